@@ -1,112 +1,102 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <string>
+#include "../common/bmp_io.h"
+#include "../common/flip.h"
 using namespace std;
 
-#pragma pack(push, 1) // Disable structure padding
-struct BMPHeader {
-    uint16_t type;
-    uint32_t size;
-    uint16_t reserved1;
-    uint16_t reserved2;
-    uint32_t offset;
-};
+enum FlipMode { kFlipH, kFlipV, kRotate180 };
 
-struct BMPInfoHeader {
-    uint32_t size;
-    int32_t width;
-    int32_t height;
-    uint16_t planes;
-    uint16_t bitsPerPixel;
-    uint32_t compression;
-    uint32_t imageSize;
-    int32_t xPixelsPerMeter;
-    int32_t yPixelsPerMeter;
-    uint32_t colorsUsed;
-    uint32_t colorsImportant;
-};
-#pragma pack(pop)
+void FlipHorizontally(const BMPReader& src, string input_num);
 
-void FlipHorizontally(vector<unsigned char>& data, int height, int width, BMPHeader &header, BMPInfoHeader &infoHeader, string input_num, int num_channel);
+void Flip(const BMPImage& image, FlipMode mode);
+
+static void usage(const char* prog) {
+    cerr << "Usage: " << prog << " k [h | v | 180] [inplace]" << " : k is input_num, "
+         << " h flips horizontally (default), v vertically and 180 rotates by 180 degrees, "
+         << " inplace rewrites input{k}.bmp itself instead of writing output{k}_flip.bmp." << endl;
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " k" << " : k is input_num" << endl;
+    if (argc < 2) {
+        usage(argv[0]);
         return 1;
     }
     string input_num = string(argv[1]);
+    FlipMode mode = kFlipH;
+    bool inplace = false;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "h") {
+            mode = kFlipH;
+        } else if (arg == "v") {
+            mode = kFlipV;
+        } else if (arg == "180") {
+            mode = kRotate180;
+        } else if (arg == "inplace") {
+            inplace = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
 
-
-    /* Read BMP */
     string filename = "input" + input_num + ".bmp";
-    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    if (inplace) {
+        BMPWriter image;
+        if (!image.edit(filename)) {
+            return 1;
+        }
+        Flip(image.image(), mode);
+        return 0;
+    }
 
-    if (!file.is_open()) {
-        std::cerr << "Error opening the file" << std::endl;
+    /* Read BMP */
+    BMPReader src;
+    if (!src.open(filename)) {
         return 1;
     }
 
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-
-    // Read the headers
-    file.read(reinterpret_cast<char*>(&header), sizeof(BMPHeader));
-    file.read(reinterpret_cast<char*>(&infoHeader), sizeof(BMPInfoHeader));
+    if (mode == kFlipH) {
+        /*Task1:  Flip Horizontally*/
+        FlipHorizontally(src, input_num);
+        return 0;
+    }
 
-    // Check if it's a BMP file
-    if (header.type != 0x4D42) {
-        std::cerr << "Not a BMP file" << std::endl;
+    // The other modes copy the input and flip the copy in place
+    BMPWriter output;
+    if (!output.create("output" + input_num + "_flip.bmp", src)) {
         return 1;
     }
-    
-    int bitsPerPixel = infoHeader.bitsPerPixel;
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int num_channel = bitsPerPixel / 8;
-    int imageSize = width * height * num_channel; // Each pixel has RGB or RGBA
-
-    // Allocate memory to store pixel data
-    std::vector<unsigned char> data(imageSize);
-    // Read pixel data
-    file.read(reinterpret_cast<char*>(data.data()), imageSize);
-    // Close the file
-    file.close();
-    
-
-
-    /*Task1:  Flip Horizontally*/
-    FlipHorizontally(data, height, width, header, infoHeader, input_num, num_channel);
-
-    
+    const BMPConstImage& in = src.image();
+    const BMPImage& out = output.image();
+    for (int y = 0; y < in.height; y++) {
+        memcpy(out.row(y), in.row(y), in.rowBytes());
+    }
+    Flip(out, mode);
     return 0;
 }
 
-void FlipHorizontally(vector<unsigned char>& data, int height, int width, BMPHeader &header, BMPInfoHeader &infoHeader, string input_num, int num_channel){
-    std::vector<unsigned char> data_copy(data);
-    for(int y = 0; y < height; y++){
-        for(int x = 0; x < width; x++){
-            int index = num_channel * (x + y * width);
-            int target_index = num_channel * ((width - 1 - x) + y * width);
-            for(int c = 0; c < num_channel; c++){
-                data_copy[index+c] = data[target_index+c];
-            }
-        }
-    }
+void FlipHorizontally(const BMPReader& src, string input_num){
     string filename = "output" + input_num + "_flip.bmp";
-    ofstream output(filename, ios::out | ios::binary);
-    if (!output.is_open()) {
-        std::cerr << "Error creating the output file" << std::endl;
+    BMPWriter output;
+    if (!output.create(filename, src)) {
         return;
     }
 
-    // Write the headers
-    output.write(reinterpret_cast<const char*>(&header), sizeof(BMPHeader));
-    output.write(reinterpret_cast<const char*>(&infoHeader), sizeof(BMPInfoHeader));
-
-    // Write the quantized pixel data
-    output.write(reinterpret_cast<const char*>(data_copy.data()), data_copy.size());
+    const BMPConstImage& in = src.image();
+    const BMPImage& out = output.image();
+    for(int y = 0; y < in.height; y++){
+        mirrorRow(in.row(y), out.row(y), in.width, in.num_channel);
+    }
+}
 
-    // Close the output file
-    output.close();
+void Flip(const BMPImage& image, FlipMode mode) {
+    if (mode == kFlipH) {
+        flipHorizontal(image);
+    } else if (mode == kFlipV) {
+        flipVertical(image);
+    } else {
+        rotate180(image);
+    }
 }
@@ -1,43 +1,54 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <string>
+#include <cmath>
+#include <algorithm>
+#include "../common/bmp_io.h"
+#include "../common/flip.h"
+#include "../common/resample.h"
+#include "../common/point_ops.h"
+#include "../common/pyramid.h"
 
 using namespace std;
 
-#pragma pack(push, 1) // Disable structure padding
-struct BMPHeader {
-    uint16_t type;
-    uint32_t size;
-    uint16_t reserved1;
-    uint16_t reserved2;
-    uint32_t offset;
-};
-
-struct BMPInfoHeader {
-    uint32_t size;
-    int32_t width;
-    int32_t height;
-    uint16_t planes;
-    uint16_t bitsPerPixel;
-    uint32_t compression;
-    uint32_t imageSize;
-    int32_t xPixelsPerMeter;
-    int32_t yPixelsPerMeter;
-    uint32_t colorsUsed;
-    uint32_t colorsImportant;
-};
-#pragma pack(pop)
-
-void FlipHorizontally(vector<unsigned char>& data, int height, int width, BMPHeader &header, BMPInfoHeader &infoHeader, string input_num, int num_channel);
-
-void Scaling(vector<unsigned char>& data, string up_down, int height, int width, BMPHeader &header, BMPInfoHeader &infoHeader, float rate, string input_num, int num_channel);
-
-void Resolution(vector<unsigned char>& data, int reso, string input_num, BMPHeader &header, BMPInfoHeader &infoHeader, int num_channel);
+void FlipHorizontally(const BMPReader& src, string input_num);
+
+void Scaling(const BMPReader& src, string up_down, float rate, string input_num, ResampleFilter filter);
+
+void Resolution(const BMPReader& src, int reso, string input_num);
+
+void Pyramid(const BMPReader& src, int levels, PyramidReduce reduce, string input_num);
+
+void AllTasks(const BMPReader& src, string input_num, ResampleFilter filter);
+
+static void usage(const char* prog) {
+    cerr << "Usage: " << prog << " k [filter] [separate] | k pyramid [box | gauss]" << " : k is input_num, " << " filter is the scaling filter: nearest, bilinear (default), bicubic, lanczos3 or area, "
+         << " separate runs each task over the whole image in turn instead of producing every output from one pass, "
+         << " pyramid writes the 1/2, 1/4 and 1/8 size levels instead, reduced by 2x2 averages (box, the default) or a 5x5 Gaussian." << endl;
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " k" << " : k is input_num" << endl;
+    ResampleFilter filter = kResampleBilinear;
+    bool pyramid = (argc >= 3) && (string(argv[2]) == "pyramid");
+    PyramidReduce reduce = kPyramidBox;
+    if (pyramid && (argc == 4) && (string(argv[3]) == "gauss")) {
+        reduce = kPyramidGaussian;
+    }
+    bool separate = false;
+    bool valid = (argc >= 2);
+    if (pyramid) {
+        valid = (argc == 3) || ((argc == 4) && ((string(argv[3]) == "box") || (string(argv[3]) == "gauss")));
+    } else {
+        for (int i = 2; valid && (i < argc); i++) {
+            if ((string(argv[i]) == "separate") && !separate) {
+                separate = true;
+            } else {
+                valid = (i == 2) && parseResampleFilter(argv[i], filter);
+            }
+        }
+    }
+    if (!valid) {
+        usage(argv[0]);
         return 1;
     }
     string input_num = string(argv[1]);
@@ -45,169 +56,145 @@ int main(int argc, char* argv[]) {
 
     /* Read BMP */
     string filename = "input" + input_num + ".bmp";
-    std::ifstream file(filename, std::ios::in | std::ios::binary);
-
-    if (!file.is_open()) {
-        std::cerr << "Error opening the file" << std::endl;
+    BMPReader src;
+    if (!src.open(filename)) {
         return 1;
     }
 
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-
-    // Read the headers
-    file.read(reinterpret_cast<char*>(&header), sizeof(BMPHeader));
-    file.read(reinterpret_cast<char*>(&infoHeader), sizeof(BMPInfoHeader));
-
-    // Check if it's a BMP file
-    if (header.type != 0x4D42) {
-        std::cerr << "Not a BMP file" << std::endl;
-        return 1;
+    /* Half, quarter and eighth size levels from one pass over the image */
+    if (pyramid) {
+        Pyramid(src, 4, reduce, input_num);
+        return 0;
     }
-    
-    int bitsPerPixel = infoHeader.bitsPerPixel;
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int num_channel = bitsPerPixel / 8;
-    int imageSize = width * height * num_channel; // Each pixel has RGB or RGBA
-
-    // Allocate memory to store pixel data
-    std::vector<unsigned char> data(imageSize);
-    // Read pixel data
-    file.read(reinterpret_cast<char*>(data.data()), imageSize);
-    // Close the file
-    file.close();
-    
 
+    /* Every output from one pass over the source rows */
+    if (!separate) {
+        AllTasks(src, input_num, filter);
+        return 0;
+    }
 
     /*Task1:  Flip Horizontally*/
-    FlipHorizontally(data, height, width, header, infoHeader, input_num, num_channel);
-    
+    FlipHorizontally(src, input_num);
+
     /*Task 2: Resolution*/
-    Resolution(data, 6, input_num, header, infoHeader, num_channel);
-    Resolution(data, 4, input_num, header, infoHeader, num_channel);
-    Resolution(data, 2, input_num, header, infoHeader, num_channel);    
+    Resolution(src, 6, input_num);
+    Resolution(src, 4, input_num);
+    Resolution(src, 2, input_num);
 
     /*Task 3: Down/Up Scaling*/
     // downscale 1.5
-    Scaling(data, "down", height, width, header, infoHeader, 1.5, input_num, num_channel);
+    Scaling(src, "down", 1.5, input_num, filter);
     // upscale 1.5
-    Scaling(data, "up", height, width, header, infoHeader, 1 / 1.5, input_num, num_channel);
-    
+    Scaling(src, "up", 1 / 1.5, input_num, filter);
+
     return 0;
 }
 
-void FlipHorizontally(vector<unsigned char>& data, int height, int width, BMPHeader &header, BMPInfoHeader &infoHeader, string input_num, int num_channel){
-    std::vector<unsigned char> data_copy(data);
-    for(int y = 0; y < height; y++){
-        for(int x = 0; x < width; x++){
-            int index = num_channel * (x + y * width);
-            int target_index = num_channel * ((width - 1 - x) + y * width);
-            for(int c = 0; c < num_channel; c++){
-                data_copy[index+c] = data[target_index+c];
-            }
-        }
-    }
+// Mirror one row of pixels
+void FlipHorizontally(const BMPReader& src, string input_num){
     string filename = "output" + input_num + "_flip.bmp";
-    ofstream output(filename, ios::out | ios::binary);
-    if (!output.is_open()) {
-        std::cerr << "Error creating the output file" << std::endl;
+    BMPWriter output;
+    if (!output.create(filename, src)) {
         return;
     }
 
-    // Write the headers
-    output.write(reinterpret_cast<const char*>(&header), sizeof(BMPHeader));
-    output.write(reinterpret_cast<const char*>(&infoHeader), sizeof(BMPInfoHeader));
-
-    // Write the quantized pixel data
-    output.write(reinterpret_cast<const char*>(data_copy.data()), data_copy.size());
-
-    // Close the output file
-    output.close();
+    const BMPConstImage& in = src.image();
+    const BMPImage& out = output.image();
+    for(int y = 0; y < in.height; y++){
+        mirrorRow(in.row(y), out.row(y), in.width, in.num_channel);
+    }
 }
 
-void Resolution(vector<unsigned char>& data, int reso, string input_num, BMPHeader &header, BMPInfoHeader &infoHeader, int num_channel) {
-    std::vector<unsigned char> data_copy(data);
-    // for(int i = 0; i < data.size(); i++){
-    //     data_copy.push_back(data[i]);
-    // }
-
+void Resolution(const BMPReader& src, int reso, string input_num) {
     int k = 8 - reso; // k is the number of discarded bits
-    for(int i = 0; i < data_copy.size(); i+=num_channel){ 
-        // discard k least significant bits, and shift back to padding them with 0
-        for(int c = 0; c < num_channel; c++){
-            data_copy[i+c] = (data_copy[i+c] >> k) << k;
-        }
-    }
 
     string filename = "output" + input_num + "_" + to_string(k/2) + ".bmp";
-    ofstream output(filename, ios::out | ios::binary);
-    if (!output.is_open()) {
-        std::cerr << "Error creating the output file" << std::endl;
+    BMPWriter output;
+    if (!output.create(filename, src)) {
         return;
     }
 
-    // Write the headers
-    output.write(reinterpret_cast<const char*>(&header), sizeof(BMPHeader));
-    output.write(reinterpret_cast<const char*>(&infoHeader), sizeof(BMPInfoHeader));
-
-    // Write the quantized pixel data
-    output.write(reinterpret_cast<const char*>(data_copy.data()), data_copy.size());
+    const BMPConstImage& in = src.image();
+    const BMPImage& out = output.image();
+    size_t row_bytes = in.rowBytes();
+    for(int y = 0; y < in.height; y++){
+        const unsigned char* src_row = in.row(y);
+        unsigned char* dst_row = out.row(y);
+        // discard k least significant bits, and shift back to padding them with 0
+        maskBits(src_row, dst_row, row_bytes, static_cast<unsigned char>(0xFF << k));
+    }
+}
 
-    // Close the output file
-    output.close();
+// Size of one side scaled down by rate
+static int scaledSize(int size, float rate) {
+    return max(1, int(lround(size / rate)));
 }
 
-void Scaling(vector<unsigned char>& data, string up_down, int height, int width, BMPHeader &header, BMPInfoHeader &infoHeader, float rate, string input_num, int num_channel) {
-    // round to the nearest neighbor
-    int new_height = int(height / rate); 
-    int new_width = int(round((width / rate) / 4.0) * 4.0); //approximate to the nearest multiple of 4
-    int new_ImageSize = new_height * new_width * num_channel;
-    // cout << "w, h, image_size: " << new_width << " " << new_height << " " << new_ImageSize << endl;
-    
-    vector<unsigned char> scaledData(new_ImageSize, 255);
-    float sourceX, sourceY, x_weight, y_weight;
-    int sourceX_floor, sourceY_floor;
-    for(int y = 0; y < new_height; y++){
-        for(int x = 0; x < new_width; x++){
-            sourceX = x * (width - 1) / (new_width - 1);
-            sourceY = y * (height - 1) / (new_height - 1);
-            sourceX_floor = int(sourceX);
-            sourceY_floor = int(sourceY);
-            x_weight = sourceX - sourceX_floor;
-            y_weight = sourceY - sourceY_floor;
-    
-            for(int c = 0; c < num_channel; c++){
-                int b1 = data[num_channel * (sourceX_floor + sourceY_floor * width) + c];
-                int b2 = data[num_channel * (sourceX_floor + (sourceY_floor+1) * width) + c];
-                int b3 = data[num_channel * ((sourceX_floor+1) + sourceY_floor * width) + c];
-                int b4 = data[num_channel * ((sourceX_floor+1) + (sourceY_floor+1) * width) + c];
-                int tmp = static_cast<int>((1 - x_weight) * (1 - y_weight) * b1 + (1 - x_weight) * y_weight * b2 +
-                            x_weight * (1 - y_weight) * b3 + x_weight * y_weight * b4);
-                
-                scaledData[num_channel * (x + y * new_width) + c] = static_cast<unsigned char>(tmp);
-            }
-        }
-    }
-    
+void Scaling(const BMPReader& src, string up_down, float rate, string input_num, ResampleFilter filter) {
+    const BMPConstImage& in = src.image();
+    int new_height = scaledSize(in.height, rate);
+    int new_width = scaledSize(in.width, rate);
+
     string filename = "output" + input_num + "_" + up_down + ".bmp";
-    ofstream output(filename, ios::out | ios::binary);
-    if (!output.is_open()) {
-        std::cerr << "Error creating the output file" << std::endl;
+    BMPWriter output;
+    if (!output.create(filename, src, new_width, new_height)) {
         return;
     }
 
-    infoHeader.width = new_width;
-    infoHeader.height = new_height;
-    infoHeader.imageSize = new_ImageSize;
+    resampleImage(in, output.image(), filter);
+}
 
-    // Write the headers
-    output.write(reinterpret_cast<const char*>(&header), sizeof(BMPHeader));
-    output.write(reinterpret_cast<const char*>(&infoHeader), sizeof(BMPInfoHeader));
+void Pyramid(const BMPReader& src, int levels, PyramidReduce reduce, string input_num) {
+    ImagePyramid pyramid;
+    pyramid.build(src.image(), levels, reduce);
+    for (int l = 1; l < pyramid.levels(); l++) {
+        BMPConstImage level = pyramid.level(l);
+        string filename = "output" + input_num + "_pyr" + to_string(l) + ".bmp";
+        BMPWriter output;
+        if (!output.create(filename, src, level.width, level.height)) {
+            return;
+        }
+        // Levels are stored with the same row order and padding as the file
+        std::memcpy(output.image().pixels, level.pixels, level.stride * size_t(level.height));
+    }
+}
 
-    // Write the scaled data
-    output.write(reinterpret_cast<const char*>(scaledData.data()), new_ImageSize);
+// The flip, the three bit depths and both scalings in one walk over the
+// source: each row is read once and every output that depends on it is
+// written while it is in cache. The scaled rows come out as soon as the
+// source rows they need have been seen.
+void AllTasks(const BMPReader& src, string input_num, ResampleFilter filter) {
+    const BMPConstImage& in = src.image();
+    BMPWriter flip;
+    if (!flip.create("output" + input_num + "_flip.bmp", src)) {
+        return;
+    }
+    const int reso[3] = {6, 4, 2};
+    BMPWriter quantised[3];
+    for (int i = 0; i < 3; i++) {
+        if (!quantised[i].create("output" + input_num + "_" + to_string((8 - reso[i]) / 2) + ".bmp", src)) {
+            return;
+        }
+    }
+    const float rates[2] = {1.5, 1 / 1.5};
+    const char* const names[2] = {"down", "up"};
+    BMPWriter scaled[2];
+    RowResampler resamplers[2];
+    for (int i = 0; i < 2; i++) {
+        if (!scaled[i].create("output" + input_num + "_" + names[i] + ".bmp", src, scaledSize(in.width, rates[i]), scaledSize(in.height, rates[i]))) {
+            return;
+        }
+        resamplers[i].begin(in.width, in.height, in.num_channel, scaled[i].image(), filter);
+    }
 
-    // Close the output file
-    output.close();
+    size_t row_bytes = in.rowBytes();
+    for (int y = 0; y < in.height; y++) {
+        const unsigned char* src_row = in.row(y);
+        mirrorRow(src_row, flip.image().row(y), in.width, in.num_channel);
+        for (int i = 0; i < 3; i++) {
+            maskBits(src_row, quantised[i].image().row(y), row_bytes, static_cast<unsigned char>(0xFF << (8 - reso[i])));
+        }
+        resamplers[0].pushRow(src_row);
+        resamplers[1].pushRow(src_row);
+    }
 }
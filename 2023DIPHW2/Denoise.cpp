@@ -1,113 +1,117 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <string>
 #include <cmath>
+#include <cstdlib>
+#include "../common/bmp_io.h"
+#include "../common/batch.h"
+#include "../common/row_stream.h"
+#include "../common/box_blur.h"
+#include "../common/gaussian.h"
 
 using namespace std;
 
-#pragma pack(push, 1) // Disable structure padding
-struct BMPHeader {
-    uint16_t type;
-    uint32_t size;
-    uint16_t reserved1;
-    uint16_t reserved2;
-    uint32_t offset;
-};
-
-struct BMPInfoHeader {
-    uint32_t size;
-    int32_t width;
-    int32_t height;
-    uint16_t planes;
-    uint16_t bitsPerPixel;
-    uint32_t compression;
-    uint32_t imageSize;
-    int32_t xPixelsPerMeter;
-    int32_t yPixelsPerMeter;
-    uint32_t colorsUsed;
-    uint32_t colorsImportant;
-};
-#pragma pack(pop)
+static void usage(const char* prog) {
+    cerr << "Usage: " << prog << " k|batch <inputs> <output dir> d [gauss [sigma]] [stream]" << " : k is input_num, "
+         << " batch processes every BMP in the <inputs> directory or list file into <output dir>, " << " d is enhance degree, which should be either 1 or 2, "
+         << " gauss uses a Gaussian blur instead of the box blur, " << " stream processes the image a few rows at a time"
+         << " (a Gaussian with sigma 8 or more is then computed with the convolution instead of the recursive filter, which differs by a level or two)." << endl;
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        cerr << "Usage: " << argv[0] << " k d" << " : k is input_num, " << " d is enhance degree, which should be either 1 or 2." << endl;
+    BatchJob batch;
+    if (!parseBatchArgs(argc, argv, batch) || (argc < 3)) {
+        usage(argv[0]);
         return 1;
     }
     string input_num = string(argv[1]);
     int enhance_degree = stoi(string(argv[2]));
     if ((enhance_degree < 1) || (enhance_degree > 2)) {
-        cerr << "Usage: " << argv[0] << " k d" << " : k is input_num, " << " d is enhance degree, which should be either 1 or 2." << endl;
-        return 1;
-    }
-
-    /* Read BMP */
-    string filename = "input" + input_num + ".bmp";
-    std::ifstream file(filename, std::ios::in | std::ios::binary);
-
-    if (!file.is_open()) {
-        std::cerr << "Error opening the file" << std::endl;
+        usage(argv[0]);
         return 1;
     }
 
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-
-    // Read the headers
-    file.read(reinterpret_cast<char*>(&header), sizeof(BMPHeader));
-    file.read(reinterpret_cast<char*>(&infoHeader), sizeof(BMPInfoHeader));
-
-    // Check if it's a BMP file
-    if (header.type != 0x4D42) {
-        std::cerr << "Not a BMP file" << std::endl;
-        return 1;
-    }
-    
-    int bitsPerPixel = infoHeader.bitsPerPixel;
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int num_channel = bitsPerPixel / 8;
-    int imageSize = width * height * num_channel; // Each pixel has RGB or RGBA
-
-    // Allocate memory to store pixel data
-    std::vector<unsigned char> data(imageSize);
-    // Read pixel data
-    file.read(reinterpret_cast<char*>(data.data()), imageSize);
-    // Close the file
-    file.close();
-
-    /* Apply Gaussian blur to denoise the image */
     int blurRadius = 3; // Adjust the blur radius for more or less blurring
+    double sigma = 2.0; // Gaussian sigma, chosen to smooth about as much as the box
     if(enhance_degree == 2){
         blurRadius = 5;
+        sigma = 3.2;
     }
-    for (int y = blurRadius; y < height - blurRadius; y++) {
-        for (int x = num_channel * blurRadius; x < (width - blurRadius) * num_channel; x += num_channel) {
-            for (int c = 0; c < num_channel; c++) {
-                int sum = 0;
-                for (int j = -blurRadius; j <= blurRadius; j++) {
-                    for (int i = -blurRadius; i <= blurRadius; i++) {
-                        sum += data[(y + j) * (width * num_channel) + (x + i * num_channel) + c];
-                    }
+    bool gauss = false;
+    bool stream = false;
+    for (int i = 3; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "gauss" && !gauss) {
+            gauss = true;
+            if (i + 1 < argc && string(argv[i + 1]) != "stream") {
+                sigma = atof(argv[++i]);
+                if (!(sigma > 0.0)) {
+                    usage(argv[0]);
+                    return 1;
                 }
-                int blurredValue = sum / ((2 * blurRadius + 1) * (2 * blurRadius + 1));
-                data[y * (width * num_channel) + x + c] = static_cast<unsigned char>(blurredValue);
             }
+        } else if (arg == "stream" && !stream) {
+            stream = true;
+        } else {
+            usage(argv[0]);
+            return 1;
         }
     }
+    if (batch.active() && stream) {
+        cerr << "batch works on whole images and cannot be streamed" << endl;
+        return 1;
+    }
+    string filename = "input" + input_num + ".bmp";
     string output_filename = "output3_" + to_string(enhance_degree) + ".bmp";
-    ofstream output(output_filename, ios::out | ios::binary);
-    if (!output.is_open()) {
-        std::cerr << "Error creating the output file" << std::endl;
-        return -1;
+
+    /* Stream the image through a window of rows around the current one */
+    if (stream && gauss) {
+        // The recursive filter needs whole columns, so streaming always uses the FIR
+        GaussianFir fir;
+        fir.reset(1, 1, sigma);
+        bool ok = streamRows(filename, output_filename, fir.radius(), [&](const RowWindow& win, unsigned char* out) {
+            if (win.y == 0) {
+                fir.reset(win.width, win.num_channel, sigma);
+            }
+            fir.blurRow([&](int j) { return win.row(j); }, out);
+        });
+        return ok ? 0 : 1;
+    }
+    if (stream) {
+        BoxBlur blur;
+        bool ok = streamRows(filename, output_filename, blurRadius + 1, [&](const RowWindow& win, unsigned char* out) {
+            if (win.y == 0) {
+                blur.reset(win.width, win.num_channel, blurRadius);
+            }
+            blur.blurRow(win.y, [&](int j) { return win.row(j); }, out);
+        });
+        return ok ? 0 : 1;
     }
 
-    output.write(reinterpret_cast<const char*>(&header), sizeof(BMPHeader));
-    output.write(reinterpret_cast<const char*>(&infoHeader), sizeof(BMPInfoHeader));
-    output.write(reinterpret_cast<const char*>(data.data()), data.size());
+    /* Blur the image to denoise it */
+    auto denoise = [&](const BMPConstImage& in, const BMPImage& out) {
+        if (gauss) {
+            gaussianBlur(in, out, sigma);
+        } else {
+            boxBlur(in, out, blurRadius);
+        }
+    };
+    if (batch.active()) {
+        return runBatch(batch, denoise) ? 0 : 1;
+    }
+
+    /* Read BMP */
+    BMPReader src;
+    if (!src.open(filename)) {
+        return 1;
+    }
+
+    BMPWriter output;
+    if (!output.create(output_filename, src)) {
+        return -1;
+    }
 
-    output.close();
+    denoise(src.image(), output.image());
 
     return 0;
 }
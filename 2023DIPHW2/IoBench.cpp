@@ -0,0 +1,154 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../common/bmp_io.h"
+#include "../common/uring_io.h"
+
+using namespace std;
+
+static void usage(const char* prog) {
+    cerr << "Usage: " << prog << " dir [count [size]]" << " : dir is a scratch directory, "
+         << " count is the number of BMPs written to it (default 4000), " << " size their width and height (default 64)." << endl;
+}
+
+// Write count size x size BMPs into dir, named dir/bench<i>.bmp; created
+// tells whether dir was made here
+static bool makeFiles(const string& dir, int count, int size, vector<string>& names, bool& created) {
+    size_t offset = sizeof(BMPHeader) + sizeof(BMPInfoHeader);
+    vector<unsigned char> bytes(offset + bmpRowStride(size, 3) * size_t(size));
+    BMPHeader header = BMPHeader();
+    BMPInfoHeader infoHeader = BMPInfoHeader();
+    header.type = 0x4D42;
+    infoHeader.size = sizeof(BMPInfoHeader);
+    infoHeader.planes = 1;
+    infoHeader.bitsPerPixel = 24;
+    memcpy(bytes.data(), &header, sizeof(header));
+    memcpy(bytes.data() + sizeof(header), &infoHeader, sizeof(infoHeader));
+    bmpPatchHeader(bytes.data(), uint32_t(offset), size, size, 3, false);
+    for (size_t i = offset; i < bytes.size(); i++) bytes[i] = static_cast<unsigned char>(i * 2654435761u >> 24);
+
+    created = (mkdir(dir.c_str(), 0755) == 0);
+    for (int i = 0; i < count; i++) {
+        names.push_back(dir + "/bench" + to_string(i) + ".bmp");
+        int fd = open(names.back().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        IoRequest request = {fd, bytes.data(), bytes.size(), false};
+        if (fd < 0 || !ioBlocking(request, true)) {
+            cerr << "Cannot write " << names.back() << endl;
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        close(fd);
+    }
+    sync();
+    return true;
+}
+
+// Drop the files from the page cache where the kernel allows it, so that the
+// reads go to the device
+static void evict(const vector<string>& names) {
+    for (size_t i = 0; i < names.size(); i++) {
+        int fd = open(names[i].c_str(), O_RDONLY);
+        if (fd < 0) continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// Read every file (write = false) or rewrite it (write = true) in groups of
+// depth requests, putting the seconds taken in seconds; false (after
+// reporting the file) if any file could not be opened, read or written
+static bool pass(BulkIo& io, const vector<string>& names, vector<vector<unsigned char> >& buffers, bool write, double& seconds) {
+    size_t depth = buffers.size();
+    vector<IoRequest> requests;
+    auto closeAll = [&] {
+        for (size_t r = 0; r < requests.size(); r++) close(requests[r].fd);
+    };
+    auto t0 = chrono::steady_clock::now();
+    for (size_t first = 0; first < names.size(); first += depth) {
+        requests.clear();
+        for (size_t i = first; i < min(names.size(), first + depth); i++) {
+            int fd = write ? open(names[i].c_str(), O_WRONLY | O_TRUNC) : open(names[i].c_str(), O_RDONLY);
+            if (fd < 0) {
+                cerr << "Cannot open " << names[i] << endl;
+                closeAll();
+                return false;
+            }
+            vector<unsigned char>& buffer = buffers[i - first];
+            requests.push_back({fd, buffer.data(), buffer.size(), false});
+        }
+        if (!io.run(requests, write)) {
+            for (size_t r = 0; r < requests.size(); r++) {
+                if (!requests[r].ok) cerr << (write ? "Error writing " : "Error reading ") << names[first + r] << endl;
+            }
+            closeAll();
+            return false;
+        }
+        closeAll();
+    }
+    if (write) sync();
+    seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    return true;
+}
+
+// Remove the benchmark files, and dir if it was made for them
+static void removeFiles(const string& dir, const vector<string>& names, bool created) {
+    for (size_t i = 0; i < names.size(); i++) unlink(names[i].c_str());
+    if (created) rmdir(dir.c_str());
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 4) {
+        usage(argv[0]);
+        return 1;
+    }
+    string dir = argv[1];
+    int count = (argc > 2) ? atoi(argv[2]) : 4000;
+    int size = (argc > 3) ? atoi(argv[3]) : 64;
+    if (count <= 0 || size <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    vector<string> names;
+    bool created = false;
+    if (!makeFiles(dir, count, size, names, created)) {
+        removeFiles(dir, names, created);
+        return 1;
+    }
+    size_t file_bytes = sizeof(BMPHeader) + sizeof(BMPInfoHeader) + bmpRowStride(size, 3) * size_t(size);
+    double total_mb = double(file_bytes) * count / 1e6;
+    printf("%d files of %zu bytes in %s\n", count, file_bytes, dir.c_str());
+
+    const unsigned depth = 64;
+    IoBackend backends[] = {kIoSync, kIoUring};
+    for (IoBackend backend : backends) {
+        BulkIo io(depth, backend);
+        if (!io.ok()) {
+            printf("  %-13s not available, not measured\n", "io_uring");
+            continue;
+        }
+        vector<vector<unsigned char> > buffers(depth, vector<unsigned char>(file_bytes));
+        vector<iovec> iov;
+        for (size_t i = 0; i < buffers.size(); i++) iov.push_back({buffers[i].data(), buffers[i].size()});
+        io.registerBuffers(iov);
+
+        evict(names);
+        double read_s = 0, write_s = 0;
+        if (!pass(io, names, buffers, false, read_s) || !pass(io, names, buffers, true, write_s)) {
+            cerr << "Measurement with " << io.backendName() << " aborted" << endl;
+            removeFiles(dir, names, created);
+            return 1;
+        }
+        printf("  %-13s read %8.0f files/s %7.1f MB/s   write %8.0f files/s %7.1f MB/s\n", io.backendName(),
+               count / read_s, total_mb / read_s, count / write_s, total_mb / write_s);
+    }
+
+    removeFiles(dir, names, created);
+    return 0;
+}
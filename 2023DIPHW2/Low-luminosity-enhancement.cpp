@@ -1,108 +1,186 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <string>
+#include <cstdlib>
+#include <cctype>
+#include <cstdio>
+#include "../common/bmp_io.h"
+#include "../common/batch.h"
+#include "../common/point_ops.h"
+#include "../common/tone_lut.h"
+#include "../common/histogram.h"
+#include "../common/clahe.h"
 
 using namespace std;
 
-#pragma pack(push, 1) // Disable structure padding
-struct BMPHeader {
-    uint16_t type;
-    uint32_t size;
-    uint16_t reserved1;
-    uint16_t reserved2;
-    uint32_t offset;
-};
+static void usage(const char* prog) {
+    cerr << "Usage: " << prog << " k|batch <inputs> <output dir> d [equalize | stretch [percent] | clahe [tiles [clip]]] [luma] [add n | contrast f | bits b | gamma g]..." << " : k is input_num, "
+         << " batch processes every BMP in the <inputs> directory or list file into <output dir>, " << " d is enhance degree, which should be either 1 or 2, "
+         << " equalize or stretch replace the brightness lift with histogram equalisation or a contrast stretch that clips percent (default 0.5) of the pixels at each end, "
+         << " clahe equalises each tile of a tiles grid (N or NxM, default 8x8) with histograms clipped at clip times the mean bin (default 2), blending between tiles, "
+         << " per channel or, with luma, one curve from the luma histogram, "
+         << " the optional tone operators are applied after the brightness lift, in order." << endl;
+}
 
-struct BMPInfoHeader {
-    uint32_t size;
-    int32_t width;
-    int32_t height;
-    uint16_t planes;
-    uint16_t bitsPerPixel;
-    uint32_t compression;
-    uint32_t imageSize;
-    int32_t xPixelsPerMeter;
-    int32_t yPixelsPerMeter;
-    uint32_t colorsUsed;
-    uint32_t colorsImportant;
+enum AdaptiveCurve {
+    kCurveNone,
+    kCurveEqualize,
+    kCurveStretch,
+    kCurveClahe
 };
-#pragma pack(pop)
+
+// The per-image curve for in, followed by the fixed chain
+static ToneLut adaptiveLut(const BMPConstImage& in, AdaptiveCurve curve, HistogramKind kind, double clip, const ToneLut& chain) {
+    Histogram h = histogram(in, kind);
+    ToneLut lut;
+    for (int c = 0; c < 3; c++) {
+        unsigned char table[256];
+        const uint64_t* bins = h.bins[(kind == kHistogramLuma) ? 0 : c];
+        if (curve == kCurveEqualize) {
+            equalizeTable(bins, h.total, table);
+        } else {
+            stretchTable(bins, h.total, clip, table);
+        }
+        lut.mapChannel(c, [&](int v) { return table[v]; });
+    }
+    for (int c = 0; c < ToneLut::kMaxChannel; c++) {
+        lut.mapChannel(c, [&](int v) { return chain.table(c)[v]; });
+    }
+    return lut;
+}
+
+// Append the tone operators in args to lut; false on a malformed operator
+static bool parseToneChain(int argc, char* argv[], ToneLut& lut) {
+    for (int i = 0; i < argc; i += 2) {
+        string op = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        double value = atof(argv[i + 1]);
+        if (op == "add") {
+            lut.add(int(value));
+        } else if (op == "contrast") {
+            lut.contrast(value);
+        } else if (op == "bits" && value >= 1 && value <= 8) {
+            lut.keepBits(int(value));
+        } else if (op == "gamma" && value > 0) {
+            lut.gamma(value);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        cerr << "Usage: " << argv[0] << " k d" << " : k is input_num, " << " d is enhance degree, which should be either 1 or 2." << endl;
+    BatchJob batch;
+    if (!parseBatchArgs(argc, argv, batch) || (argc < 3)) {
+        usage(argv[0]);
         return 1;
     }
     string input_num = string(argv[1]);
     int enhance_degree = stoi(string(argv[2]));
     if ((enhance_degree < 1) || (enhance_degree > 2)) {
-        cerr << "Usage: " << argv[0] << " k d" << " : k is input_num, " << " d is enhance degree, which should be either 1 or 2." << endl;
+        usage(argv[0]);
         return 1;
     }
 
-
-    /* Read BMP */
-    string filename = "input" + input_num + ".bmp";
-    std::ifstream file(filename, std::ios::in | std::ios::binary);
-
-    if (!file.is_open()) {
-        std::cerr << "Error opening the file" << std::endl;
-        return 1;
+    unsigned char increase_intensity = 20;
+    if (enhance_degree == 2) {
+        increase_intensity = 40;
+    }
+    /* Histogram equalisation, stretch or CLAHE instead of the fixed lift */
+    AdaptiveCurve curve = kCurveNone;
+    HistogramKind kind = kHistogramChannels;
+    double clip = 0.005;
+    int tiles_x = 8, tiles_y = 8;
+    double clahe_clip = 2.0;
+    int next = 3;
+    if ((next < argc) && (string(argv[next]) == "equalize" || string(argv[next]) == "stretch")) {
+        curve = (string(argv[next]) == "equalize") ? kCurveEqualize : kCurveStretch;
+        next++;
+        if ((curve == kCurveStretch) && (next < argc) && (isdigit(argv[next][0]) || argv[next][0] == '.')) {
+            clip = atof(argv[next++]) / 100.0;
+            if (!(clip >= 0.0 && clip < 0.5)) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+    } else if ((next < argc) && (string(argv[next]) == "clahe")) {
+        curve = kCurveClahe;
+        next++;
+        if ((next < argc) && isdigit(argv[next][0])) {
+            int fields = sscanf(argv[next++], "%dx%d", &tiles_x, &tiles_y);
+            if (fields == 1) tiles_y = tiles_x;
+            if (tiles_x <= 0 || tiles_y <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            if ((next < argc) && (isdigit(argv[next][0]) || argv[next][0] == '.')) {
+                clahe_clip = atof(argv[next++]);
+            }
+        }
+    }
+    if (curve != kCurveNone) {
+        if ((next < argc) && (string(argv[next]) == "luma")) {
+            kind = kHistogramLuma;
+            next++;
+        }
     }
 
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-
-    // Read the headers
-    file.read(reinterpret_cast<char*>(&header), sizeof(BMPHeader));
-    file.read(reinterpret_cast<char*>(&infoHeader), sizeof(BMPInfoHeader));
-
-    // Check if it's a BMP file
-    if (header.type != 0x4D42) {
-        std::cerr << "Not a BMP file" << std::endl;
+    /* Further tone operators are fused with the lift into one lookup table */
+    ToneLut lut;
+    if (curve == kCurveNone) {
+        lut.add(increase_intensity);
+    }
+    if (!parseToneChain(argc - next, argv + next, lut)) {
+        usage(argv[0]);
         return 1;
     }
-    
-    int bitsPerPixel = infoHeader.bitsPerPixel;
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int num_channel = bitsPerPixel / 8;
-    int imageSize = width * height * num_channel; // Each pixel has RGB or RGBA
 
-    // Allocate memory to store pixel data
-    std::vector<unsigned char> data(imageSize);
-    // Read pixel data
-    file.read(reinterpret_cast<char*>(data.data()), imageSize);
-    // Close the file
-    file.close();
 
     /*Do Low-luminosity Enhancement on images*/
-    unsigned char increase_intensity = 20;
-    if (enhance_degree == 2) {
-        increase_intensity = 40;
-    }  
-    for(int i = 0; i < data.size(); i+=3){
-        // double max_channel = max(max(data[i], data[i + 1]), data[i + 2]);
-        data[i] = min(255, data[i] + increase_intensity);
-        data[i + 1] = min(255, data[i + 1] + increase_intensity);
-        data[i + 2] = min(255, data[i + 2] + increase_intensity);
+    bool chain = (argc > 3);
+    bool tones = (next < argc);
+    auto enhance = [&](const BMPConstImage& in, const BMPImage& out) {
+        if (curve == kCurveClahe) {
+            clahe(in, out, tiles_x, tiles_y, clahe_clip, kind);
+            if (tones) lut.apply(BMPConstImage(out), out);
+            return;
+        }
+        if (curve != kCurveNone) {
+            adaptiveLut(in, curve, kind, clip, lut).apply(in, out);
+            return;
+        }
+        if (chain) {
+            lut.apply(in, out);
+            return;
+        }
+        size_t row_bytes = in.rowBytes();
+        for(int y = 0; y < in.height; y++){
+            const unsigned char* src_row = in.row(y);
+            unsigned char* dst_row = out.row(y);
+            addSaturate(src_row, dst_row, row_bytes, increase_intensity);
+        }
+    };
+    if (batch.active()) {
+        return runBatch(batch, enhance) ? 0 : 1;
+    }
+
+    /* Read BMP */
+    string filename = "input" + input_num + ".bmp";
+    BMPReader src;
+    if (!src.open(filename)) {
+        return 1;
     }
 
     string output_filename = "output1_" + to_string(enhance_degree) + ".bmp";
-    ofstream output(output_filename, ios::out | ios::binary);
-    if (!output.is_open()) {
-        std::cerr << "Error creating the output file" << std::endl;
+    BMPWriter output;
+    if (!output.create(output_filename, src)) {
         return -1;
     }
 
-    output.write(reinterpret_cast<const char*>(&header), sizeof(BMPHeader));
-    output.write(reinterpret_cast<const char*>(&infoHeader), sizeof(BMPInfoHeader));
-    
-    output.write(reinterpret_cast<const char*>(data.data()), data.size());
-
-    output.close();
+    enhance(src.image(), output.image());
 
     return 0;
 }
-
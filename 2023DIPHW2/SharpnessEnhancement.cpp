@@ -1,144 +1,106 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <string>
+#include "../common/bmp_io.h"
+#include "../common/batch.h"
+#include "../common/row_stream.h"
+#include "../common/convolution.h"
 
 using namespace std;
 
-#pragma pack(push, 1) // Disable structure padding
-struct BMPHeader {
-    uint16_t type;
-    uint32_t size;
-    uint16_t reserved1;
-    uint16_t reserved2;
-    uint32_t offset;
-};
-
-struct BMPInfoHeader {
-    uint32_t size;
-    int32_t width;
-    int32_t height;
-    uint16_t planes;
-    uint16_t bitsPerPixel;
-    uint32_t compression;
-    uint32_t imageSize;
-    int32_t xPixelsPerMeter;
-    int32_t yPixelsPerMeter;
-    uint32_t colorsUsed;
-    uint32_t colorsImportant;
-};
-#pragma pack(pop)
-
-// Function to apply sharpening filter to the image data
-void applySharpeningFilter(std::vector<unsigned char>& data, int width, int height, int enhance_degree) {
-    std::vector<unsigned char> resultData = data; // Create a copy of the data
-
-    
-    int kernel[3][3] = {
-            {0, -1, 0},
-            {-1,  5, -1},
-            {0, -1, 0}
-        };
-
+// Sharpen one row with the kernel for the enhance degree; rows[j] is the
+// source row j - 1 rows away
+void sharpenRow(const unsigned char* const rows[3], unsigned char* dst_row, int width, int num_channel, int enhance_degree, BorderMode mode) {
     if (enhance_degree == 2) /* Composite Laplacian kernell 2 (sharper) */
     {
-        for(int i = 0; i < 3; i++) {
-            for(int j = 0; j < 3; j++) {
-                kernel[i][j] = -1;
-                if ((i == 1) && (j == 1))
-                {
-                    kernel[i][j] = 9;
-                }                
-            }
-        }
+        convolveRow<SharpenKernel9>(rows, dst_row, width, num_channel, mode);
+    } else {
+        convolveRow<SharpenKernel5>(rows, dst_row, width, num_channel, mode);
     }
+}
 
-    int channels = 3; // Assuming RGB image (3 channels)
-
-    for (int y = 1; y < (height - 1); y++){
-        for (int x = 1; x < (width - 1); x++){
-            for(int c = 0; c < channels; c++){
-                int sum = 0;
-                for(int j = -1; j <= 1; j++){
-                    for(int i = -1; i <= 1; i++){
-                        sum += data[(y + j) * (width * channels) + (x + i) * channels + c] * kernel[j + 1][i + 1];
-                    }
-                }
-                if (sum < 0) sum = 0;
-                if (sum > 255) sum = 255;
-                resultData[y * (width * channels) + x * channels + c] = static_cast<unsigned char>(sum);
-            }
-        }
+// Function to apply sharpening filter to the image data, in parallel bands of rows
+void applySharpeningFilter(const BMPConstImage& in, const BMPImage& out, int enhance_degree, BorderMode mode) {
+    if (enhance_degree == 2) {
+        convolveImage<SharpenKernel9>(in, out, mode);
+    } else {
+        convolveImage<SharpenKernel5>(in, out, mode);
     }
+}
 
-    data = resultData; // Update the data with the sharpened result
+static void usage(const char* prog) {
+    cerr << "Usage: " << prog << " k|batch <inputs> <output dir> d [clamp | reflect | wrap] [stream]" << " : k is input_num, "
+         << " batch processes every BMP in the <inputs> directory or list file into <output dir>, " << " d is enhance degree, which should be either 1 or 2, "
+         << " clamp, reflect or wrap picks the pixels used past the border (clamp by default), " << " stream processes the image a few rows at a time." << endl;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        cerr << "Usage: " << argv[0] << " k d" << " : k is input_num, " << " d is enhance degree, which should be either 1 or 2." << endl;
+    BatchJob batch;
+    if (!parseBatchArgs(argc, argv, batch) || (argc < 3)) {
+        usage(argv[0]);
         return 1;
     }
     string input_num = string(argv[1]);
     int enhance_degree = stoi(string(argv[2]));
     if ((enhance_degree < 1) || (enhance_degree > 2)) {
-        cerr << "Usage: " << argv[0] << " k d" << " : k is input_num, " << " d is enhance degree, which should be either 1 or 2." << endl;
+        usage(argv[0]);
+        return 1;
+    }
+    BorderMode mode = kBorderClamp;
+    bool stream = false;
+    for (int i = 3; i < argc; i++) {
+        string arg = argv[i];
+        if ((arg == "stream") && !stream) {
+            stream = true;
+        } else if ((i == 3) && (arg == "clamp" || arg == "reflect" || arg == "wrap")) {
+            mode = (arg == "clamp") ? kBorderClamp : (arg == "reflect") ? kBorderReflect : kBorderWrap;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (stream && (mode == kBorderWrap)) {
+        cerr << "wrap needs the whole image and cannot be streamed" << endl;
+        return 1;
+    }
+    if (batch.active() && stream) {
+        cerr << "batch works on whole images and cannot be streamed" << endl;
         return 1;
     }
 
-
-    /* Read BMP */
     string filename = "input" + input_num + ".bmp";
-    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    string output_filename = "output2_" + to_string(enhance_degree) + ".bmp";
 
-    if (!file.is_open()) {
-        std::cerr << "Error opening the file" << std::endl;
-        return 1;
+    /* Stream the image through a window of 3 rows */
+    if (stream) {
+        bool ok = streamRows(filename, output_filename, 1, [&](const RowWindow& win, unsigned char* out) {
+            const unsigned char* rows[3];
+            for (int j = -1; j <= 1; j++) rows[j + 1] = win.row(borderIndex(win.y + j, win.height, mode) - win.y);
+            sharpenRow(rows, out, win.width, win.num_channel, enhance_degree, mode);
+        });
+        return ok ? 0 : 1;
     }
 
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-
-    // Read the headers
-    file.read(reinterpret_cast<char*>(&header), sizeof(BMPHeader));
-    file.read(reinterpret_cast<char*>(&infoHeader), sizeof(BMPInfoHeader));
+    if (batch.active()) {
+        bool ok = runBatch(batch, [&](const BMPConstImage& in, const BMPImage& out) {
+            applySharpeningFilter(in, out, enhance_degree, mode);
+        });
+        return ok ? 0 : 1;
+    }
 
-    // Check if it's a BMP file
-    if (header.type != 0x4D42) {
-        std::cerr << "Not a BMP file" << std::endl;
+    /* Read BMP */
+    BMPReader src;
+    if (!src.open(filename)) {
         return 1;
     }
-    
-    int bitsPerPixel = infoHeader.bitsPerPixel;
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int num_channel = bitsPerPixel / 8;
-    int imageSize = width * height * num_channel; // Each pixel has RGB or RGBA
 
-    // Allocate memory to store pixel data
-    std::vector<unsigned char> data(imageSize);
-    // Read pixel data
-    file.read(reinterpret_cast<char*>(data.data()), imageSize);
-    // Close the file
-    file.close();
-
-    /*Do Sharpness Enhancement on images*/
-    applySharpeningFilter(data, width, height, enhance_degree);
-
-
-    string output_filename = "output2_" + to_string(enhance_degree) + ".bmp";
-    ofstream output(output_filename, ios::out | ios::binary);
-    if (!output.is_open()) {
-        std::cerr << "Error creating the output file" << std::endl;
+    BMPWriter output;
+    if (!output.create(output_filename, src)) {
         return -1;
     }
 
-    output.write(reinterpret_cast<const char*>(&header), sizeof(BMPHeader));
-    output.write(reinterpret_cast<const char*>(&infoHeader), sizeof(BMPInfoHeader));
-    
-    output.write(reinterpret_cast<const char*>(data.data()), data.size());
-
-    output.close();
+    /*Do Sharpness Enhancement on images*/
+    applySharpeningFilter(src.image(), output.image(), enhance_degree, mode);
 
     return 0;
 }
@@ -1,257 +1,191 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <string>
 #include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include "../common/bmp_io.h"
+#include "../common/convolution.h"
+#include "../common/cube_lut.h"
+#include "../common/hsv.h"
+#include "../common/tone_lut.h"
 
 using namespace std;
 
-#pragma pack(push, 1) // Disable structure padding
-struct BMPHeader {
-    uint16_t type;
-    uint32_t size;
-    uint16_t reserved1;
-    uint16_t reserved2;
-    uint32_t offset;
+// Saturation, value and contrast settings for one input
+struct EnhancePreset {
+    double saturation;  // factor on S
+    double value;       // factor on V
+    double contrast;    // factor about mid-grey, applied after the HSV step
 };
 
-struct BMPInfoHeader {
-    uint32_t size;
-    int32_t width;
-    int32_t height;
-    uint16_t planes;
-    uint16_t bitsPerPixel;
-    uint32_t compression;
-    uint32_t imageSize;
-    int32_t xPixelsPerMeter;
-    int32_t yPixelsPerMeter;
-    uint32_t colorsUsed;
-    uint32_t colorsImportant;
-};
-#pragma pack(pop)
-
-void rgbToHsv(unsigned char r, unsigned char g, unsigned char b, double& h, double& s, double& v) {
-    double minVal = std::min(std::min(r, g), b);
-    double maxVal = std::max(std::max(r, g), b);
-    v = maxVal / 255.0;
-
-    double delta = maxVal - minVal;
-
-    if (maxVal == 0) {
-        s = 0;
-    } else {
-        s = delta / maxVal;
-    }
-
-    if (delta == 0) {
-        h = 0;
-    } else {
-        if (r == maxVal) {
-            h = (g - b) / delta;
-        } else if (g == maxVal) {
-            h = 2 + (b - r) / delta;
-        } else {
-            h = 4 + (r - g) / delta;
+// Read "k saturation value contrast" lines; '#' starts a comment
+bool loadPresets(const string& path, map<string, EnhancePreset>& presets) {
+    ifstream file(path);
+    if (!file) {
+        cerr << "Error opening the presets file " << path << endl;
+        return false;
+    }
+    string line;
+    int line_num = 0;
+    while (getline(file, line)) {
+        line_num++;
+        line = line.substr(0, line.find('#'));
+        istringstream fields(line);
+        string key;
+        if (!(fields >> key)) {
+            continue;
         }
-
-        h *= 60;
-
-        if (h < 0) {
-            h += 360;
+        EnhancePreset preset;
+        string extra;
+        if (!(fields >> preset.saturation >> preset.value >> preset.contrast) || (fields >> extra)) {
+            cerr << "Malformed preset at " << path << ":" << line_num << endl;
+            return false;
         }
+        presets[key] = preset;
     }
+    return true;
 }
 
-// Function to convert HSV to RGB
-void hsvToRgb(double h, double s, double v, unsigned char& r, unsigned char& g, unsigned char& b) {
-    if (s == 0) {
-        r = g = b = static_cast<unsigned char>(v * 255.0);
-    } else {
-        h /= 60;
-        int i = static_cast<int>(std::floor(h));
-        double f = h - i;
-        double p = v * (1 - s);
-        double q = v * (1 - s * f);
-        double t = v * (1 - s * (1 - f));
-
-        switch (i) {
-            case 0: r = static_cast<unsigned char>(v * 255.0); g = static_cast<unsigned char>(t * 255.0); b = static_cast<unsigned char>(p * 255.0); break;
-            case 1: r = static_cast<unsigned char>(q * 255.0); g = static_cast<unsigned char>(v * 255.0); b = static_cast<unsigned char>(p * 255.0); break;
-            case 2: r = static_cast<unsigned char>(p * 255.0); g = static_cast<unsigned char>(v * 255.0); b = static_cast<unsigned char>(t * 255.0); break;
-            case 3: r = static_cast<unsigned char>(p * 255.0); g = static_cast<unsigned char>(q * 255.0); b = static_cast<unsigned char>(v * 255.0); break;
-            case 4: r = static_cast<unsigned char>(t * 255.0); g = static_cast<unsigned char>(p * 255.0); b = static_cast<unsigned char>(v * 255.0); break;
-            default: r = static_cast<unsigned char>(v * 255.0); g = static_cast<unsigned char>(p * 255.0); b = static_cast<unsigned char>(q * 255.0); break;
+// Saturation/value scaling and contrast in one pass over each row: the row
+// goes through fixed-point RGB -> HSV, the S and V scaling, HSV -> RGB and
+// the contrast table while it is still in cache. Within one level of the
+// double-precision version (see hsv.h).
+void enhanceImage(const BMPConstImage& in, const BMPImage& out, const EnhancePreset& preset) {
+    ToneLut contrast_lut;
+    contrast_lut.contrast(preset.contrast);
+
+    int width = in.width;
+    int num_channel = in.num_channel;
+    size_t row_bytes = in.rowBytes();
+    vector<uint16_t> h(width), s(width), v(width);
+    for (int y = 0; y < in.height; y++) {
+        const unsigned char* src_row = in.row(y);
+        unsigned char* data = out.row(y);
+        rgbToHsvRow(src_row, num_channel, width, h.data(), s.data(), v.data());
+
+        // Enhance saturation and value, clipped to 1
+        hsvScale(s.data(), width, preset.saturation);
+        hsvScale(v.data(), width, preset.value);
+
+        // Back to RGB (alpha is carried over from the source), then contrast
+        if (num_channel > 3) {
+            std::memcpy(data, src_row, row_bytes);
         }
-    }
-}
-
-// Function to enhance saturation
-void enhanceSaturation(std::vector<unsigned char>& data, double factor, double val_factor) {
-    for (size_t i = 0; i < data.size(); i += 3) { // Assuming 3 channels (RGB) per pixel
-        unsigned char& r = data[i];
-        unsigned char& g = data[i + 1];
-        unsigned char& b = data[i + 2];
-
-        // Convert RGB to HSV
-        double h, s, v;
-        rgbToHsv(r, g, b, h, s, v);
-
-        // Enhance saturation
-        s *= factor;
-
-        // Clip saturation to the valid range [0, 1]
-        s = std::max(0.0, std::min(1.0, s));
-
-        // Enhance value
-        v = std::min(1.0, v * val_factor);
-
-        // Convert back to RGB
-        hsvToRgb(h, s, v, r, g, b);
-    }
-}
-
-void adjustContrast(std::vector<unsigned char>& data, double contrastFactor) {
-    for (size_t i = 0; i < data.size(); ++i) {
-        double adjustedIntensity = contrastFactor * (static_cast<double>(data[i]) - 128.0) + 128.0;
-        
-        // Clip the adjusted intensity to the valid range [0, 255]
-        data[i] = static_cast<unsigned char>(std::max(0.0, std::min(255.0, adjustedIntensity)));
+        hsvToRgbRow(h.data(), s.data(), v.data(), width, data, num_channel);
+        contrast_lut.apply(data, data, row_bytes, num_channel);
     }
 }
 
 // Function to apply sharpening filter to the image data
-void applySharpeningFilter(std::vector<unsigned char>& data, int width, int height, int enhance_degree) {
-    std::vector<unsigned char> resultData = data; // Create a copy of the data
-
-    
-    int kernel[3][3] = {
-            {0, -1, 0},
-            {-1,  5, -1},
-            {0, -1, 0}
-        };
-
+void applySharpeningFilter(const BMPConstImage& in, const BMPImage& out, int enhance_degree) {
     if (enhance_degree == 2) /* Composite Laplacian kernell 2 (sharper) */
     {
-        for(int i = 0; i < 3; i++) {
-            for(int j = 0; j < 3; j++) {
-                kernel[i][j] = -1;
-                if ((i == 1) && (j == 1))
-                {
-                    kernel[i][j] = 9;
-                }                
-            }
-        }
-    }
-
-    int channels = 3; // Assuming RGB image (3 channels)
-
-    for (int y = 1; y < (height - 1); y++){
-        for (int x = 1; x < (width - 1); x++){
-            for(int c = 0; c < channels; c++){
-                int sum = 0;
-                for(int j = -1; j <= 1; j++){
-                    for(int i = -1; i <= 1; i++){
-                        sum += data[(y + j) * (width * channels) + (x + i) * channels + c] * kernel[j + 1][i + 1];
-                    }
-                }
-                if (sum < 0) sum = 0;
-                if (sum > 255) sum = 255;
-                resultData[y * (width * channels) + x * channels + c] = static_cast<unsigned char>(sum);
-            }
-        }
+        convolveImage<SharpenKernel9>(in, out, kBorderClamp);
+    } else {
+        convolveImage<SharpenKernel5>(in, out, kBorderClamp);
     }
-
-    data = resultData; // Update the data with the sharpened result
 }
 
-
+static void usage(const char* prog) {
+    cerr << "Usage: " << prog << " k d [presets] [cube [N] | lut file] [trilinear | tetrahedral]" << " : k is input_num, " << " d is enhance degree, which should be either 1 or 2, "
+         << " presets is the preset file (presets.cfg by default), " << " cube bakes the preset into an N^3 .cube LUT (N = 33 by default) and applies that, "
+         << " lut applies a .cube file instead of the preset, " << " trilinear or tetrahedral (the default) picks how the LUT is interpolated." << endl;
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        cerr << "Usage: " << argv[0] << " k d" << " : k is input_num, " << " d is enhance degree, which should be either 1 or 2." << endl;
+    if (argc < 3) {
+        usage(argv[0]);
         return 1;
     }
     string input_num = string(argv[1]);
     int enhance_degree = stoi(string(argv[2]));
     if ((enhance_degree < 1) || (enhance_degree > 2)) {
-        cerr << "Usage: " << argv[0] << " k d" << " : k is input_num, " << " d is enhance degree, which should be either 1 or 2." << endl;
+        usage(argv[0]);
+        return 1;
+    }
+    string presets_filename = "presets.cfg";
+    string lut_filename;
+    int cube_size = 0;
+    CubeInterpolation interpolation = kCubeTetrahedral;
+    bool interpolation_set = false;
+    for (int i = 3; i < argc; i++) {
+        string arg = argv[i];
+        if ((arg == "cube") && lut_filename.empty() && (cube_size == 0)) {
+            cube_size = 33;
+            if ((i + 1 < argc) && isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                cube_size = atoi(argv[++i]);
+            }
+            if ((cube_size < 2) || (cube_size > 256)) {
+                cerr << "The LUT size should be between 2 and 256" << endl;
+                return 1;
+            }
+        } else if ((arg == "lut") && (i + 1 < argc) && lut_filename.empty() && (cube_size == 0)) {
+            lut_filename = argv[++i];
+        } else if (((arg == "trilinear") || (arg == "tetrahedral")) && (!lut_filename.empty() || (cube_size > 0)) && !interpolation_set) {
+            interpolation = (arg == "trilinear") ? kCubeTrilinear : kCubeTetrahedral;
+            interpolation_set = true;
+        } else if (i == 3) {
+            presets_filename = arg;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    map<string, EnhancePreset> presets;
+    CubeLut cube;
+    if (!lut_filename.empty()) {
+        if (!cube.load(lut_filename)) {
+            return 1;
+        }
+    } else if (!loadPresets(presets_filename, presets)) {
         return 1;
     }
 
     /* Read BMP */
     string filename = "output" + input_num + "_1.bmp";
-    std::ifstream file(filename, std::ios::in | std::ios::binary);
-
-    if (!file.is_open()) {
-        std::cerr << "Error opening the file" << std::endl;
+    BMPReader src;
+    if (!src.open(filename)) {
         return 1;
     }
 
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-
-    // Read the headers
-    file.read(reinterpret_cast<char*>(&header), sizeof(BMPHeader));
-    file.read(reinterpret_cast<char*>(&infoHeader), sizeof(BMPInfoHeader));
-
-    // Check if it's a BMP file
-    if (header.type != 0x4D42) {
-        std::cerr << "Not a BMP file" << std::endl;
-        return 1;
+    string output_filename = "output" + input_num + "_" + to_string(enhance_degree) + ".bmp";
+    BMPWriter output;
+    if (!output.create(output_filename, src)) {
+        return -1;
     }
-    
-    int bitsPerPixel = infoHeader.bitsPerPixel;
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int num_channel = bitsPerPixel / 8;
-    int imageSize = width * height * num_channel; // Each pixel has RGB or RGBA
-
-    // Allocate memory to store pixel data
-    std::vector<unsigned char> data(imageSize);
-    // Read pixel data
-    file.read(reinterpret_cast<char*>(data.data()), imageSize);
-    // Close the file
-    file.close();
+    const BMPImage& data = output.image();
 
-    /* Chromatic Adaptation */
-    if (input_num == "1") {
-        enhanceSaturation(data, 1.3, 1.4);
-        adjustContrast(data, 1.2);
+    /* Image Enhancement through a 3D LUT */
+    if (!lut_filename.empty()) {
+        cube.apply(src.image(), data, interpolation);
+        return output.close() ? 0 : 1;
     }
-    else if (input_num == "2") {
-        // applySharpeningFilter(data, width, height, 1);
-        enhanceSaturation(data, 0.7, 1.5);
-        adjustContrast(data, 1.2);
-        // applySharpeningFilter(data, width, height, 1);
-    }
-    else if (input_num == "3") {
-        enhanceSaturation(data, 1.4, 1.6);
-        adjustContrast(data, 1.1);
+
+    /* Image Enhancement with the preset for this input */
+    map<string, EnhancePreset>::const_iterator preset = presets.find(input_num);
+    if ((preset != presets.end()) && (cube_size > 0)) {
+        cube.buildFromImageOp(cube_size, [&](const BMPConstImage& lattice, const BMPImage& baked) {
+            enhanceImage(lattice, baked, preset->second);
+        });
+        string cube_filename = "output" + input_num + "_" + to_string(enhance_degree) + ".cube";
+        if (!cube.save(cube_filename, "enhancement preset " + input_num)) {
+            return -1;
+        }
+        cube.apply(src.image(), data, interpolation);
     }
-    else if (input_num == "4") {
-        
-        enhanceSaturation(data, 1.4, 0.8);
-        adjustContrast(data, 1.4);
+    else if (preset != presets.end()) {
+        enhanceImage(src.image(), data, preset->second);
     }
-
-    
-
-        
-
-    
-
-    string output_filename = "output" + input_num + "_" + to_string(enhance_degree) + ".bmp";
-    ofstream output(output_filename, ios::out | ios::binary);
-    if (!output.is_open()) {
-        std::cerr << "Error creating the output file" << std::endl;
-        return -1;
+    else {
+        for (int y = 0; y < data.height; y++) {
+            std::memcpy(data.row(y), src.image().row(y), data.rowBytes());
+        }
     }
-    output.write(reinterpret_cast<const char*>(&header), sizeof(BMPHeader));
-    output.write(reinterpret_cast<const char*>(&infoHeader), sizeof(BMPInfoHeader));
-    output.write(reinterpret_cast<const char*>(data.data()), data.size());
 
-    output.close();
-
-    return 0;
+    // Writing over the input (d = 1) only replaces it here
+    return output.close() ? 0 : 1;
 }
-
@@ -1,50 +1,54 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <string>
-#include "opencv2/imgproc.hpp"
-#include "opencv2/imgcodecs.hpp"
+#include <map>
+#include <tuple>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unistd.h>
+#include "../common/bmp_io.h"
+#include "../common/fft.h"
+#include "../common/planes.h"
+#include "../common/tile_executor.h"
 
 using namespace std;
-using namespace cv;
 
-void calcPSF(Mat& outputImg, Size filterSize, int len, double theta);
-void fftshift(const Mat& inputImg, Mat& outputImg);
-void filter2DFreq(const Mat& inputImg, Mat& outputImg, const Mat& H);
-void calcWnrFilter(const Mat& input_h_PSF, Mat& output_G, double nsr);
-int cal_PSNR(const Mat& img1, const Mat& img2);
-
-#pragma pack(push, 1) // Disable structure padding
-struct BMPHeader {
-    uint16_t type;
-    uint32_t size;
-    uint16_t reserved1;
-    uint16_t reserved2;
-    uint32_t offset;
+// How the planes are extended to the transform size
+enum PadMode {
+    kPadMirror,  // the image reflected at its edges
+    kPadTaper    // the reflection faded to the image mean towards the seam
 };
 
-struct BMPInfoHeader {
-    uint32_t size;
-    int32_t width;
-    int32_t height;
-    uint16_t planes;
-    uint16_t bitsPerPixel;
-    uint32_t compression;
-    uint32_t imageSize;
-    int32_t xPixelsPerMeter;
-    int32_t yPixelsPerMeter;
-    uint32_t colorsUsed;
-    uint32_t colorsImportant;
-};
-#pragma pack(pop)
+void padPlane(float* plane, int rows, int cols, int top, int left, int height, int width, PadMode mode);
+void calcPSF(vector<float>& outputImg, int rows, int cols, int len, double theta);
+void filter2DFreq(const RealFft2D& fft, const float* inputImg, size_t stride, float* outputImg, const vector<float>& G);
+void calcWnrFilter(const RealFft2D& fft, const vector<float>& input_h_PSF, vector<float>& output_G, double nsr);
+const vector<float>& wienerFilter(int rows, int cols, int len, double theta, int snr);
+double cal_PSNR(const string& filename1, const string& filename2);
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " <input_id> [mirror|taper]" << " : the image is padded to a fast transform size with mirrored"
+              << " edges (default) or mirrored edges tapered to the mean, to keep the circular convolution from ringing at the borders" << std::endl;
+}
 
 int main(int argc, char* argv[]) {
     // Check if at least one command-line argument is provided
-    if (argc < 1) {
-        std::cerr << "Usage: " << argv[0] << " <input_id> " << std::endl;
+    if (argc < 2 || argc > 3) {
+        usage(argv[0]);
         return 1;  // Return an error code
     }
     std::string input_num = argv[1];
+    PadMode pad_mode = kPadMirror;
+    if (argc == 3) {
+        std::string mode = argv[2];
+        if (mode == "taper") {
+            pad_mode = kPadTaper;
+        } else if (mode != "mirror") {
+            usage(argv[0]);
+            return 1;
+        }
+    }
     std::vector<int> Len(3), Snr(3);
     std::vector<double> THETA(3);
     if(input_num == "1") {
@@ -60,199 +64,239 @@ int main(int argc, char* argv[]) {
 
     /* Read BMP */
     std::string filename = "input" + input_num + ".bmp";
-    std::ifstream file(filename, std::ios::in | std::ios::binary);
-
-    if (!file.is_open()) {
-        std::cerr << "Error opening the file" << std::endl;
+    BMPReader src;
+    if (!src.open(filename)) {
         return 1;
     }
-
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-
-    // Read the headers
-    file.read(reinterpret_cast<char*>(&header), sizeof(BMPHeader));
-    file.read(reinterpret_cast<char*>(&infoHeader), sizeof(BMPInfoHeader));
-
-    // Check if it's a BMP file
-    if (header.type != 0x4D42) {
-        std::cerr << "Not a BMP file" << std::endl;
-        return 1;
-    }
-    
-    int bitsPerPixel = infoHeader.bitsPerPixel;
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int num_channel = bitsPerPixel / 8;
-    int imageSize = width * height * num_channel; // Each pixel has RGB or RGBA
-
-    // Allocate memory to store pixel data
-    std::vector<unsigned char> data(imageSize);
-    // Read pixel data
-    file.read(reinterpret_cast<char*>(data.data()), imageSize);
-    // Close the file
-    file.close();
+    const BMPConstImage& data = src.image();
+    int width = data.width;
+    int height = data.height;
+    int num_channel = data.num_channel;
 
     /* Restoration */
-    cv::Mat imgRGB = cv::Mat(height, width, CV_8UC3);
-    vector<cv::Mat> channels;
-    cv::split(imgRGB, channels);
-    for(int c = 0; c < 3; c++) {
-        for(int i = 0; i < height; i++) {
-            for(int j = 0; j < width; j++)
-                channels[c].at<uchar>(height-1-i, j) = data[i * width * num_channel + j * num_channel + c];
+    // Each axis is padded by at least half the blur on both sides and then
+    // up to the next 2^a 3^b 5^c size (even for the width), so the
+    // transforms only use the fast butterflies and the blur wraps into the
+    // padding instead of the opposite edge
+    int margin = int(std::round(*max_element(Len.begin(), Len.end()) / 2.0)) + 1;
+    int rows = fftGoodSize(height + 2 * margin), cols = fftGoodSize(width + 2 * margin, true);
+    int top = (rows - height) / 2, left = (cols - width) / 2;
+
+    // Split the pixels straight into one padded float plane per channel, top
+    // row first
+    const int kChannels = 3;
+    vector<vector<float>> channels(kChannels, vector<float>(size_t(rows) * cols));
+    forEachTile(height, data.rowBytes(), 0, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            size_t i = size_t(top + height - 1 - y) * cols + left;
+            float* planes[kChannels] = {&channels[0][i], &channels[1][i], &channels[2][i]};
+            splitPlanes(data.row(y), num_channel, width, planes);
         }
-    }
-    
-    
-    vector<cv::Mat> channelsOut;
+    });
 
-    int i = 0;
-    for(auto &channel : channels)
-    {
-        int len = Len[i];
-        double theta = THETA[i];
-        int snr = Snr[i];
-        cv::Mat imgIn = channel;
-        cv::Mat imgOut;
-        // it needs to process even image only
-        Rect roi = Rect(0, 0, imgIn.cols & -2, imgIn.rows & -2);
-        //Hw calculation (start)
-        cv::Mat Hw, h;
-        calcPSF(h, roi.size(), len, theta);
-        calcWnrFilter(h, Hw, 1.0 / double(snr));
-        //Hw calculation (stop)
-        imgIn.convertTo(imgIn, CV_32F);
-        // filtering (start)
-        filter2DFreq(imgIn(roi), imgOut, Hw);
-        // filtering (stop)
-        imgOut.convertTo(imgOut, CV_8U);
-        normalize(imgOut, imgOut, 0, 255, NORM_MINMAX);
-        channelsOut.push_back(imgOut);
-        i++;
+    // The channels are padded concurrently, then restored in place one after
+    // another so that each transform spreads over the whole thread pool
+    // (pool tasks run nested pool work serially). Rounding to bytes followed
+    // by a min-max normalisation over the image is folded into the merge
+    // below as a per-channel scale and shift.
+    ThreadPool& pool = ThreadPool::shared();
+    pool.parallelFor(kChannels, [&](int c) {
+        padPlane(channels[c].data(), rows, cols, top, left, height, width, pad_mode);
+    });
+    RealFft2D fft(rows, cols);
+    for (int c = 0; c < kChannels; c++) {
+        // Hw is computed once per size and parameter set and shared by the
+        // channels
+        const vector<float>& Hw = wienerFilter(rows, cols, Len[c], THETA[c], Snr[c]);
+        filter2DFreq(fft, channels[c].data(), cols, channels[c].data(), Hw);
     }
-
-    //merge 3 channel back to a vector
-    vector<unsigned char> dataOut;
-    for(int j = 0; j < height; j++)
-    {
-        for(int k = 0; k < width; k++)
-        {
-            dataOut.push_back(channelsOut[0].at<uchar>(height-j, k));
-            dataOut.push_back(channelsOut[1].at<uchar>(height-j, k));
-            dataOut.push_back(channelsOut[2].at<uchar>(height-j, k));
+    float scale[kChannels], shift[kChannels];
+    pool.parallelFor(kChannels, [&](int c) {
+        const float* plane = channels[c].data();
+        float lo = plane[size_t(top) * cols + left], hi = lo;
+        for (int y = top; y < top + height; y++) {
+            auto range = minmax_element(plane + size_t(y) * cols + left, plane + size_t(y) * cols + left + width);
+            lo = min(lo, *range.first);
+            hi = max(hi, *range.second);
         }
-    }
-    
-    
-
+        int lo8 = planeToByte(lo), hi8 = planeToByte(hi);
+        double stretch = (hi8 > lo8) ? 255.0 / (hi8 - lo8) : 0.0;
+        scale[c] = float(stretch);
+        shift[c] = float(-lo8 * stretch);
+    });
 
     /* Write BMP */
     string output_filename = "output" + input_num + ".bmp";
-    ofstream output(output_filename, ios::out | ios::binary);
-    if (!output.is_open()) {
-        std::cerr << "Error creating the output file" << std::endl;
+    BMPWriter output;
+    if (!output.create(output_filename, src)) {
         return -1;
     }
 
-    output.write(reinterpret_cast<const char*>(&header), sizeof(BMPHeader));
-    output.write(reinterpret_cast<const char*>(&infoHeader), sizeof(BMPInfoHeader));
-    
-    output.write(reinterpret_cast<const char*>(dataOut.data()), dataOut.size());
-
+    // Merge the 3 channels straight into the mapped output, cropping the
+    // padding off. 32-bit rows are copied from the input first, which keeps
+    // its alpha.
+    const BMPImage& dataOut = output.image();
+    forEachTile(height, dataOut.rowBytes(), 0, [&](int y0, int y1) {
+        for (int j = y0; j < y1; j++) {
+            size_t at = size_t(top + height - 1 - j) * cols + left;
+            const float* planes[kChannels] = {&channels[0][at], &channels[1][at], &channels[2][at]};
+            if (num_channel == 4) memcpy(dataOut.row(j), data.row(j), dataOut.rowBytes());
+            mergePlanes(planes, scale, shift, width, dataOut.row(j), num_channel);
+        }
+    });
     output.close();
-    /* calculate PSNR for input1 */
-    if(input_num == "1"){
-        cv::Mat imgRGB_ori = imread("input" + input_num + "_ori.bmp");
-        cv::Mat test_img = imread("output" + input_num + ".bmp");
-        cout << "PSNR: " << cal_PSNR(imgRGB_ori, test_img) << endl;
+    /* calculate PSNR for input1, when its reference is there */
+    string reference = "input" + input_num + "_ori.bmp";
+    if(input_num == "1" && access(reference.c_str(), F_OK) == 0){
+        double psnr = cal_PSNR(reference, output_filename);
+        if (psnr >= 0) cout << "PSNR: " << psnr << endl;
     }
 
     return 0;
 }
 
-void calcPSF(Mat& outputImg, Size filterSize, int len, double theta)
+// Reflected index of i into [0, n): ... c b a | a b c ... | c b a ...
+static int mirrorIndex(int i, int n)
+{
+    int period = 2 * n;
+    i %= period;
+    if (i < 0) i += period;
+    return (i < n) ? i : period - 1 - i;
+}
+
+// For a line of n image values followed by a gap of count that wraps back
+// to the image start, as the transform sees it: the image element each gap
+// element reflects (the first half of the gap the end of the image, the
+// second half its start) and, with kPadTaper, a raised cosine weight that
+// fades the reflection to the mean where the two halves meet
+static void padSources(int n, int count, PadMode mode, vector<int>& src, vector<float>& weight)
 {
-    Mat h(filterSize, CV_32F, Scalar(0));
-    // Calculate the center point of the ellipse
-    Point point(filterSize.width / 2, filterSize.height / 2);
-    // Draw an ellipse on the PSF matrix
-    ellipse(h, point, Size(0, cvRound(float(len) / 2.0)), 90.0 - theta, 0, 360, Scalar(255), FILLED);
-    // Calculate the sum of all values in the PSF matrix
-    Scalar summa = sum(h);
-    // Normalize the PSF matrix by dividing each element by the sum
-    outputImg = h / summa[0];
+    src.resize(count);
+    weight.assign(count, 1.0f);
+    for (int k = 0; k < count; k++) {
+        // distance from the nearer end of the image
+        bool after_end = k < count - k;
+        int d = after_end ? k + 1 : count - k;
+        src[k] = after_end ? mirrorIndex(n + k, n) : mirrorIndex(-d, n);
+        if (mode == kPadTaper) weight[k] = float(0.5 + 0.5 * cos(M_PI * min(1.0, 2.0 * d / (count + 1))));
+    }
 }
-void fftshift(const Mat& inputImg, Mat& outputImg)
+
+// Extend the height x width image at (top, left) of a rows x cols plane
+// over the rest of the plane: along its rows first, then whole padded rows
+// down the plane
+void padPlane(float* plane, int rows, int cols, int top, int left, int height, int width, PadMode mode)
 {
-    outputImg = inputImg.clone();
-    int cx = outputImg.cols / 2;
-    int cy = outputImg.rows / 2;
-    // Create region-of-interest for each quadrant
-    cv::Rect roiTopLeft(0, 0, cx, cy);
-    cv::Rect roiTopRight(cx, 0, cx, cy);
-    cv::Rect roiBottomLeft(0, cy, cx, cy);
-    cv::Rect roiBottomRight(cx, cy, cx, cy);
-    // Extract quadrants
-    cv::Mat topLeft(outputImg, roiTopLeft);
-    cv::Mat topRight(outputImg, roiTopRight);
-    cv::Mat bottomLeft(outputImg, roiBottomLeft);
-    cv::Mat bottomRight(outputImg, roiBottomRight);
-    // Swap quadrants
-    cv::Mat tmp;
-    topLeft.copyTo(tmp);
-    bottomRight.copyTo(topLeft);
-    tmp.copyTo(bottomRight);
+    double sum = 0;
+    for (int y = top; y < top + height; y++) {
+        const float* row = plane + size_t(y) * cols + left;
+        for (int x = 0; x < width; x++) sum += row[x];
+    }
+    float mean = float(sum / (double(width) * height));
+    auto fade = [&](float v, float w) { return (mode == kPadTaper) ? mean + (v - mean) * w : v; };
 
-    topRight.copyTo(tmp);
-    bottomLeft.copyTo(topRight);
-    tmp.copyTo(bottomLeft);
+    vector<int> src;
+    vector<float> weight;
+    padSources(width, cols - width, mode, src, weight);
+    for (int y = top; y < top + height; y++) {
+        float* row = plane + size_t(y) * cols;
+        for (int k = 0; k < cols - width; k++) row[(left + width + k) % cols] = fade(row[left + src[k]], weight[k]);
+    }
+    padSources(height, rows - height, mode, src, weight);
+    for (int k = 0; k < rows - height; k++) {
+        const float* from = plane + size_t(top + src[k]) * cols;
+        float* to = plane + size_t((top + height + k) % rows) * cols;
+        for (int x = 0; x < cols; x++) to[x] = fade(from[x], weight[k]);
+    }
 }
-void filter2DFreq(const Mat& inputImg, Mat& outputImg, const Mat& H)
+
+// The motion-blur PSF: a line of length len through the centre at theta
+// degrees from the x axis (y up), rasterised with one pixel per step along
+// its major axis and normalised to sum 1. It is drawn around the origin,
+// wrapping at the edges, which is where the transform expects the centre of
+// a kernel.
+void calcPSF(vector<float>& outputImg, int rows, int cols, int len, double theta)
 {
-    Mat planes[2] = { Mat_<float>(inputImg.clone()), Mat::zeros(inputImg.size(), CV_32F) };
-    Mat complexI;
-    merge(planes, 2, complexI);
-    dft(complexI, complexI, DFT_SCALE);
-    Mat planesH[2] = { Mat_<float>(H.clone()), Mat::zeros(H.size(), CV_32F) };
-    Mat complexH;
-    merge(planesH, 2, complexH);
-    Mat complexIH;
-    mulSpectrums(complexI, complexH, complexIH, 0);
-    idft(complexIH, complexIH);
-    split(complexIH, planes);
-    outputImg = planes[0];
+    outputImg.assign(size_t(rows) * cols, 0.0f);
+    double half = std::round(len / 2.0);
+    double angle = theta * M_PI / 180.0;
+    double dx = half * cos(angle), dy = -half * sin(angle);
+    int steps = int(std::round(2.0 * max(fabs(dx), fabs(dy))));
+    int count = 0;
+    for (int s = 0; s <= steps; s++) {
+        double t = (steps == 0) ? 0.0 : double(s) / steps;
+        long x = lround(-dx + 2.0 * dx * t), y = lround(-dy + 2.0 * dy * t);
+        float& p = outputImg[size_t((y % rows + rows) % rows) * cols + size_t((x % cols + cols) % cols)];
+        if (p == 0.0f) {
+            p = 1.0f;
+            count++;
+        }
+    }
+    for (float& p : outputImg) p /= float(count);
 }
 
-void calcWnrFilter(const Mat& input_h_PSF, Mat& output_G, double nsr)
+// Wiener restoration in the frequency domain. The image and the PSF are
+// real, so both go through real-input transforms that keep half the
+// spectrum. The filter only keeps the real part of H, so it is real too and
+// filtering is one element-wise product with the spectrum.
+void filter2DFreq(const RealFft2D& fft, const float* inputImg, size_t stride, float* outputImg, const vector<float>& G)
 {
-    Mat h_PSF_shifted;
-    fftshift(input_h_PSF, h_PSF_shifted);
-    Mat planes[2] = { Mat_<float>(h_PSF_shifted.clone()), Mat::zeros(h_PSF_shifted.size(), CV_32F) };
-    Mat complexI;
-    merge(planes, 2, complexI);
-    dft(complexI, complexI);
-    split(complexI, planes);
-    Mat denom;
-    pow(abs(planes[0]), 2, denom);
-    denom += nsr;
-    divide(planes[0], denom, output_G);
+    vector<float> re(fft.spectrumSize()), im(fft.spectrumSize());
+    fft.forward(inputImg, stride, re.data(), im.data());
+    spectrumMultiply(re.data(), im.data(), G.data(), G.size());
+    fft.inverse(re.data(), im.data(), outputImg, fft.cols());
 }
 
-int cal_PSNR(const Mat& img1, const Mat& img2)
+// G = Re(H) / (Re(H)^2 + nsr), laid out like the spectrum, with the
+// 1 / (rows * cols) of the inverse transform folded in
+void calcWnrFilter(const RealFft2D& fft, const vector<float>& input_h_PSF, vector<float>& output_G, double nsr)
 {
-    int MSE = 0;
-    int PSNR = 0;
-    int height = img1.rows;
-    int width = img1.cols;
-    for(int i = 0; i < height; i++)
-    {
-        for(int j = 0; j < width; j++)
-            MSE += pow(img1.at<uchar>(i, j) - img2.at<uchar>(i, j), 2);
-    }
-    MSE /= (height * width);
-    PSNR = 10 * log10(255 * 255 / MSE);
-    return PSNR;
+    vector<float> im(fft.spectrumSize());
+    output_G.assign(fft.spectrumSize(), 0.0f);
+    fft.forward(input_h_PSF.data(), fft.cols(), output_G.data(), im.data());
+    double norm = 1.0 / (double(fft.rows()) * fft.cols());
+    for (float& g : output_G) g = float(g / (double(g) * g + nsr) * norm);
 }
 
+// The Wiener filter for a rows x cols image and a PSF of length len at
+// angle theta, computed on first use and cached (map entries never move, so
+// the reference stays valid)
+const vector<float>& wienerFilter(int rows, int cols, int len, double theta, int snr)
+{
+    static map<tuple<int, int, int, double, int>, vector<float>> cache;
+    tuple<int, int, int, double, int> key(cols, rows, len, theta, snr);
+    auto found = cache.find(key);
+    if (found != cache.end()) return found->second;
+    vector<float> h;
+    calcPSF(h, rows, cols, len, theta);
+    vector<float>& Hw = cache[key];
+    calcWnrFilter(RealFft2D(rows, cols), h, Hw, 1.0 / double(snr));
+    return Hw;
+}
 
+// PSNR of two BMPs of the same size over all colour bytes, or -1 when
+// either cannot be read
+double cal_PSNR(const string& filename1, const string& filename2)
+{
+    BMPReader img1, img2;
+    if (!img1.open(filename1) || !img2.open(filename2)) {
+        return -1;
+    }
+    const BMPConstImage& a = img1.image();
+    const BMPConstImage& b = img2.image();
+    if (a.width != b.width || a.height != b.height || a.num_channel != b.num_channel) {
+        std::cerr << "Error: " << filename1 << " and " << filename2 << " differ in size" << std::endl;
+        return -1;
+    }
+    double MSE = 0;
+    for (int y = 0; y < a.height; y++) {
+        const unsigned char* p = a.row(y);
+        const unsigned char* q = b.row(y);
+        for (size_t i = 0; i < size_t(a.width) * a.num_channel; i++) {
+            double d = double(p[i]) - q[i];
+            MSE += d * d;
+        }
+    }
+    MSE /= double(a.width) * a.height * a.num_channel;
+    return 10 * log10(255.0 * 255.0 / max(MSE, 1e-10));
+}
@@ -0,0 +1,347 @@
+#ifndef DIP_COMMON_BATCH_H
+#define DIP_COMMON_BATCH_H
+
+// Batch mode: run one operator over many BMP files in one process.
+//
+// Files go through a three-stage pipeline. Reader threads read whole files
+// into memory ahead of time, the calling thread runs the operator on one
+// image after another (the operator itself spreads over the shared thread
+// pool), and writer threads write the results out. Each image in flight
+// holds one slot with its input and output buffers; there are a fixed number
+// of slots, reused from image to image, so memory stays bounded by the slot
+// count times the largest image however many files there are, and a stage
+// that gets ahead simply waits for a free slot.
+//
+// Readers and writers move files in groups of the slots that are ready,
+// each group one BulkIo submission (io_uring where available, see
+// uring_io.h), with the slot buffers registered as fixed buffers.
+//
+// The tools take "batch <inputs> <output dir>" in place of k. <inputs> is a
+// directory, whose *.bmp files are processed in name order, or a text file
+// listing one path per line. Each result goes to the output directory under
+// its input's file name. DIP_BATCH_IMAGES=n sets the number of slots.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bmp_io.h"
+#include "uring_io.h"
+
+// Blocking FIFO between two stages; pop() fails once the queue is closed and
+// drained
+template <typename T>
+class BatchQueue {
+public:
+    BatchQueue() : closed_(false) {}
+
+    void push(const T& item) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            items_.push_back(item);
+        }
+        ready_.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [&] { return closed_ || !items_.empty(); });
+        if (items_.empty()) return false;
+        item = items_.front();
+        items_.pop_front();
+        return true;
+    }
+
+    // pop() without waiting
+    bool tryPop(T& item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (items_.empty()) return false;
+        item = items_.front();
+        items_.pop_front();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        ready_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<T> items_;
+    bool closed_;
+};
+
+// The files named by source: the *.bmp files of a directory in name order,
+// or the lines of a list file
+inline bool listBatchInputs(const std::string& source, std::vector<std::string>& files) {
+    files.clear();
+    struct stat st;
+    if (stat(source.c_str(), &st) != 0) {
+        std::cerr << "Cannot open " << source << std::endl;
+        return false;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        DIR* dir = opendir(source.c_str());
+        if (!dir) {
+            std::cerr << "Cannot open " << source << std::endl;
+            return false;
+        }
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() > 4 && strcasecmp(name.c_str() + name.size() - 4, ".bmp") == 0) files.push_back(source + "/" + name);
+        }
+        closedir(dir);
+        std::sort(files.begin(), files.end());
+    } else {
+        std::ifstream list(source.c_str());
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+            if (!line.empty()) files.push_back(line);
+        }
+    }
+    if (files.empty()) {
+        std::cerr << "No input files in " << source << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// A batch from the command line: "prog batch <inputs> <output dir> args..."
+struct BatchJob {
+    std::vector<std::string> inputs;
+    std::string output_dir;
+
+    bool active() const { return !output_dir.empty(); }
+};
+
+// If argv[1] is "batch", fill job from argv[2] and argv[3] and drop those
+// two arguments, so that "batch" is left where the tools expect k.
+// False on a malformed batch command line.
+inline bool parseBatchArgs(int& argc, char* argv[], BatchJob& job) {
+    if ((argc < 2) || (std::strcmp(argv[1], "batch") != 0)) return true;
+    if (argc < 4) return false;
+    if (!listBatchInputs(argv[2], job.inputs)) return false;
+    job.output_dir = argv[3];
+    if ((mkdir(job.output_dir.c_str(), 0755) != 0) && (errno != EEXIST)) {
+        std::cerr << "Cannot create " << job.output_dir << std::endl;
+        return false;
+    }
+    for (int i = 4; i <= argc; i++) argv[i - 2] = argv[i];
+    argc -= 2;
+    return true;
+}
+
+// One image in flight
+struct BatchSlot {
+    size_t index;
+    bool ok;
+    std::vector<unsigned char> in_bytes;
+    std::vector<unsigned char> out_bytes;
+    BMPConstImage in;
+    BMPImage out;
+};
+
+// The output for the BMP in slot.in_bytes: its headers, patched for a pixel
+// array of the same geometry
+inline bool batchPrepare(BatchSlot& slot) {
+    if (!bmpMapImage(static_cast<const unsigned char*>(slot.in_bytes.data()), slot.in_bytes.size(), slot.in)) return false;
+    size_t offset = size_t(slot.in.pixels - slot.in_bytes.data());
+    slot.out_bytes.resize(offset + slot.in.stride * size_t(slot.in.height));
+    std::memcpy(slot.out_bytes.data(), slot.in_bytes.data(), offset);
+    bmpPatchHeader(slot.out_bytes.data(), uint32_t(offset), slot.in.width, slot.in.height, slot.in.num_channel, slot.in.top_down);
+    slot.out.pixels = slot.out_bytes.data() + offset;
+    slot.out.width = slot.in.width;
+    slot.out.height = slot.in.height;
+    slot.out.num_channel = slot.in.num_channel;
+    slot.out.stride = slot.in.stride;
+    slot.out.top_down = slot.in.top_down;
+    // Operators only write the pixels; clear the row padding left over from
+    // the slot's previous image
+    size_t row_bytes = slot.out.rowBytes();
+    if (row_bytes != slot.out.stride) {
+        for (int y = 0; y < slot.out.height; y++) std::memset(slot.out.row(y) + row_bytes, 0, slot.out.stride - row_bytes);
+    }
+    return true;
+}
+
+typedef std::function<void(const BMPConstImage&, const BMPImage&)> BatchOp;
+
+// Up to count slots: waits for the first, takes the rest only if ready
+inline bool batchGather(BatchQueue<BatchSlot*>& queue, size_t count, std::vector<BatchSlot*>& group) {
+    group.clear();
+    BatchSlot* slot;
+    if (!queue.pop(slot)) return false;
+    group.push_back(slot);
+    while (group.size() < count && queue.tryPop(slot)) group.push_back(slot);
+    return true;
+}
+
+// Run op over every input of job with readers reader and writers writer
+// threads. Files that cannot be read or written are reported and skipped;
+// returns true if every file was processed.
+inline bool runBatch(const BatchJob& job, const BatchOp& op, int readers = 2, int writers = 2) {
+    {
+        // DIP_IO=uring without a ring: stop here rather than fail every file
+        BulkIo probe(1);
+        if (!probe.ok()) return false;
+    }
+    int slot_count = 4 * (readers + writers);
+    if (const char* env = std::getenv("DIP_BATCH_IMAGES")) slot_count = std::max(1, std::atoi(env));
+    // Files are read and written in groups, one submission per group
+    size_t group_size = size_t(std::max(1, slot_count / 4));
+    std::vector<BatchSlot> slots(static_cast<size_t>(slot_count));
+    BatchQueue<BatchSlot*> free_slots, loaded, computed;
+    for (size_t i = 0; i < slots.size(); i++) free_slots.push(&slots[i]);
+
+    // Size the buffers for the largest input, so that they can be
+    // registered with the kernel once and never move: an output is never
+    // larger than its input, and an input that has grown past the size seen
+    // here is skipped rather than read into a reallocated buffer (the kernel
+    // would keep using the old, registered pages)
+    std::vector<iovec> buffers;
+    size_t largest = 0;
+    for (size_t i = 0; i < job.inputs.size(); i++) {
+        struct stat st;
+        if (stat(job.inputs[i].c_str(), &st) == 0) largest = std::max(largest, size_t(st.st_size));
+    }
+    if (largest > 0) {
+        size_t capacity = (largest + 0xFFFF) & ~size_t(0xFFFF);
+        for (size_t i = 0; i < slots.size(); i++) {
+            slots[i].in_bytes.reserve(capacity);
+            slots[i].out_bytes.reserve(capacity);
+            buffers.push_back({slots[i].in_bytes.data(), capacity});
+            buffers.push_back({slots[i].out_bytes.data(), capacity});
+        }
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<int> failures(0);
+    std::mutex log_mutex;
+    auto fail = [&](const std::string& what, const std::string& filename) {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        std::cerr << what << " " << filename << std::endl;
+        failures++;
+    };
+    auto outputName = [&](size_t index) {
+        const std::string& input = job.inputs[index];
+        size_t slash = input.find_last_of('/');
+        return job.output_dir + "/" + ((slash == std::string::npos) ? input : input.substr(slash + 1));
+    };
+
+    std::atomic<int> readers_left(readers);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < readers; t++) {
+        threads.push_back(std::thread([&] {
+            BulkIo io(static_cast<unsigned>(group_size));
+            io.registerBuffers(buffers);
+            std::vector<BatchSlot*> group;
+            std::vector<IoRequest> requests;
+            std::vector<BatchSlot*> requested;
+            bool more = true;
+            while (more && batchGather(free_slots, group_size, group)) {
+                requests.clear();
+                requested.clear();
+                for (size_t g = 0; g < group.size(); g++) {
+                    BatchSlot* slot = group[g];
+                    size_t index = more ? next++ : job.inputs.size();
+                    if (index >= job.inputs.size()) {
+                        more = false;
+                        free_slots.push(slot);
+                        continue;
+                    }
+                    slot->index = index;
+                    slot->ok = false;
+                    requested.push_back(slot);
+                    int fd = ::open(job.inputs[index].c_str(), O_RDONLY);
+                    struct stat file_st;
+                    if (fd < 0 || fstat(fd, &file_st) != 0 ||
+                        (!buffers.empty() && size_t(file_st.st_size) > slot->in_bytes.capacity())) {
+                        if (fd >= 0) ::close(fd);
+                        continue;
+                    }
+                    slot->in_bytes.resize(size_t(file_st.st_size));
+                    slot->ok = true;
+                    requests.push_back({fd, slot->in_bytes.data(), slot->in_bytes.size(), false});
+                }
+                io.run(requests, false);
+                for (size_t r = 0, g = 0; g < requested.size(); g++) {
+                    BatchSlot* slot = requested[g];
+                    if (slot->ok) {
+                        ::close(requests[r].fd);
+                        slot->ok = requests[r++].ok;
+                    }
+                    if (!slot->ok) {
+                        fail("Error reading", job.inputs[slot->index]);
+                    } else if (!(slot->ok = batchPrepare(*slot))) {
+                        fail("Skipping", job.inputs[slot->index]);
+                    }
+                    loaded.push(slot);
+                }
+            }
+            if (--readers_left == 0) loaded.close();
+        }));
+    }
+    for (int t = 0; t < writers; t++) {
+        threads.push_back(std::thread([&] {
+            BulkIo io(static_cast<unsigned>(group_size));
+            io.registerBuffers(buffers);
+            std::vector<BatchSlot*> group;
+            std::vector<IoRequest> requests;
+            std::vector<BatchSlot*> requested;
+            while (batchGather(computed, group_size, group)) {
+                requests.clear();
+                requested.clear();
+                for (size_t g = 0; g < group.size(); g++) {
+                    BatchSlot* slot = group[g];
+                    if (!slot->ok) continue;
+                    int fd = ::open(outputName(slot->index).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                    if (fd < 0) {
+                        fail("Error writing", outputName(slot->index));
+                        continue;
+                    }
+                    requested.push_back(slot);
+                    requests.push_back({fd, slot->out_bytes.data(), slot->out_bytes.size(), false});
+                }
+                io.run(requests, true);
+                for (size_t r = 0; r < requests.size(); r++) {
+                    bool closed = (::close(requests[r].fd) == 0);
+                    if (!requests[r].ok || !closed) fail("Error writing", outputName(requested[r]->index));
+                }
+                for (size_t g = 0; g < group.size(); g++) free_slots.push(group[g]);
+            }
+        }));
+    }
+
+    BatchSlot* slot;
+    while (loaded.pop(slot)) {
+        if (slot->ok) op(slot->in, slot->out);
+        computed.push(slot);
+    }
+    computed.close();
+    for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+    return failures == 0;
+}
+
+#endif // DIP_COMMON_BATCH_H
@@ -0,0 +1,385 @@
+#ifndef DIP_COMMON_BMP_IO_H
+#define DIP_COMMON_BMP_IO_H
+
+// Shared BMP reader/writer for every homework tool.
+//
+// Input files are mmapped read-only and the pixel array is exposed in place,
+// output files are preallocated and mmapped so operators write their result
+// straight into the page cache. No pixel data goes through an iostream.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#pragma pack(push, 1) // Disable structure padding
+struct BMPHeader {
+    uint16_t type;
+    uint32_t size;
+    uint16_t reserved1;
+    uint16_t reserved2;
+    uint32_t offset;
+};
+
+struct BMPInfoHeader {
+    uint32_t size;
+    int32_t width;
+    int32_t height;
+    uint16_t planes;
+    uint16_t bitsPerPixel;
+    uint32_t compression;
+    uint32_t imageSize;
+    int32_t xPixelsPerMeter;
+    int32_t yPixelsPerMeter;
+    uint32_t colorsUsed;
+    uint32_t colorsImportant;
+};
+#pragma pack(pop)
+
+// Bytes per stored row: BMP rows are padded to a multiple of 4 bytes.
+inline size_t bmpRowStride(int width, int num_channel) {
+    return (size_t(width) * num_channel + 3) & ~size_t(3);
+}
+
+// Rewrite the size and geometry fields of the headers at the start of bytes
+// for a pixel array at offset. Returns the resulting file size.
+inline size_t bmpPatchHeader(unsigned char* bytes, uint32_t offset, int width, int height, int num_channel, bool top_down) {
+    BMPHeader header;
+    BMPInfoHeader infoHeader;
+    std::memcpy(&header, bytes, sizeof(BMPHeader));
+    std::memcpy(&infoHeader, bytes + sizeof(BMPHeader), sizeof(BMPInfoHeader));
+    size_t imageSize = bmpRowStride(width, num_channel) * size_t(height);
+    header.size = uint32_t(offset + imageSize);
+    header.offset = offset;
+    infoHeader.width = width;
+    infoHeader.height = top_down ? -height : height;
+    infoHeader.imageSize = uint32_t(imageSize);
+    std::memcpy(bytes, &header, sizeof(BMPHeader));
+    std::memcpy(bytes + sizeof(BMPHeader), &infoHeader, sizeof(BMPInfoHeader));
+    return offset + imageSize;
+}
+
+// Check that the headers describe an uncompressed 24/32 bpp pixel array that
+// fits in a file of fileSize bytes.
+inline bool bmpCheckHeader(const BMPHeader& header, const BMPInfoHeader& infoHeader, uint64_t fileSize) {
+    if (header.type != 0x4D42) {
+        std::cerr << "Not a BMP file" << std::endl;
+        return false;
+    }
+    int bitsPerPixel = infoHeader.bitsPerPixel;
+    if ((bitsPerPixel != 24 && bitsPerPixel != 32) ||
+        (infoHeader.compression != 0 && infoHeader.compression != 3)) {
+        std::cerr << "Only uncompressed 24/32-bit BMP files are supported" << std::endl;
+        return false;
+    }
+    int height = std::abs(infoHeader.height);
+    if (infoHeader.width <= 0 || height <= 0 || header.offset > fileSize ||
+        bmpRowStride(infoHeader.width, bitsPerPixel / 8) * uint64_t(height) > fileSize - header.offset) {
+        std::cerr << "Truncated BMP file" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// View of a BMP pixel array. Rows are addressed bottom-up (y = 0 is the last
+// row on screen), the order all the tools were written against, whether the
+// file itself is stored bottom-up or top-down.
+template <typename T>
+struct BMPPixels {
+    T* pixels;          // first row as stored in the file
+    int width;
+    int height;
+    int num_channel;    // 3 for BGR, 4 for BGRA
+    size_t stride;      // bytes per stored row, including padding
+    bool top_down;
+
+    BMPPixels() : pixels(nullptr), width(0), height(0), num_channel(0), stride(0), top_down(false) {}
+
+    template <typename U>
+    BMPPixels(const BMPPixels<U>& other)
+        : pixels(other.pixels), width(other.width), height(other.height),
+          num_channel(other.num_channel), stride(other.stride), top_down(other.top_down) {}
+
+    T* row(int y) const {
+        size_t stored = top_down ? size_t(height - 1 - y) : size_t(y);
+        return pixels + stored * stride;
+    }
+    size_t rowBytes() const { return size_t(width) * num_channel; }
+};
+
+typedef BMPPixels<unsigned char> BMPImage;
+typedef BMPPixels<const unsigned char> BMPConstImage;
+
+// Point image at the pixel array of the BMP file held in bytes[0, size),
+// after checking its headers.
+template <typename T>
+inline bool bmpMapImage(T* bytes, size_t size, BMPPixels<T>& image) {
+    if (size < sizeof(BMPHeader) + sizeof(BMPInfoHeader)) {
+        std::cerr << "Not a BMP file" << std::endl;
+        return false;
+    }
+    BMPHeader header;
+    BMPInfoHeader infoHeader;
+    std::memcpy(&header, bytes, sizeof(BMPHeader));
+    std::memcpy(&infoHeader, bytes + sizeof(BMPHeader), sizeof(BMPInfoHeader));
+    if (!bmpCheckHeader(header, infoHeader, size)) return false;
+    image.pixels = bytes + header.offset;
+    image.width = infoHeader.width;
+    image.height = std::abs(infoHeader.height);
+    image.num_channel = infoHeader.bitsPerPixel / 8;
+    image.stride = bmpRowStride(image.width, image.num_channel);
+    image.top_down = infoHeader.height < 0;
+    return true;
+}
+
+// Read-only mapping of an input BMP.
+class BMPReader {
+public:
+    BMPReader() : fd_(-1), map_(nullptr), mapSize_(0) {}
+    ~BMPReader() { close(); }
+    BMPReader(const BMPReader&) = delete;
+    BMPReader& operator=(const BMPReader&) = delete;
+
+    bool open(const std::string& filename) {
+        close();
+        fd_ = ::open(filename.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            std::cerr << "Error opening the file" << std::endl;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd_, &st) != 0 || size_t(st.st_size) < sizeof(BMPHeader) + sizeof(BMPInfoHeader)) {
+            std::cerr << "Not a BMP file" << std::endl;
+            close();
+            return false;
+        }
+        mapSize_ = size_t(st.st_size);
+        void* p = mmap(nullptr, mapSize_, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (p == MAP_FAILED) {
+            std::cerr << "Error mapping the file" << std::endl;
+            map_ = nullptr;
+            close();
+            return false;
+        }
+        map_ = static_cast<unsigned char*>(p);
+        madvise(map_, mapSize_, MADV_SEQUENTIAL);
+
+        std::memcpy(&header_, map_, sizeof(BMPHeader));
+        std::memcpy(&infoHeader_, map_ + sizeof(BMPHeader), sizeof(BMPInfoHeader));
+
+        if (!bmpCheckHeader(header_, infoHeader_, mapSize_)) {
+            close();
+            return false;
+        }
+        image_.width = infoHeader_.width;
+        image_.height = std::abs(infoHeader_.height);
+        image_.top_down = infoHeader_.height < 0;
+        image_.num_channel = infoHeader_.bitsPerPixel / 8;
+        image_.stride = bmpRowStride(image_.width, image_.num_channel);
+        image_.pixels = map_ + header_.offset;
+        return true;
+    }
+
+    void close() {
+        if (map_) munmap(map_, mapSize_);
+        if (fd_ >= 0) ::close(fd_);
+        map_ = nullptr;
+        mapSize_ = 0;
+        fd_ = -1;
+        image_ = BMPConstImage();
+    }
+
+    const BMPHeader& header() const { return header_; }
+    const BMPInfoHeader& infoHeader() const { return infoHeader_; }
+    const BMPConstImage& image() const { return image_; }
+    // Raw header bytes up to the pixel array, including any V4/V5 extension
+    const unsigned char* headerBytes() const { return map_; }
+
+    int width() const { return image_.width; }
+    int height() const { return image_.height; }
+    int numChannel() const { return image_.num_channel; }
+
+    // Whether filename names the file this reader has open
+    bool sameFile(const std::string& filename) const {
+        struct stat mine, other;
+        return fd_ >= 0 && fstat(fd_, &mine) == 0 && stat(filename.c_str(), &other) == 0 &&
+               mine.st_dev == other.st_dev && mine.st_ino == other.st_ino;
+    }
+
+private:
+    int fd_;
+    unsigned char* map_;
+    size_t mapSize_;
+    BMPHeader header_;
+    BMPInfoHeader infoHeader_;
+    BMPConstImage image_;
+};
+
+// Preallocated, writable mapping of an output BMP. Writing over the file a
+// BMPReader has open (e.g. enhancing an image into itself) goes to a
+// temporary file next to it that replaces it on close(), so the reader's
+// pixels stay intact until then.
+class BMPWriter {
+public:
+    BMPWriter() : fd_(-1), map_(nullptr), mapSize_(0) {}
+    ~BMPWriter() { close(); }
+    BMPWriter(const BMPWriter&) = delete;
+    BMPWriter& operator=(const BMPWriter&) = delete;
+
+    // Output with the same header (and geometry) as src
+    bool create(const std::string& filename, const BMPReader& src) {
+        return create(filename, src, src.width(), src.height());
+    }
+
+    // Output with src's header bytes, resized to width x height
+    bool create(const std::string& filename, const BMPReader& src, int width, int height) {
+        uint32_t offset = src.header().offset;
+        if (!allocate(filename, offset, width, height, src.numChannel(), src.sameFile(filename))) return false;
+        std::memcpy(map_, src.headerBytes(), offset);
+        patchHeader(offset, width, height, src.numChannel(), src.image().top_down);
+        return true;
+    }
+
+    // Output with a plain 54-byte header
+    bool create(const std::string& filename, int width, int height, int num_channel) {
+        uint32_t offset = sizeof(BMPHeader) + sizeof(BMPInfoHeader);
+        if (!allocate(filename, offset, width, height, num_channel)) return false;
+        BMPHeader header = BMPHeader();
+        BMPInfoHeader infoHeader = BMPInfoHeader();
+        header.type = 0x4D42;
+        infoHeader.size = sizeof(BMPInfoHeader);
+        infoHeader.planes = 1;
+        infoHeader.bitsPerPixel = uint16_t(num_channel * 8);
+        infoHeader.xPixelsPerMeter = 3780;
+        infoHeader.yPixelsPerMeter = 3780;
+        std::memcpy(map_, &header, sizeof(BMPHeader));
+        std::memcpy(map_ + sizeof(BMPHeader), &infoHeader, sizeof(BMPInfoHeader));
+        patchHeader(offset, width, height, num_channel, false);
+        return true;
+    }
+
+    // Map an existing BMP read-write so it can be modified in place
+    bool edit(const std::string& filename) {
+        close();
+        fd_ = ::open(filename.c_str(), O_RDWR);
+        if (fd_ < 0) {
+            std::cerr << "Error opening the file" << std::endl;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd_, &st) != 0 || size_t(st.st_size) < sizeof(BMPHeader) + sizeof(BMPInfoHeader)) {
+            std::cerr << "Not a BMP file" << std::endl;
+            close();
+            return false;
+        }
+        mapSize_ = size_t(st.st_size);
+        void* p = mmap(nullptr, mapSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) {
+            std::cerr << "Error mapping the file" << std::endl;
+            map_ = nullptr;
+            close();
+            return false;
+        }
+        map_ = static_cast<unsigned char*>(p);
+        if (!bmpMapImage(map_, mapSize_, image_)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // Unmap the output; a temporary output then replaces its target, or is
+    // removed if it was never completely set up. False if the rename fails.
+    bool close() {
+        bool ok = true;
+        bool complete = (map_ != nullptr);
+        if (map_) munmap(map_, mapSize_);
+        if (fd_ >= 0) ::close(fd_);
+        if (!tempName_.empty()) {
+            if (!complete) {
+                unlink(tempName_.c_str());
+            } else if (rename(tempName_.c_str(), target_.c_str()) != 0) {
+                std::cerr << "Error replacing " << target_ << std::endl;
+                unlink(tempName_.c_str());
+                ok = false;
+            }
+        }
+        tempName_.clear();
+        target_.clear();
+        map_ = nullptr;
+        mapSize_ = 0;
+        fd_ = -1;
+        image_ = BMPImage();
+        return ok;
+    }
+
+    const BMPImage& image() const { return image_; }
+
+private:
+    bool allocate(const std::string& filename, uint32_t offset, int width, int height, int num_channel, bool replace = false) {
+        close();
+        if (replace) {
+            // Truncating would pull the pixels from under the reader's mapping
+            std::vector<char> name(filename.begin(), filename.end());
+            const char suffix[] = ".XXXXXX";
+            name.insert(name.end(), suffix, suffix + sizeof(suffix));
+            fd_ = mkstemp(name.data());
+            if (fd_ >= 0) {
+                fchmod(fd_, 0644);
+                tempName_ = name.data();
+                target_ = filename;
+            }
+        } else {
+            fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        }
+        if (fd_ < 0) {
+            std::cerr << "Error creating the output file" << std::endl;
+            return false;
+        }
+        mapSize_ = offset + bmpRowStride(width, num_channel) * size_t(height);
+        // Reserve the blocks up front so a full disk fails here instead of
+        // raising SIGBUS in the middle of an operator.
+        if (posix_fallocate(fd_, 0, off_t(mapSize_)) != 0 && ftruncate(fd_, off_t(mapSize_)) != 0) {
+            std::cerr << "Error creating the output file" << std::endl;
+            close();
+            return false;
+        }
+        void* p = mmap(nullptr, mapSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) {
+            std::cerr << "Error mapping the output file" << std::endl;
+            map_ = nullptr;
+            close();
+            return false;
+        }
+        map_ = static_cast<unsigned char*>(p);
+        return true;
+    }
+
+    void patchHeader(uint32_t offset, int width, int height, int num_channel, bool top_down) {
+        bmpPatchHeader(map_, offset, width, height, num_channel, top_down);
+        image_.pixels = map_ + offset;
+        image_.width = width;
+        image_.height = height;
+        image_.num_channel = num_channel;
+        image_.stride = bmpRowStride(width, num_channel);
+        image_.top_down = top_down;
+    }
+
+    int fd_;
+    unsigned char* map_;
+    size_t mapSize_;
+    BMPImage image_;
+    std::string tempName_;  // temporary output replacing target_ on close()
+    std::string target_;
+};
+
+#endif // DIP_COMMON_BMP_IO_H
@@ -0,0 +1,111 @@
+#ifndef DIP_COMMON_BOX_BLUR_H
+#define DIP_COMMON_BOX_BLUR_H
+
+// Separable running-sum box filter.
+//
+// Each output row is produced from per-column sums that are updated by adding
+// the row entering the window and subtracting the row leaving it, followed by
+// a horizontal running sum over those column sums. The cost per pixel is the
+// same for any radius. Borders are handled by clamping to the edge pixel.
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "bmp_io.h"
+#include "tile_executor.h"
+
+class BoxBlur {
+public:
+    BoxBlur() : width_(0), num_channel_(0), radius_(0), area_(1), multiplier_(0), shift_(0), next_y_(-1) {}
+    BoxBlur(int width, int num_channel, int radius) { reset(width, num_channel, radius); }
+
+    void reset(int width, int num_channel, int radius) {
+        width_ = width;
+        num_channel_ = num_channel;
+        radius_ = radius;
+        area_ = uint32_t(2 * radius + 1) * uint32_t(2 * radius + 1);
+        // sum / area as a multiply and shift: exact for every sum below 2^31
+        shift_ = 31;
+        while ((uint64_t(1) << (shift_ - 31)) < area_) shift_++;
+        multiplier_ = ((uint64_t(1) << shift_) + area_ - 1) / area_;
+        padded_.assign(size_t(width + 2 * radius + 1) * num_channel, 0);
+        next_y_ = -1;
+    }
+
+    // Blur output row y. Rows are fed in order from any starting row (the
+    // column sums are rebuilt whenever y does not follow the previous row),
+    // and rowAt(j) must return source row y + j clamped to the image, for
+    // j in [-radius - 1, radius].
+    template <typename RowAt>
+    void blurRow(int y, RowAt rowAt, unsigned char* out) {
+        uint32_t* column = padded_.data() + size_t(radius_) * num_channel_;
+        size_t row_bytes = size_t(width_) * num_channel_;
+        if (y != next_y_) {
+            std::fill(column, column + row_bytes, 0u);
+            for (int j = -radius_; j <= radius_; j++) {
+                const unsigned char* src = rowAt(j);
+                for (size_t i = 0; i < row_bytes; i++) column[i] += src[i];
+            }
+        } else {
+            const unsigned char* entering = rowAt(radius_);
+            const unsigned char* leaving = rowAt(-radius_ - 1);
+            for (size_t i = 0; i < row_bytes; i++) column[i] += uint32_t(entering[i]) - leaving[i];
+        }
+        next_y_ = y + 1;
+        horizontalPass(out);
+    }
+
+private:
+    void horizontalPass(unsigned char* out) {
+        int nc = num_channel_;
+        uint32_t* pad = padded_.data();
+        // Replicate the edge columns into the padding
+        for (int x = 0; x < radius_; x++) {
+            for (int c = 0; c < nc; c++) pad[x * nc + c] = pad[radius_ * nc + c];
+        }
+        const uint32_t* last = pad + size_t(radius_ + width_ - 1) * nc;
+        for (int x = radius_ + width_; x < width_ + 2 * radius_ + 1; x++) {
+            for (int c = 0; c < nc; c++) pad[x * nc + c] = last[c];
+        }
+
+        uint32_t half = area_ / 2;
+        uint32_t sum[4] = {0, 0, 0, 0};
+        for (int i = 0; i <= 2 * radius_; i++) {
+            for (int c = 0; c < nc; c++) sum[c] += pad[i * nc + c];
+        }
+        const uint32_t* leaving = pad;
+        const uint32_t* entering = pad + size_t(2 * radius_ + 1) * nc;
+        for (int x = 0; x < width_; x++) {
+            for (int c = 0; c < nc; c++) {
+                out[c] = static_cast<unsigned char>(((sum[c] + half) * multiplier_) >> shift_);
+                sum[c] += entering[c] - leaving[c];
+            }
+            out += nc;
+            entering += nc;
+            leaving += nc;
+        }
+    }
+
+    int width_;
+    int num_channel_;
+    int radius_;
+    uint32_t area_;
+    uint64_t multiplier_;
+    int shift_;
+    int next_y_;  // row the column sums are ready to advance to
+    std::vector<uint32_t> padded_;  // column sums with radius_ pixels of padding each side
+};
+
+// Out-of-place box blur of the whole image, in parallel bands of rows; out
+// must not alias in.
+inline void boxBlur(const BMPConstImage& in, const BMPImage& out, int radius) {
+    forEachTile(in.height, in.rowBytes(), radius + 1, [&](int y0, int y1) {
+        BoxBlur blur(in.width, in.num_channel, radius);
+        for (int y = y0; y < y1; y++) {
+            blur.blurRow(y, [&](int j) { return in.row(std::max(0, std::min(in.height - 1, y + j))); }, out.row(y));
+        }
+    });
+}
+
+#endif // DIP_COMMON_BOX_BLUR_H
@@ -0,0 +1,243 @@
+#ifndef DIP_COMMON_CLAHE_H
+#define DIP_COMMON_CLAHE_H
+
+// Contrast-limited adaptive histogram equalisation.
+//
+// The image is cut into a grid of tiles and every tile gets its own
+// equalisation curve, from its histogram with each bin clipped at the clip
+// limit (a multiple of the mean bin count) and the excess spread evenly over
+// all bins, which caps how steep the curve can get in flat regions. The tile
+// histograms are counted in parallel, one task per tile, with
+// histogramCount() from histogram.h.
+//
+// Each output pixel blends the curves of the four tiles whose centres
+// surround it, with bilinear weights; pixels outside the outer centres use
+// the nearest tiles only. Rows are processed in bands on the shared pool.
+// Along a row the four tiles stay the same between two tile centres, so each
+// such span is looked up in the four curves with lookupChannels() and then
+// blended by a SIMD kernel in 16-bit fixed point with 7-bit weights. The
+// kernels all do the same integer arithmetic, so the result does not depend
+// on the dispatch level or the number of threads.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "bmp_io.h"
+#include "dispatch.h"
+#include "histogram.h"
+#include "tile_executor.h"
+#include "tone_lut.h"
+
+/* Bilinear blend of four looked-up rows: a and b are the upper tiles'
+   values, c and d the lower ones', wx the per-byte weight of the right-hand
+   tiles and wy the weight of the lower ones, both 0..127 */
+
+typedef void (*ClaheBlendFn)(const unsigned char*, const unsigned char*, const unsigned char*, const unsigned char*,
+                             const unsigned char*, int, unsigned char*, size_t);
+
+// (x * w + 2^14) >> 15, as pmulhrsw
+inline int claheMulRound(int x, int w) {
+    return (x * w + 16384) >> 15;
+}
+
+inline void claheBlendScalar(const unsigned char* a, const unsigned char* b, const unsigned char* c, const unsigned char* d,
+                             const unsigned char* wx, int wy, unsigned char* dst, size_t n) {
+    int wy8 = wy << 8;
+    for (size_t i = 0; i < n; i++) {
+        int top = (a[i] << 7) + (b[i] - a[i]) * wx[i];
+        int bottom = (c[i] << 7) + (d[i] - c[i]) * wx[i];
+        int r = top + claheMulRound(bottom - top, wy8);
+        dst[i] = static_cast<unsigned char>((r + 64) >> 7);
+    }
+}
+
+#if DIP_X86_DISPATCH
+__attribute__((target("avx2")))
+inline void claheBlendAvx2(const unsigned char* a, const unsigned char* b, const unsigned char* c, const unsigned char* d,
+                           const unsigned char* wx, int wy, unsigned char* dst, size_t n) {
+    const __m256i wy8 = _mm256_set1_epi16(static_cast<short>(wy << 8));
+    const __m256i half = _mm256_set1_epi16(64);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        __m256i vc = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i)));
+        __m256i vd = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i)));
+        __m256i w = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(wx + i)));
+        __m256i top = _mm256_add_epi16(_mm256_slli_epi16(va, 7), _mm256_mullo_epi16(_mm256_sub_epi16(vb, va), w));
+        __m256i bottom = _mm256_add_epi16(_mm256_slli_epi16(vc, 7), _mm256_mullo_epi16(_mm256_sub_epi16(vd, vc), w));
+        __m256i r = _mm256_add_epi16(top, _mm256_mulhrs_epi16(_mm256_sub_epi16(bottom, top), wy8));
+        r = _mm256_srli_epi16(_mm256_add_epi16(r, half), 7);
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(r, r), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_castsi256_si128(packed));
+    }
+    claheBlendScalar(a + i, b + i, c + i, d + i, wx + i, wy, dst + i, n - i);
+}
+
+// 32 bytes at a time, widened to 16-bit lanes; the tail goes through the
+// scalar blend, as in the AVX2 kernel
+__attribute__((target("avx512f,avx512bw")))
+inline __m512i claheLoad32(const unsigned char* p) {
+    return _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline void claheBlendAvx512(const unsigned char* a, const unsigned char* b, const unsigned char* c, const unsigned char* d,
+                             const unsigned char* wx, int wy, unsigned char* dst, size_t n) {
+    const __m512i wy8 = _mm512_set1_epi16(static_cast<short>(wy << 8));
+    const __m512i half = _mm512_set1_epi16(64);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512i va = claheLoad32(a + i), vb = claheLoad32(b + i);
+        __m512i vc = claheLoad32(c + i), vd = claheLoad32(d + i);
+        __m512i w = claheLoad32(wx + i);
+        __m512i top = _mm512_add_epi16(_mm512_slli_epi16(va, 7), _mm512_mullo_epi16(_mm512_sub_epi16(vb, va), w));
+        __m512i bottom = _mm512_add_epi16(_mm512_slli_epi16(vc, 7), _mm512_mullo_epi16(_mm512_sub_epi16(vd, vc), w));
+        __m512i r = _mm512_add_epi16(top, _mm512_mulhrs_epi16(_mm512_sub_epi16(bottom, top), wy8));
+        r = _mm512_srli_epi16(_mm512_add_epi16(r, half), 7);
+        // zero-masked: the plain narrowing passes GCC an undefined vector
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm512_maskz_cvtepi16_epi8(__mmask32(0xFFFFFFFFu), r));
+    }
+    claheBlendScalar(a + i, b + i, c + i, d + i, wx + i, wy, dst + i, n - i);
+}
+#endif
+
+inline void claheBlend(const unsigned char* a, const unsigned char* b, const unsigned char* c, const unsigned char* d,
+                       const unsigned char* wx, int wy, unsigned char* dst, size_t n) {
+#if DIP_X86_DISPATCH
+    static const ClaheBlendFn variants[kCpuLevelCount] = {claheBlendScalar, nullptr, claheBlendAvx2, claheBlendAvx512, nullptr};
+#else
+    static const ClaheBlendFn variants[kCpuLevelCount] = {claheBlendScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const ClaheBlendFn fn = pickKernel(variants);
+    fn(a, b, c, d, wx, wy, dst, n);
+}
+
+/* Tile curves */
+
+// The equalisation curve of a tile of pixels pixels with histogram counts,
+// clipped at clip times the mean bin count, as in OpenCV's CLAHE
+inline void claheTable(uint32_t* counts, uint32_t pixels, double clip, unsigned char* table) {
+    if (clip > 0) {
+        uint32_t limit = std::max(1u, static_cast<uint32_t>(clip * pixels / 256));
+        uint32_t excess = 0;
+        for (int v = 0; v < 256; v++) {
+            if (counts[v] > limit) {
+                excess += counts[v] - limit;
+                counts[v] = limit;
+            }
+        }
+        uint32_t share = excess / 256, rest = excess % 256;
+        for (int v = 0; v < 256; v++) counts[v] += share;
+        if (rest) {
+            for (uint32_t v = 0, step = std::max(256 / rest, 1u); v < 256 && rest > 0; v += step, rest--) counts[v]++;
+        }
+    }
+    double scale = 255.0 / pixels;
+    uint32_t cdf = 0;
+    for (int v = 0; v < 256; v++) {
+        cdf += counts[v];
+        table[v] = static_cast<unsigned char>(std::min(255L, std::lround(cdf * scale)));
+    }
+}
+
+// Tile t of count tiles along a side of size pixels: [start, end)
+inline int claheTileStart(int t, int count, int size) {
+    return int(int64_t(t) * size / count);
+}
+
+// The two tiles whose centres bracket position p and the 7-bit weight of
+// the second (rounded, so 0..127 with a weight of 128 moving on a tile), for
+// tiles of size / count pixels
+inline void claheNeighbours(int p, int count, int size, int& t0, int& t1, int& weight) {
+    double f = (p + 0.5) * count / size - 0.5;
+    double base = std::floor(f);
+    t0 = int(base);
+    weight = int(std::lround((f - base) * 128));
+    if (weight == 128) {
+        t0++;
+        weight = 0;
+    }
+    t1 = t0 + 1;
+    if (t0 < 0) t0 = t1 = weight = 0;
+    if (t1 >= count) {
+        t0 = t1 = count - 1;
+        weight = 0;
+    }
+}
+
+// CLAHE of in into out (same geometry) on a tiles_x by tiles_y grid. kind
+// picks a curve per channel, or one curve from the luma histogram used for
+// all three colour channels; alpha is copied.
+inline void clahe(const BMPConstImage& in, const BMPImage& out, int tiles_x, int tiles_y, double clip, HistogramKind kind) {
+    int nc = in.num_channel;
+    tiles_x = std::max(1, std::min(tiles_x, in.width));
+    tiles_y = std::max(1, std::min(tiles_y, in.height));
+    int tiles = tiles_x * tiles_y;
+    ThreadPool& pool = ThreadPool::shared();
+
+    // One 256-entry curve per channel (alpha: the identity) per tile
+    std::vector<unsigned char> curves(size_t(tiles) * 4 * 256);
+    pool.parallelFor(tiles, [&](int t) {
+        int tx = t % tiles_x, ty = t / tiles_x;
+        int x0 = claheTileStart(tx, tiles_x, in.width), x1 = claheTileStart(tx + 1, tiles_x, in.width);
+        int y0 = claheTileStart(ty, tiles_y, in.height), y1 = claheTileStart(ty + 1, tiles_y, in.height);
+        uint32_t counts[3][256] = {};
+        histogramCount(in, y0, y1, x0, x1, kind, counts);
+        unsigned char* curve = &curves[size_t(t) * 4 * 256];
+        uint32_t pixels = uint32_t(x1 - x0) * uint32_t(y1 - y0);
+        for (int c = 0; c < 3; c++) {
+            if (kind == kHistogramLuma && c > 0) {
+                std::copy(curve, curve + 256, curve + 256 * c);
+            } else {
+                claheTable(counts[c], pixels, clip, curve + 256 * c);
+            }
+        }
+        for (int v = 0; v < 256; v++) curve[3 * 256 + v] = static_cast<unsigned char>(v);
+    });
+
+    // Per byte of a row: the weight of the right-hand tile; per pixel: the
+    // left- and right-hand tiles, whose changes split the row into spans
+    size_t row_bytes = in.rowBytes();
+    std::vector<unsigned char> weights(row_bytes);
+    std::vector<int> left(size_t(in.width) + 1), right(size_t(in.width) + 1);
+    for (int x = 0; x < in.width; x++) {
+        int weight;
+        claheNeighbours(x, tiles_x, in.width, left[x], right[x], weight);
+        for (int c = 0; c < nc; c++) weights[size_t(x) * nc + c] = static_cast<unsigned char>(weight);
+    }
+    left[in.width] = -1;
+
+    forEachTile(in.height, 5 * row_bytes, 0, [&](int y0, int y1) {
+        std::vector<unsigned char> scratch(4 * row_bytes);
+        unsigned char* row_a = scratch.data();
+        unsigned char* row_b = row_a + row_bytes;
+        unsigned char* row_c = row_b + row_bytes;
+        unsigned char* row_d = row_c + row_bytes;
+        for (int y = y0; y < y1; y++) {
+            int ty0, ty1, wy;
+            claheNeighbours(y, tiles_y, in.height, ty0, ty1, wy);
+            const unsigned char* src = in.row(y);
+            unsigned char* dst = out.row(y);
+            for (int xs = 0, xe; xs < in.width; xs = xe) {
+                for (xe = xs + 1; left[xe] == left[xs] && right[xe] == right[xs]; xe++) {
+                }
+                const unsigned char* tables[4][4];
+                int corners[4] = {ty0 * tiles_x + left[xs], ty0 * tiles_x + right[xs], ty1 * tiles_x + left[xs], ty1 * tiles_x + right[xs]};
+                for (int k = 0; k < 4; k++) {
+                    for (int c = 0; c < 4; c++) tables[k][c] = &curves[(size_t(corners[k]) * 4 + c) * 256];
+                }
+                size_t offset = size_t(xs) * nc, n = size_t(xe - xs) * nc;
+                lookupChannels(src + offset, row_a + offset, n, nc, tables[0]);
+                lookupChannels(src + offset, row_b + offset, n, nc, tables[1]);
+                lookupChannels(src + offset, row_c + offset, n, nc, tables[2]);
+                lookupChannels(src + offset, row_d + offset, n, nc, tables[3]);
+            }
+            claheBlend(row_a, row_b, row_c, row_d, weights.data(), wy, dst, row_bytes);
+        }
+    });
+}
+
+#endif // DIP_COMMON_CLAHE_H
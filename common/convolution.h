@@ -0,0 +1,265 @@
+#ifndef DIP_COMMON_CONVOLUTION_H
+#define DIP_COMMON_CONVOLUTION_H
+
+// Small fixed-kernel convolution.
+//
+// The kernel is part of the type: ConvKernel<shift, taps...> holds 3x3 or
+// 5x5 integer taps (row by row, top row first) and a final right shift, and
+// every loop over the taps is fully unrolled, so zero taps generate no code,
+// point-symmetric taps of equal weight are added before their single
+// multiply, and weights of +-1 become plain adds and subtracts. Pixels are
+// accumulated as 16-bit lanes with saturating adds and packed back to bytes
+// with saturation; kernels whose worst case could overflow 16 bits are
+// rejected at compile time, so results match the plain integer sum exactly.
+//
+// Every byte of a pixel is filtered except alpha, which is copied. Pixels
+// outside the image are taken from the clamped, mirrored or wrapped position.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "bmp_io.h"
+#include "dispatch.h"
+#include "tile_executor.h"
+
+enum BorderMode {
+    kBorderClamp,    // aa|abc|cc
+    kBorderReflect,  // cb|abc|ba, the edge pixel is not repeated
+    kBorderWrap      // bc|abc|ab
+};
+
+// Source index for position i of a line of n pixels
+inline int borderIndex(int i, int n, BorderMode mode) {
+    if ((i >= 0) && (i < n)) return i;
+    if (mode == kBorderWrap) return ((i % n) + n) % n;
+    if ((mode == kBorderClamp) || (n == 1)) return std::max(0, std::min(n - 1, i));
+    int period = 2 * n - 2;
+    i = ((i % period) + period) % period;
+    return (i < n) ? i : period - i;
+}
+
+constexpr int convTapAt(int) { return 0; }
+
+template <typename... Rest>
+constexpr int convTapAt(int k, int first, Rest... rest) {
+    return (k == 0) ? first : convTapAt(k - 1, rest...);
+}
+
+constexpr int convAbsSum(int) { return 0; }
+
+template <typename... Rest>
+constexpr int convAbsSum(int, int first, Rest... rest) {
+    return ((first < 0) ? -first : first) + convAbsSum(0, rest...);
+}
+
+template <int Shift, int... Taps>
+struct ConvKernel {
+    static const int count = sizeof...(Taps);
+    static const int size = (count == 25) ? 5 : 3;
+    static const int radius = size / 2;
+    static const int shift = Shift;
+    static_assert((count == 9) || (count == 25), "ConvKernel needs 3x3 or 5x5 taps");
+    static_assert((Shift >= 0) && (Shift < 15), "ConvKernel shift out of range");
+    static_assert(convAbsSum(0, Taps...) * 255 <= 32767, "ConvKernel taps could overflow 16-bit accumulation");
+
+    static constexpr int tap(int k) { return convTapAt(k, Taps...); }
+    static constexpr int row(int k) { return k / size - radius; }
+    static constexpr int column(int k) { return k % size - radius; }
+    // Tap k is folded into its point-symmetric partner count - 1 - k
+    static constexpr bool folded(int k) { return (k > count / 2) && (tap(k) == tap(count - 1 - k)); }
+    static constexpr bool paired(int k) { return (k < count / 2) && (tap(k) == tap(count - 1 - k)); }
+};
+
+/* Laplacian sharpening kernels */
+
+typedef ConvKernel<0,
+     0, -1,  0,
+    -1,  5, -1,
+     0, -1,  0> SharpenKernel5;
+
+typedef ConvKernel<0,
+    -1, -1, -1,
+    -1,  9, -1,
+    -1, -1, -1> SharpenKernel9;
+
+inline unsigned char convRound(int sum, int shift) {
+    if (shift > 0) sum = (sum + (1 << (shift - 1))) >> shift;
+    return static_cast<unsigned char>(std::max(0, std::min(255, sum)));
+}
+
+// Bytes [begin, end) of a row whose taps are all inside the row
+template <typename Kernel>
+inline void convolveBytesScalar(const unsigned char* const* rows, unsigned char* dst, size_t begin, size_t end, int nc) {
+    for (size_t i = begin; i < end; i++) {
+        int sum = 0;
+#pragma GCC unroll 25
+        for (int k = 0; k < Kernel::count; k++) {
+            if ((Kernel::tap(k) == 0) || Kernel::folded(k)) continue;
+            int v = rows[Kernel::row(k) + Kernel::radius][i + Kernel::column(k) * nc];
+            if (Kernel::paired(k)) {
+                int k2 = Kernel::count - 1 - k;
+                v += rows[Kernel::row(k2) + Kernel::radius][i + Kernel::column(k2) * nc];
+            }
+            sum += Kernel::tap(k) * v;
+        }
+        dst[i] = convRound(sum, Kernel::shift);
+    }
+}
+
+#if DIP_X86_DISPATCH
+__attribute__((target("sse2")))
+inline __m128i convScaleSse2(__m128i v, int w) {
+    return (w == 1) ? v : (w == -1) ? _mm_sub_epi16(_mm_setzero_si128(), v) : _mm_mullo_epi16(v, _mm_set1_epi16(short(w)));
+}
+
+template <typename Kernel>
+__attribute__((target("sse2")))
+void convolveBytesSse2(const unsigned char* const* rows, unsigned char* dst, size_t begin, size_t end, int nc) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __m128i acc_lo = zero, acc_hi = zero;
+#pragma GCC unroll 25
+        for (int k = 0; k < Kernel::count; k++) {
+            if ((Kernel::tap(k) == 0) || Kernel::folded(k)) continue;
+            __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[Kernel::row(k) + Kernel::radius] + i + Kernel::column(k) * nc));
+            __m128i lo = _mm_unpacklo_epi8(p, zero), hi = _mm_unpackhi_epi8(p, zero);
+            if (Kernel::paired(k)) {
+                int k2 = Kernel::count - 1 - k;
+                __m128i q = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[Kernel::row(k2) + Kernel::radius] + i + Kernel::column(k2) * nc));
+                lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(q, zero));
+                hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(q, zero));
+            }
+            if (Kernel::tap(k) == -1) {
+                acc_lo = _mm_subs_epi16(acc_lo, lo);
+                acc_hi = _mm_subs_epi16(acc_hi, hi);
+            } else {
+                acc_lo = _mm_adds_epi16(acc_lo, convScaleSse2(lo, Kernel::tap(k)));
+                acc_hi = _mm_adds_epi16(acc_hi, convScaleSse2(hi, Kernel::tap(k)));
+            }
+        }
+        if (Kernel::shift > 0) {
+            __m128i half = _mm_set1_epi16(short(1 << (Kernel::shift - 1)));
+            acc_lo = _mm_srai_epi16(_mm_adds_epi16(acc_lo, half), Kernel::shift);
+            acc_hi = _mm_srai_epi16(_mm_adds_epi16(acc_hi, half), Kernel::shift);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(acc_lo, acc_hi));
+    }
+    convolveBytesScalar<Kernel>(rows, dst, i, end, nc);
+}
+
+__attribute__((target("avx2")))
+inline __m256i convScaleAvx2(__m256i v, int w) {
+    return (w == 1) ? v : (w == -1) ? _mm256_sub_epi16(_mm256_setzero_si256(), v) : _mm256_mullo_epi16(v, _mm256_set1_epi16(short(w)));
+}
+
+template <typename Kernel>
+__attribute__((target("avx2")))
+void convolveBytesAvx2(const unsigned char* const* rows, unsigned char* dst, size_t begin, size_t end, int nc) {
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __m256i acc = _mm256_setzero_si256();
+#pragma GCC unroll 25
+        for (int k = 0; k < Kernel::count; k++) {
+            if ((Kernel::tap(k) == 0) || Kernel::folded(k)) continue;
+            __m256i p = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[Kernel::row(k) + Kernel::radius] + i + Kernel::column(k) * nc)));
+            if (Kernel::paired(k)) {
+                int k2 = Kernel::count - 1 - k;
+                p = _mm256_add_epi16(p, _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[Kernel::row(k2) + Kernel::radius] + i + Kernel::column(k2) * nc))));
+            }
+            acc = (Kernel::tap(k) == -1) ? _mm256_subs_epi16(acc, p) : _mm256_adds_epi16(acc, convScaleAvx2(p, Kernel::tap(k)));
+        }
+        if (Kernel::shift > 0) {
+            acc = _mm256_srai_epi16(_mm256_adds_epi16(acc, _mm256_set1_epi16(short(1 << (Kernel::shift - 1)))), Kernel::shift);
+        }
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(acc, acc), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_castsi256_si128(packed));
+    }
+    convolveBytesScalar<Kernel>(rows, dst, i, end, nc);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline __m512i convScaleAvx512(__m512i v, int w) {
+    return (w == 1) ? v : (w == -1) ? _mm512_sub_epi16(_mm512_setzero_si512(), v) : _mm512_mullo_epi16(v, _mm512_set1_epi16(short(w)));
+}
+
+template <typename Kernel>
+__attribute__((target("avx512f,avx512bw")))
+void convolveBytesAvx512(const unsigned char* const* rows, unsigned char* dst, size_t begin, size_t end, int nc) {
+    size_t i = begin;
+    for (; i + 32 <= end; i += 32) {
+        __m512i acc = _mm512_setzero_si512();
+#pragma GCC unroll 25
+        for (int k = 0; k < Kernel::count; k++) {
+            if ((Kernel::tap(k) == 0) || Kernel::folded(k)) continue;
+            __m512i p = _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[Kernel::row(k) + Kernel::radius] + i + Kernel::column(k) * nc)));
+            if (Kernel::paired(k)) {
+                int k2 = Kernel::count - 1 - k;
+                p = _mm512_add_epi16(p, _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[Kernel::row(k2) + Kernel::radius] + i + Kernel::column(k2) * nc))));
+            }
+            acc = (Kernel::tap(k) == -1) ? _mm512_subs_epi16(acc, p) : _mm512_adds_epi16(acc, convScaleAvx512(p, Kernel::tap(k)));
+        }
+        if (Kernel::shift > 0) {
+            acc = _mm512_srai_epi16(_mm512_adds_epi16(acc, _mm512_set1_epi16(short(1 << (Kernel::shift - 1)))), Kernel::shift);
+        }
+        acc = _mm512_max_epi16(acc, _mm512_setzero_si512());
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm512_maskz_cvtusepi16_epi8(0xFFFFFFFFu, acc));
+    }
+    convolveBytesScalar<Kernel>(rows, dst, i, end, nc);
+}
+#endif
+
+// Pixels whose taps leave the row: one pixel at a time through borderIndex
+template <typename Kernel>
+inline void convolveEdgePixel(const unsigned char* const* rows, unsigned char* dst, int x, int width, int nc, BorderMode mode) {
+    int xs[Kernel::size];
+    for (int i = 0; i < Kernel::size; i++) xs[i] = borderIndex(x + i - Kernel::radius, width, mode) * nc;
+    for (int c = 0; c < nc; c++) {
+        int sum = 0;
+        for (int k = 0; k < Kernel::count; k++) {
+            sum += Kernel::tap(k) * rows[Kernel::row(k) + Kernel::radius][xs[Kernel::column(k) + Kernel::radius] + c];
+        }
+        dst[x * nc + c] = convRound(sum, Kernel::shift);
+    }
+}
+
+typedef void (*ConvolveBytesFn)(const unsigned char* const*, unsigned char*, size_t, size_t, int);
+
+// Convolve one row. rows[j] is the source row j - radius rows away from the
+// output row, already resolved for the border mode.
+template <typename Kernel>
+void convolveRow(const unsigned char* const* rows, unsigned char* dst, int width, int nc, BorderMode mode) {
+#if DIP_X86_DISPATCH
+    static const ConvolveBytesFn variants[kCpuLevelCount] = {convolveBytesScalar<Kernel>, convolveBytesSse2<Kernel>, convolveBytesAvx2<Kernel>,
+                                                             convolveBytesAvx512<Kernel>, nullptr};
+#else
+    static const ConvolveBytesFn variants[kCpuLevelCount] = {convolveBytesScalar<Kernel>, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const ConvolveBytesFn fn = pickKernel(variants);
+    int r = Kernel::radius;
+    int inner_end = std::max(r, width - r);
+    if (width > 2 * r) fn(rows, dst, size_t(r) * nc, size_t(width - r) * nc, nc);
+    for (int x = 0; x < std::min(r, width); x++) convolveEdgePixel<Kernel>(rows, dst, x, width, nc, mode);
+    for (int x = inner_end; x < width; x++) convolveEdgePixel<Kernel>(rows, dst, x, width, nc, mode);
+
+    // Alpha passes through
+    if (nc == 4) {
+        const unsigned char* center = rows[r];
+        for (int x = 0; x < width; x++) dst[x * 4 + 3] = center[x * 4 + 3];
+    }
+}
+
+// Out-of-place convolution of the whole image, in parallel bands of rows
+template <typename Kernel>
+void convolveImage(const BMPConstImage& in, const BMPImage& out, BorderMode mode) {
+    forEachTile(in.height, in.rowBytes(), Kernel::radius, [&](int y0, int y1) {
+        const unsigned char* rows[Kernel::size];
+        for (int y = y0; y < y1; y++) {
+            for (int j = 0; j < Kernel::size; j++) rows[j] = in.row(borderIndex(y + j - Kernel::radius, in.height, mode));
+            convolveRow<Kernel>(rows, out.row(y), in.width, in.num_channel, mode);
+        }
+    });
+}
+
+#endif // DIP_COMMON_CONVOLUTION_H
@@ -0,0 +1,296 @@
+#ifndef DIP_COMMON_CUBE_LUT_H
+#define DIP_COMMON_CUBE_LUT_H
+
+// 3D colour lookup tables.
+//
+// A CubeLut holds an N x N x N lattice of output colours. Any per-pixel
+// RGB -> RGB transform can be baked into one by running an existing image
+// operator over an image of the lattice colours, and then applied with
+// trilinear or tetrahedral interpolation: a handful of 4-float loads and
+// multiply-adds per pixel, whatever the transform costs. Tables are read
+// and written in the Adobe .cube format (RGB in 0..1, red varying fastest).
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bmp_io.h"
+#include "tile_executor.h"
+
+enum CubeInterpolation {
+    kCubeTrilinear,
+    kCubeTetrahedral
+};
+
+class CubeLut {
+public:
+    CubeLut() : size_(0) {}
+
+    int size() const { return size_; }
+
+    // Bake an image operator op(const BMPConstImage& in, const BMPImage& out)
+    // that maps each pixel independently, by running it once over an image
+    // holding every lattice colour (rounded to bytes)
+    template <typename ImageOp>
+    void buildFromImageOp(int size, ImageOp op) {
+        resize(size);
+        int num_channel = 3;
+        size_t stride = bmpRowStride(size, num_channel);
+        std::vector<unsigned char> src(stride * size * size), dst(src.size());
+        BMPImage in;
+        in.pixels = src.data();
+        in.width = size;
+        in.height = size * size;
+        in.num_channel = num_channel;
+        in.stride = stride;
+        BMPImage out = in;
+        out.pixels = dst.data();
+        for (int b = 0; b < size; b++) {
+            for (int g = 0; g < size; g++) {
+                unsigned char* row = in.row(g + size * b);
+                for (int r = 0; r < size; r++) {
+                    row[r * 3] = static_cast<unsigned char>(latticeValue(b));
+                    row[r * 3 + 1] = static_cast<unsigned char>(latticeValue(g));
+                    row[r * 3 + 2] = static_cast<unsigned char>(latticeValue(r));
+                }
+            }
+        }
+        op(BMPConstImage(in), out);
+        for (int b = 0; b < size; b++) {
+            for (int g = 0; g < size; g++) {
+                const unsigned char* row = out.row(g + size * b);
+                for (int r = 0; r < size; r++) {
+                    setEntry(r, g, b, row[r * 3 + 2] / 255.0f, row[r * 3 + 1] / 255.0f, row[r * 3] / 255.0f);
+                }
+            }
+        }
+    }
+
+    // Interpolate every pixel of in into out (alpha is copied); in and out
+    // may be the same image. Bands of rows run on the shared thread pool.
+    void apply(const BMPConstImage& in, const BMPImage& out, CubeInterpolation mode) const {
+        forEachTile(in.height, in.rowBytes(), 0, [&](int y0, int y1) { applyRows(in, out, mode, y0, y1); });
+    }
+
+    bool save(const std::string& path, const std::string& title) const {
+        FILE* file = std::fopen(path.c_str(), "w");
+        if (!file) {
+            std::cerr << "Error creating the output file" << std::endl;
+            return false;
+        }
+        std::fprintf(file, "TITLE \"%s\"\nLUT_3D_SIZE %d\nDOMAIN_MIN 0 0 0\nDOMAIN_MAX 1 1 1\n", title.c_str(), size_);
+        for (size_t i = 0; i < table_.size(); i += 4) {
+            // Entries are stored as B, G, R, 0 scaled to 0..255
+            std::fprintf(file, "%.6f %.6f %.6f\n", table_[i + 2] / 255.0f, table_[i + 1] / 255.0f, table_[i] / 255.0f);
+        }
+        bool ok = std::ferror(file) == 0;
+        ok = (std::fclose(file) == 0) && ok;
+        if (!ok) std::cerr << "Error writing the output file" << std::endl;
+        return ok;
+    }
+
+    bool load(const std::string& path) {
+        std::ifstream file(path);
+        if (!file) {
+            std::cerr << "Error opening the LUT file " << path << std::endl;
+            return false;
+        }
+        int size = 0;
+        float domain_min[3] = {0.0f, 0.0f, 0.0f};
+        float domain_max[3] = {1.0f, 1.0f, 1.0f};
+        std::vector<float> rgb;
+        std::string line;
+        int line_num = 0;
+        while (std::getline(file, line)) {
+            line_num++;
+            line = line.substr(0, line.find('#'));
+            std::istringstream fields(line);
+            std::string key;
+            if (!(fields >> key)) {
+                continue;
+            }
+            bool ok = true;
+            if (key == "TITLE") {
+                continue;
+            } else if (key == "LUT_3D_SIZE") {
+                ok = static_cast<bool>(fields >> size) && size >= 2 && size <= 256 && rgb.empty();
+            } else if (key == "DOMAIN_MIN") {
+                ok = static_cast<bool>(fields >> domain_min[0] >> domain_min[1] >> domain_min[2]);
+            } else if (key == "DOMAIN_MAX") {
+                ok = static_cast<bool>(fields >> domain_max[0] >> domain_max[1] >> domain_max[2]);
+            } else if (key == "LUT_1D_SIZE") {
+                std::cerr << "Only 3D LUTs are supported" << std::endl;
+                return false;
+            } else {
+                std::istringstream values(line);
+                float r, g, b;
+                ok = static_cast<bool>(values >> r >> g >> b) && size > 0;
+                rgb.push_back(r);
+                rgb.push_back(g);
+                rgb.push_back(b);
+            }
+            if (!ok) {
+                std::cerr << "Malformed LUT at " << path << ":" << line_num << std::endl;
+                return false;
+            }
+        }
+        if (size == 0 || rgb.size() != size_t(size) * size * size * 3) {
+            std::cerr << "Malformed LUT " << path << ": expected " << size << "^3 entries" << std::endl;
+            return false;
+        }
+        for (int c = 0; c < 3; c++) {
+            if (domain_min[c] != 0.0f || domain_max[c] != 1.0f) {
+                std::cerr << "Only LUTs over the domain 0..1 are supported" << std::endl;
+                return false;
+            }
+        }
+        resize(size);
+        for (size_t i = 0; i < rgb.size() / 3; i++) {
+            table_[i * 4] = rgb[i * 3 + 2] * 255.0f;
+            table_[i * 4 + 1] = rgb[i * 3 + 1] * 255.0f;
+            table_[i * 4 + 2] = rgb[i * 3] * 255.0f;
+        }
+        return true;
+    }
+
+private:
+    // Byte value of lattice index i
+    int latticeValue(int i) const {
+        return (i * 255 + (size_ - 1) / 2) / (size_ - 1);
+    }
+
+    void resize(int size) {
+        size_ = size;
+        table_.assign(size_t(size) * size * size * 4, 0.0f);
+        // Lattice cell and position within it for every byte value
+        for (int v = 0; v < 256; v++) {
+            float pos = v * float(size - 1) / 255.0f;
+            int cell = std::min(size - 2, int(pos));
+            cell_[v] = cell;
+            frac_[v] = pos - cell;
+        }
+    }
+
+    void setEntry(int r, int g, int b, float red, float green, float blue) {
+        float* e = &table_[(size_t(r) + size_t(size_) * (g + size_t(size_) * b)) * 4];
+        e[0] = blue * 255.0f;
+        e[1] = green * 255.0f;
+        e[2] = red * 255.0f;
+        e[3] = 0.0f;
+    }
+
+    void applyRows(const BMPConstImage& in, const BMPImage& out, CubeInterpolation mode, int y0, int y1) const {
+        int nc = in.num_channel;
+        int width = in.width;
+        // Offsets (in floats) of one lattice step along r, g and b
+        size_t dr = 4, dg = size_t(size_) * 4, db = size_t(size_) * size_ * 4;
+        for (int y = y0; y < y1; y++) {
+            const unsigned char* src = in.row(y);
+            unsigned char* dst = out.row(y);
+            for (int x = 0; x < width; x++) {
+                const unsigned char* p = src + x * nc;
+                int bi = p[0], gi = p[1], ri = p[2];
+                const float* c000 = &table_[(size_t(cell_[ri]) + size_t(size_) * (cell_[gi] + size_t(size_) * cell_[bi])) * 4];
+                float fr = frac_[ri], fg = frac_[gi], fb = frac_[bi];
+                float res[4];
+                if (mode == kCubeTetrahedral) {
+                    tetrahedral(c000, dr, dg, db, fr, fg, fb, res);
+                } else {
+                    trilinear(c000, dr, dg, db, fr, fg, fb, res);
+                }
+                unsigned char* q = dst + x * nc;
+                for (int c = 0; c < 3; c++) {
+                    long v = lrintf(res[c]);
+                    q[c] = static_cast<unsigned char>(v < 0 ? 0 : (v > 255 ? 255 : v));
+                }
+                for (int c = 3; c < nc; c++) q[c] = p[c];
+            }
+        }
+    }
+
+#ifdef __SSE2__
+    static __m128 lerp(__m128 a, __m128 b, float t) {
+        return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(t)));
+    }
+
+    static void trilinear(const float* c, size_t dr, size_t dg, size_t db, float fr, float fg, float fb, float* res) {
+        __m128 c00 = lerp(_mm_loadu_ps(c), _mm_loadu_ps(c + dr), fr);
+        __m128 c10 = lerp(_mm_loadu_ps(c + dg), _mm_loadu_ps(c + dg + dr), fr);
+        __m128 c01 = lerp(_mm_loadu_ps(c + db), _mm_loadu_ps(c + db + dr), fr);
+        __m128 c11 = lerp(_mm_loadu_ps(c + db + dg), _mm_loadu_ps(c + db + dg + dr), fr);
+        _mm_storeu_ps(res, lerp(lerp(c00, c10, fg), lerp(c01, c11, fg), fb));
+    }
+
+    // Split the cell into six tetrahedra along the main diagonal and blend
+    // the four corners of the one holding the point: c000 + sum of weighted
+    // steps along the path through the cell in order of decreasing fraction.
+    static void tetrahedral(const float* c, size_t dr, size_t dg, size_t db, float fr, float fg, float fb, float* res) {
+        size_t s1, s2;           // offsets after the first and second steps
+        float w1, w2, w3;        // largest, middle and smallest fraction
+        if (fr > fg) {
+            if (fg > fb) { s1 = dr; s2 = dr + dg; w1 = fr; w2 = fg; w3 = fb; }
+            else if (fr > fb) { s1 = dr; s2 = dr + db; w1 = fr; w2 = fb; w3 = fg; }
+            else { s1 = db; s2 = db + dr; w1 = fb; w2 = fr; w3 = fg; }
+        } else {
+            if (fb > fg) { s1 = db; s2 = db + dg; w1 = fb; w2 = fg; w3 = fr; }
+            else if (fb > fr) { s1 = dg; s2 = dg + db; w1 = fg; w2 = fb; w3 = fr; }
+            else { s1 = dg; s2 = dg + dr; w1 = fg; w2 = fr; w3 = fb; }
+        }
+        __m128 v0 = _mm_loadu_ps(c);
+        __m128 v1 = _mm_loadu_ps(c + s1);
+        __m128 v2 = _mm_loadu_ps(c + s2);
+        __m128 v3 = _mm_loadu_ps(c + dr + dg + db);
+        __m128 sum = _mm_add_ps(v0, _mm_mul_ps(_mm_set1_ps(w1), _mm_sub_ps(v1, v0)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w2), _mm_sub_ps(v2, v1)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w3), _mm_sub_ps(v3, v2)));
+        _mm_storeu_ps(res, sum);
+    }
+#else
+    static void trilinear(const float* c, size_t dr, size_t dg, size_t db, float fr, float fg, float fb, float* res) {
+        for (int k = 0; k < 4; k++) {
+            float c00 = c[k] + (c[dr + k] - c[k]) * fr;
+            float c10 = c[dg + k] + (c[dg + dr + k] - c[dg + k]) * fr;
+            float c01 = c[db + k] + (c[db + dr + k] - c[db + k]) * fr;
+            float c11 = c[db + dg + k] + (c[db + dg + dr + k] - c[db + dg + k]) * fr;
+            float c0 = c00 + (c10 - c00) * fg;
+            float c1 = c01 + (c11 - c01) * fg;
+            res[k] = c0 + (c1 - c0) * fb;
+        }
+    }
+
+    static void tetrahedral(const float* c, size_t dr, size_t dg, size_t db, float fr, float fg, float fb, float* res) {
+        size_t s1, s2;
+        float w1, w2, w3;
+        if (fr > fg) {
+            if (fg > fb) { s1 = dr; s2 = dr + dg; w1 = fr; w2 = fg; w3 = fb; }
+            else if (fr > fb) { s1 = dr; s2 = dr + db; w1 = fr; w2 = fb; w3 = fg; }
+            else { s1 = db; s2 = db + dr; w1 = fb; w2 = fr; w3 = fg; }
+        } else {
+            if (fb > fg) { s1 = db; s2 = db + dg; w1 = fb; w2 = fg; w3 = fr; }
+            else if (fb > fr) { s1 = dg; s2 = dg + db; w1 = fg; w2 = fb; w3 = fr; }
+            else { s1 = dg; s2 = dg + dr; w1 = fg; w2 = fr; w3 = fb; }
+        }
+        size_t s3 = dr + dg + db;
+        for (int k = 0; k < 4; k++) {
+            res[k] = c[k] + w1 * (c[s1 + k] - c[k]) + w2 * (c[s2 + k] - c[s1 + k]) + w3 * (c[s3 + k] - c[s2 + k]);
+        }
+    }
+#endif
+
+    int size_;
+    std::vector<float> table_;   // B, G, R, 0 per entry (0..255), red index fastest
+    int cell_[256];
+    float frac_[256];
+};
+
+#endif // DIP_COMMON_CUBE_LUT_H
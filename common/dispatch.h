@@ -0,0 +1,94 @@
+#ifndef DIP_COMMON_DISPATCH_H
+#define DIP_COMMON_DISPATCH_H
+
+// Runtime CPU dispatch.
+//
+// Kernels are compiled for several instruction set levels in the same binary
+// (with per-function target attributes, so no -m flags are needed) and the
+// best one the CPU and OS support is picked once, at first use. Setting
+// DIP_CPU_LEVEL=scalar|sse2|avx2|avx512|avx512vbmi caps the level, e.g. to
+// compare variants or to work around a misbehaving machine; it can lower the
+// level but never raise it above what cpuid reports.
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DIP_X86_DISPATCH 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define DIP_X86_DISPATCH 0
+#endif
+
+enum CpuLevel {
+    kCpuScalar = 0,
+    kCpuSSE2,
+    kCpuAVX2,
+    kCpuAVX512,      // AVX-512F + BW
+    kCpuAVX512VBMI,  // AVX-512F + BW + VBMI byte permutes
+    kCpuLevelCount
+};
+
+inline const char* cpuLevelName(CpuLevel level) {
+    static const char* const names[kCpuLevelCount] = {"scalar", "sse2", "avx2", "avx512", "avx512vbmi"};
+    return names[level];
+}
+
+// Highest level supported by both the CPU and the OS (which has to save the
+// wider registers on a context switch)
+inline CpuLevel cpuDetectLevel() {
+#if DIP_X86_DISPATCH
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return kCpuScalar;
+    if (!(edx & (1u << 26))) return kCpuScalar;
+    CpuLevel level = kCpuSSE2;
+    bool osxsave = (ecx & (1u << 27)) != 0;
+    bool avx = (ecx & (1u << 28)) != 0;
+    if (!osxsave || !avx) return level;
+    unsigned xcr0_lo, xcr0_hi;
+    __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 0x6) != 0x6) return level;   // XMM and YMM state
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return level;
+    if (!(ebx & (1u << 5))) return level;        // AVX2
+    level = kCpuAVX2;
+    if ((xcr0_lo & 0xE0) != 0xE0) return level;  // opmask and ZMM state
+    if (!(ebx & (1u << 16)) || !(ebx & (1u << 30))) return level;  // AVX-512F, AVX-512BW
+    level = kCpuAVX512;
+    if (ecx & (1u << 1)) level = kCpuAVX512VBMI;
+    return level;
+#else
+    return kCpuScalar;
+#endif
+}
+
+// The level kernels are dispatched at: the detected level, capped by
+// DIP_CPU_LEVEL if it is set
+inline CpuLevel cpuLevel() {
+    static const CpuLevel level = [] {
+        CpuLevel detected = cpuDetectLevel();
+        const char* env = std::getenv("DIP_CPU_LEVEL");
+        if (!env || !*env) return detected;
+        for (int i = 0; i < kCpuLevelCount; i++) {
+            if (std::strcmp(env, cpuLevelName(CpuLevel(i))) == 0) {
+                return CpuLevel(i) < detected ? CpuLevel(i) : detected;
+            }
+        }
+        std::cerr << "Unknown DIP_CPU_LEVEL " << env << ", using " << cpuLevelName(detected) << std::endl;
+        return detected;
+    }();
+    return level;
+}
+
+// One kernel per level, indexed by CpuLevel; null entries are skipped.
+// Returns the best variant at or below cpuLevel().
+template <typename Fn>
+inline Fn pickKernel(const Fn (&variants)[kCpuLevelCount]) {
+    for (int i = cpuLevel(); i > kCpuScalar; i--) {
+        if (variants[i]) return variants[i];
+    }
+    return variants[kCpuScalar];
+}
+
+#endif // DIP_COMMON_DISPATCH_H
@@ -0,0 +1,702 @@
+#ifndef DIP_COMMON_FFT_H
+#define DIP_COMMON_FFT_H
+
+// Fast Fourier transforms for images.
+//
+// The 1-D transform is a self-sorting (Stockham) mixed-radix FFT with
+// dedicated radix 2, 3, 4 and 5 butterflies and a generic butterfly for any
+// other prime factor, so it takes every length but is fastest on lengths of
+// the form 2^a 3^b 5^c. A plan holds the factorisation and the twiddles of
+// every stage; plans are built once per length and cached.
+//
+// Transforms always run on kFftLanes = 8 sequences at once: element k of
+// sequence l is at [k * 8 + l] of separate real and imaginary arrays, so a
+// butterfly on one AVX2 register does the same step of 8 transforms and the
+// twiddles are broadcast scalars. The scalar variant runs the same
+// operations lane by lane in the same order, so all variants give the same
+// bits. The inverse is computed by swapping the real and imaginary arrays
+// around the forward transform and is not normalised.
+//
+// RealFft2D transforms a rows x cols real image (cols even) into its
+// cols / 2 + 1 non-redundant columns of frequencies. Each group of 8 rows is
+// transposed into lanes, and a row of cols reals is transformed as cols / 2
+// complex values (even samples as real parts, odd ones as imaginary) and
+// then untangled into the half spectrum. The columns are then transformed
+// in groups of 8 bins, which the spectrum layout keeps contiguous: bin u of
+// row v is at ((u / 8) * rows + v) * 8 + u % 8. Row groups and bin groups
+// are spread over the shared thread pool (run serially when called from
+// inside a pool task).
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "dispatch.h"
+#include "tile_executor.h"
+
+const int kFftLanes = 8;
+
+/* Plans */
+
+struct FftStage {
+    int radix;
+    int m;        // butterflies per stride: the stage's length / radix
+    int stride;   // product of the radices of the stages before
+    // W_len^(j k) for j < m and 1 <= k < radix, at j * (radix - 1) + k - 1,
+    // with W_len = exp(-2 pi i / len) and len = radix * m
+    std::vector<float> tw_re, tw_im;
+    // W_radix^k for k < radix, for the generic butterfly
+    std::vector<float> root_re, root_im;
+};
+
+struct FftPlan {
+    int n;
+    std::vector<FftStage> stages;
+};
+
+// Radices for n: fours first, then two, three, five and any other primes
+inline std::vector<int> fftFactors(int n) {
+    std::vector<int> factors;
+    while (n % 4 == 0) {
+        factors.push_back(4);
+        n /= 4;
+    }
+    for (int p = 2; n > 1; p++) {
+        if (p * p > n) p = n;
+        while (n % p == 0) {
+            factors.push_back(p);
+            n /= p;
+        }
+    }
+    return factors;
+}
+
+// The smallest size >= n of the form 2^a 3^b 5^c (and even if asked), which
+// the transforms run with the fixed butterflies only
+inline int fftGoodSize(int n, bool even = false) {
+    for (int m = std::max(n, 1);; m++) {
+        if (even && m % 2 != 0) continue;
+        int rest = m;
+        for (int p = 2; p <= 5; p++) {
+            while (rest % p == 0) rest /= p;
+        }
+        if (rest == 1) return m;
+    }
+}
+
+inline const FftPlan& fftPlan(int n) {
+    static std::map<int, std::unique_ptr<FftPlan> > plans;
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<FftPlan>& plan = plans[n];
+    if (plan) return *plan;
+    plan.reset(new FftPlan);
+    plan->n = n;
+    std::vector<int> factors = fftFactors(n);
+    int len = n, stride = 1;
+    for (size_t f = 0; f < factors.size(); f++) {
+        FftStage stage;
+        stage.radix = factors[f];
+        stage.m = len / stage.radix;
+        stage.stride = stride;
+        for (int j = 0; j < stage.m; j++) {
+            for (int k = 1; k < stage.radix; k++) {
+                double angle = -2.0 * M_PI * double(j) * k / len;
+                stage.tw_re.push_back(float(std::cos(angle)));
+                stage.tw_im.push_back(float(std::sin(angle)));
+            }
+        }
+        for (int k = 0; k < stage.radix; k++) {
+            double angle = -2.0 * M_PI * k / stage.radix;
+            stage.root_re.push_back(float(std::cos(angle)));
+            stage.root_im.push_back(float(std::sin(angle)));
+        }
+        plan->stages.push_back(stage);
+        len = stage.m;
+        stride *= stage.radix;
+    }
+    return *plan;
+}
+
+/* Lanes: one register (or array) of kFftLanes floats */
+
+struct FftLanesScalar {
+    struct T {
+        float v[kFftLanes];
+    };
+    static T load(const float* p) {
+        T x;
+        for (int l = 0; l < kFftLanes; l++) x.v[l] = p[l];
+        return x;
+    }
+    static void store(float* p, const T& x) {
+        for (int l = 0; l < kFftLanes; l++) p[l] = x.v[l];
+    }
+    static T set1(float a) {
+        T x;
+        for (int l = 0; l < kFftLanes; l++) x.v[l] = a;
+        return x;
+    }
+    static T add(const T& a, const T& b) {
+        T x;
+        for (int l = 0; l < kFftLanes; l++) x.v[l] = a.v[l] + b.v[l];
+        return x;
+    }
+    static T sub(const T& a, const T& b) {
+        T x;
+        for (int l = 0; l < kFftLanes; l++) x.v[l] = a.v[l] - b.v[l];
+        return x;
+    }
+    static T mul(const T& a, const T& b) {
+        T x;
+        for (int l = 0; l < kFftLanes; l++) x.v[l] = a.v[l] * b.v[l];
+        return x;
+    }
+    // dst[k][l] = src[l][k] for an 8 x 8 block
+    static void transpose(const float* const* src, float* const* dst) {
+        for (int k = 0; k < kFftLanes; k++) {
+            for (int l = 0; l < kFftLanes; l++) dst[k][l] = src[l][k];
+        }
+    }
+};
+
+#if DIP_X86_DISPATCH
+struct FftLanesAvx2 {
+    typedef __m256 T;
+    __attribute__((target("avx2"))) static T load(const float* p) { return _mm256_loadu_ps(p); }
+    __attribute__((target("avx2"))) static void store(float* p, T x) { _mm256_storeu_ps(p, x); }
+    __attribute__((target("avx2"))) static T set1(float a) { return _mm256_set1_ps(a); }
+    __attribute__((target("avx2"))) static T add(T a, T b) { return _mm256_add_ps(a, b); }
+    __attribute__((target("avx2"))) static T sub(T a, T b) { return _mm256_sub_ps(a, b); }
+    __attribute__((target("avx2"))) static T mul(T a, T b) { return _mm256_mul_ps(a, b); }
+    __attribute__((target("avx2")))
+    static void transpose(const float* const* src, float* const* dst) {
+        __m256 r[8], t[8];
+        for (int l = 0; l < 8; l++) r[l] = _mm256_loadu_ps(src[l]);
+        for (int l = 0; l < 8; l += 2) {
+            t[l] = _mm256_unpacklo_ps(r[l], r[l + 1]);
+            t[l + 1] = _mm256_unpackhi_ps(r[l], r[l + 1]);
+        }
+        for (int l = 0; l < 8; l += 4) {
+            r[l] = _mm256_shuffle_ps(t[l], t[l + 2], 0x44);
+            r[l + 1] = _mm256_shuffle_ps(t[l], t[l + 2], 0xEE);
+            r[l + 2] = _mm256_shuffle_ps(t[l + 1], t[l + 3], 0x44);
+            r[l + 3] = _mm256_shuffle_ps(t[l + 1], t[l + 3], 0xEE);
+        }
+        for (int k = 0; k < 4; k++) {
+            _mm256_storeu_ps(dst[k], _mm256_permute2f128_ps(r[k], r[k + 4], 0x20));
+            _mm256_storeu_ps(dst[k + 4], _mm256_permute2f128_ps(r[k], r[k + 4], 0x31));
+        }
+    }
+};
+#endif
+
+// The generic kernels below pass AVX registers between functions that have
+// no target attribute of their own; they are always inlined into
+// target("avx2") wrappers, so the ABI note GCC gives for that does not apply.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+/* Butterflies: b[k] = sum over r of a[r] W_P^(r k), in place */
+
+template <class V, int P>
+struct FftButterfly;
+
+template <class V>
+struct FftButterfly<V, 2> {
+    typedef typename V::T T;
+    __attribute__((always_inline)) static void run(T* re, T* im) {
+        T r = V::sub(re[0], re[1]), i = V::sub(im[0], im[1]);
+        re[0] = V::add(re[0], re[1]);
+        im[0] = V::add(im[0], im[1]);
+        re[1] = r;
+        im[1] = i;
+    }
+};
+
+template <class V>
+struct FftButterfly<V, 3> {
+    typedef typename V::T T;
+    __attribute__((always_inline)) static void run(T* re, T* im) {
+        const T half = V::set1(0.5f), s = V::set1(0.866025403784438647f);
+        T t1r = V::add(re[1], re[2]), t1i = V::add(im[1], im[2]);
+        T t2r = V::sub(re[0], V::mul(half, t1r)), t2i = V::sub(im[0], V::mul(half, t1i));
+        T t3r = V::mul(s, V::sub(re[1], re[2])), t3i = V::mul(s, V::sub(im[1], im[2]));
+        re[0] = V::add(re[0], t1r);
+        im[0] = V::add(im[0], t1i);
+        re[1] = V::add(t2r, t3i);
+        im[1] = V::sub(t2i, t3r);
+        re[2] = V::sub(t2r, t3i);
+        im[2] = V::add(t2i, t3r);
+    }
+};
+
+template <class V>
+struct FftButterfly<V, 4> {
+    typedef typename V::T T;
+    __attribute__((always_inline)) static void run(T* re, T* im) {
+        T t0r = V::add(re[0], re[2]), t0i = V::add(im[0], im[2]);
+        T t1r = V::sub(re[0], re[2]), t1i = V::sub(im[0], im[2]);
+        T t2r = V::add(re[1], re[3]), t2i = V::add(im[1], im[3]);
+        T t3r = V::sub(re[1], re[3]), t3i = V::sub(im[1], im[3]);
+        re[0] = V::add(t0r, t2r);
+        im[0] = V::add(t0i, t2i);
+        re[2] = V::sub(t0r, t2r);
+        im[2] = V::sub(t0i, t2i);
+        re[1] = V::add(t1r, t3i);
+        im[1] = V::sub(t1i, t3r);
+        re[3] = V::sub(t1r, t3i);
+        im[3] = V::add(t1i, t3r);
+    }
+};
+
+template <class V>
+struct FftButterfly<V, 5> {
+    typedef typename V::T T;
+    __attribute__((always_inline)) static void run(T* re, T* im) {
+        const T c1 = V::set1(0.309016994374947424f), c2 = V::set1(-0.809016994374947424f);
+        const T s1 = V::set1(0.951056516295153572f), s2 = V::set1(0.587785252292473129f);
+        T t1r = V::add(re[1], re[4]), t1i = V::add(im[1], im[4]);
+        T t2r = V::add(re[2], re[3]), t2i = V::add(im[2], im[3]);
+        T t3r = V::sub(re[1], re[4]), t3i = V::sub(im[1], im[4]);
+        T t4r = V::sub(re[2], re[3]), t4i = V::sub(im[2], im[3]);
+        T m1r = V::add(re[0], V::add(V::mul(c1, t1r), V::mul(c2, t2r)));
+        T m1i = V::add(im[0], V::add(V::mul(c1, t1i), V::mul(c2, t2i)));
+        T m2r = V::add(re[0], V::add(V::mul(c2, t1r), V::mul(c1, t2r)));
+        T m2i = V::add(im[0], V::add(V::mul(c2, t1i), V::mul(c1, t2i)));
+        T n1r = V::add(V::mul(s1, t3r), V::mul(s2, t4r)), n1i = V::add(V::mul(s1, t3i), V::mul(s2, t4i));
+        T n2r = V::sub(V::mul(s2, t3r), V::mul(s1, t4r)), n2i = V::sub(V::mul(s2, t3i), V::mul(s1, t4i));
+        re[0] = V::add(re[0], V::add(t1r, t2r));
+        im[0] = V::add(im[0], V::add(t1i, t2i));
+        re[1] = V::add(m1r, n1i);
+        im[1] = V::sub(m1i, n1r);
+        re[4] = V::sub(m1r, n1i);
+        im[4] = V::add(m1i, n1r);
+        re[2] = V::add(m2r, n2i);
+        im[2] = V::sub(m2i, n2r);
+        re[3] = V::sub(m2r, n2i);
+        im[3] = V::add(m2i, n2r);
+    }
+};
+
+// x *= (wr + i wi)
+template <class V>
+__attribute__((always_inline)) inline void fftRotate(typename V::T& re, typename V::T& im, float wr, float wi) {
+    typename V::T r = V::sub(V::mul(re, V::set1(wr)), V::mul(im, V::set1(wi)));
+    im = V::add(V::mul(re, V::set1(wi)), V::mul(im, V::set1(wr)));
+    re = r;
+}
+
+/* Stages: y[q + s (P j + k)] = W_len^(j k) b_k, b the butterfly of
+   x[q + s (j + r m)] for r < P */
+
+template <class V, int P>
+__attribute__((always_inline)) inline void fftStageFixed(const FftStage& stage, const float* xr, const float* xi, float* yr, float* yi) {
+    typedef typename V::T T;
+    int m = stage.m, s = stage.stride;
+    for (int j = 0; j < m; j++) {
+        const float* tw_re = stage.tw_re.data() + size_t(j) * (P - 1);
+        const float* tw_im = stage.tw_im.data() + size_t(j) * (P - 1);
+        for (int q = 0; q < s; q++) {
+            T re[P], im[P];
+            for (int r = 0; r < P; r++) {
+                size_t at = size_t(q + s * (j + r * m)) * kFftLanes;
+                re[r] = V::load(xr + at);
+                im[r] = V::load(xi + at);
+            }
+            FftButterfly<V, P>::run(re, im);
+            for (int k = 0; k < P; k++) {
+                if (j > 0 && k > 0) fftRotate<V>(re[k], im[k], tw_re[k - 1], tw_im[k - 1]);
+                size_t at = size_t(q + s * (P * j + k)) * kFftLanes;
+                V::store(yr + at, re[k]);
+                V::store(yi + at, im[k]);
+            }
+        }
+    }
+}
+
+// Any radix, as a direct DFT of the P inputs
+template <class V>
+__attribute__((always_inline)) inline void fftStageGeneric(const FftStage& stage, const float* xr, const float* xi, float* yr, float* yi) {
+    typedef typename V::T T;
+    int p = stage.radix, m = stage.m, s = stage.stride;
+    std::vector<float> in(2 * size_t(p) * kFftLanes);
+    float* in_re = in.data();
+    float* in_im = in_re + size_t(p) * kFftLanes;
+    for (int j = 0; j < m; j++) {
+        for (int q = 0; q < s; q++) {
+            for (int r = 0; r < p; r++) {
+                size_t at = size_t(q + s * (j + r * m)) * kFftLanes;
+                V::store(in_re + size_t(r) * kFftLanes, V::load(xr + at));
+                V::store(in_im + size_t(r) * kFftLanes, V::load(xi + at));
+            }
+            for (int k = 0; k < p; k++) {
+                T re = V::load(in_re), im = V::load(in_im);
+                for (int r = 1, e = k; r < p; r++, e = (e + k) % p) {
+                    T ar = V::load(in_re + size_t(r) * kFftLanes), ai = V::load(in_im + size_t(r) * kFftLanes);
+                    fftRotate<V>(ar, ai, stage.root_re[e], stage.root_im[e]);
+                    re = V::add(re, ar);
+                    im = V::add(im, ai);
+                }
+                if (j > 0 && k > 0) {
+                    size_t w = size_t(j) * (p - 1) + k - 1;
+                    fftRotate<V>(re, im, stage.tw_re[w], stage.tw_im[w]);
+                }
+                size_t at = size_t(q + s * (p * j + k)) * kFftLanes;
+                V::store(yr + at, re);
+                V::store(yi + at, im);
+            }
+        }
+    }
+}
+
+// The whole transform, ping-ponging between (re, im) and (work_re, work_im)
+template <class V>
+__attribute__((always_inline)) inline void fftRun(const FftPlan& plan, float* re, float* im, float* work_re, float* work_im) {
+    float* xr = re;
+    float* xi = im;
+    float* yr = work_re;
+    float* yi = work_im;
+    for (size_t i = 0; i < plan.stages.size(); i++) {
+        const FftStage& stage = plan.stages[i];
+        switch (stage.radix) {
+        case 2: fftStageFixed<V, 2>(stage, xr, xi, yr, yi); break;
+        case 3: fftStageFixed<V, 3>(stage, xr, xi, yr, yi); break;
+        case 4: fftStageFixed<V, 4>(stage, xr, xi, yr, yi); break;
+        case 5: fftStageFixed<V, 5>(stage, xr, xi, yr, yi); break;
+        default: fftStageGeneric<V>(stage, xr, xi, yr, yi); break;
+        }
+        std::swap(xr, yr);
+        std::swap(xi, yi);
+    }
+    if (xr != re) {
+        std::memcpy(re, xr, size_t(plan.n) * kFftLanes * sizeof(float));
+        std::memcpy(im, xi, size_t(plan.n) * kFftLanes * sizeof(float));
+    }
+}
+
+/* Real rows <-> half spectra, 8 rows at a time */
+
+// What a row pass needs besides the data
+struct FftRowPass {
+    const FftPlan* plan;     // cols / 2
+    const float* cos_k;      // cos(2 pi k / cols), k <= cols / 2
+    const float* sin_k;
+    int rows, cols, groups;  // groups of 8 bins
+    float* buffer;           // per-thread scratch, fftRowBufferSize() floats
+};
+
+inline size_t fftRowBufferSize(int cols, int groups) {
+    size_t half = size_t(cols / 2) * kFftLanes;
+    return 4 * half + 2 * size_t(groups) * kFftLanes * kFftLanes + 2 * kFftLanes;
+}
+
+// Rows [row0, row0 + 8) of image (missing rows read as zeros) into the half
+// spectra of the bin groups, columns still to be transformed
+template <class V>
+__attribute__((always_inline)) inline void fftRowsForward(const FftRowPass& pass, const float* image, size_t stride, int row0, float* re, float* im) {
+    typedef typename V::T T;
+    int h = pass.cols / 2;
+    size_t half = size_t(h) * kFftLanes;
+    float* zr = pass.buffer;
+    float* zi = zr + half;
+    float* work_re = zi + half;
+    float* work_im = work_re + half;
+    float* xr = work_im + half;
+    float* xi = xr + size_t(pass.groups) * kFftLanes * kFftLanes;
+    float* zeros = xi + size_t(pass.groups) * kFftLanes * kFftLanes;
+    float* dummy = zeros + kFftLanes;
+    std::fill(zeros, zeros + kFftLanes, 0.0f);
+
+    // Transpose into lanes: even columns are the real parts, odd columns the
+    // imaginary parts of h complex samples
+    const float* rows[kFftLanes];
+    for (int l = 0; l < kFftLanes; l++) rows[l] = (row0 + l < pass.rows) ? image + size_t(row0 + l) * stride : nullptr;
+    int c = 0;
+    for (; c + kFftLanes <= pass.cols; c += kFftLanes) {
+        const float* src[kFftLanes];
+        float* dst[kFftLanes];
+        for (int l = 0; l < kFftLanes; l++) {
+            src[l] = rows[l] ? rows[l] + c : zeros;
+            dst[l] = (((c + l) & 1) ? zi : zr) + size_t((c + l) / 2) * kFftLanes;
+        }
+        V::transpose(src, dst);
+    }
+    for (; c < pass.cols; c++) {
+        float* dst = ((c & 1) ? zi : zr) + size_t(c / 2) * kFftLanes;
+        for (int l = 0; l < kFftLanes; l++) dst[l] = rows[l] ? rows[l][c] : 0.0f;
+    }
+
+    fftRun<V>(*pass.plan, zr, zi, work_re, work_im);
+
+    // Untangle: with A = Z[k] and B = conj(Z[h - k]), the even samples'
+    // spectrum is (A + B) / 2, the odd samples' (A - B) / 2i, and
+    // X[k] = even + W^k odd
+    const T half_v = V::set1(0.5f);
+    T z0r = V::load(zr), z0i = V::load(zi);
+    V::store(xr, V::add(z0r, z0i));
+    V::store(xi, V::set1(0.0f));
+    V::store(xr + half, V::sub(z0r, z0i));
+    V::store(xi + half, V::set1(0.0f));
+    for (int k = 1; k < h; k++) {
+        T ar = V::load(zr + size_t(k) * kFftLanes), ai = V::load(zi + size_t(k) * kFftLanes);
+        T br = V::load(zr + size_t(h - k) * kFftLanes), bi = V::sub(V::set1(0.0f), V::load(zi + size_t(h - k) * kFftLanes));
+        T er = V::mul(half_v, V::add(ar, br)), ei = V::mul(half_v, V::add(ai, bi));
+        T or_ = V::mul(half_v, V::sub(ai, bi)), oi = V::mul(half_v, V::sub(br, ar));
+        fftRotate<V>(or_, oi, pass.cos_k[k], -pass.sin_k[k]);
+        V::store(xr + size_t(k) * kFftLanes, V::add(er, or_));
+        V::store(xi + size_t(k) * kFftLanes, V::add(ei, oi));
+    }
+    size_t bins = size_t(pass.groups) * kFftLanes;
+    std::fill(xr + (h + 1) * size_t(kFftLanes), xr + bins * kFftLanes, 0.0f);
+    std::fill(xi + (h + 1) * size_t(kFftLanes), xi + bins * kFftLanes, 0.0f);
+
+    // Transpose back: lanes become bins of the spectrum rows
+    for (int g = 0; g < pass.groups; g++) {
+        const float* src_re[kFftLanes];
+        const float* src_im[kFftLanes];
+        float* dst_re[kFftLanes];
+        float* dst_im[kFftLanes];
+        for (int l = 0; l < kFftLanes; l++) {
+            size_t bin = size_t(g) * kFftLanes + l;
+            src_re[l] = xr + bin * kFftLanes;
+            src_im[l] = xi + bin * kFftLanes;
+            size_t at = (size_t(g) * pass.rows + row0 + l) * kFftLanes;
+            bool valid = row0 + l < pass.rows;
+            dst_re[l] = valid ? re + at : dummy;
+            dst_im[l] = valid ? im + at : dummy;
+        }
+        V::transpose(src_re, dst_re);
+        V::transpose(src_im, dst_im);
+    }
+}
+
+// The inverse of fftRowsForward, after the columns have been transformed
+// back: half spectra to rows [row0, row0 + 8) of image, cols / 2 times the
+// real inverse
+template <class V>
+__attribute__((always_inline)) inline void fftRowsInverse(const FftRowPass& pass, const float* re, const float* im, int row0, float* image, size_t stride) {
+    typedef typename V::T T;
+    int h = pass.cols / 2;
+    size_t half = size_t(h) * kFftLanes;
+    float* zr = pass.buffer;
+    float* zi = zr + half;
+    float* work_re = zi + half;
+    float* work_im = work_re + half;
+    float* xr = work_im + half;
+    float* xi = xr + size_t(pass.groups) * kFftLanes * kFftLanes;
+    float* zeros = xi + size_t(pass.groups) * kFftLanes * kFftLanes;
+    float* dummy = zeros + kFftLanes;
+    std::fill(zeros, zeros + kFftLanes, 0.0f);
+
+    for (int g = 0; g < pass.groups; g++) {
+        const float* src_re[kFftLanes];
+        const float* src_im[kFftLanes];
+        float* dst_re[kFftLanes];
+        float* dst_im[kFftLanes];
+        for (int l = 0; l < kFftLanes; l++) {
+            size_t at = (size_t(g) * pass.rows + row0 + l) * kFftLanes;
+            bool valid = row0 + l < pass.rows;
+            src_re[l] = valid ? re + at : zeros;
+            src_im[l] = valid ? im + at : zeros;
+            size_t bin = size_t(g) * kFftLanes + l;
+            dst_re[l] = xr + bin * kFftLanes;
+            dst_im[l] = xi + bin * kFftLanes;
+        }
+        V::transpose(src_re, dst_re);
+        V::transpose(src_im, dst_im);
+    }
+
+    // Retangle: with B = conj(X[h - k]), the even samples' spectrum is
+    // X[k] + B and the odd samples' (X[k] - B) W^-k (both doubled), and
+    // Z[k] = even + i odd
+    for (int k = 0; k < h; k++) {
+        T ar = V::load(xr + size_t(k) * kFftLanes), ai = V::load(xi + size_t(k) * kFftLanes);
+        T br = V::load(xr + size_t(h - k) * kFftLanes), bi = V::sub(V::set1(0.0f), V::load(xi + size_t(h - k) * kFftLanes));
+        T er = V::add(ar, br), ei = V::add(ai, bi);
+        T or_ = V::sub(ar, br), oi = V::sub(ai, bi);
+        fftRotate<V>(or_, oi, pass.cos_k[k], pass.sin_k[k]);
+        V::store(zr + size_t(k) * kFftLanes, V::sub(er, oi));
+        V::store(zi + size_t(k) * kFftLanes, V::add(ei, or_));
+    }
+
+    fftRun<V>(*pass.plan, zi, zr, work_im, work_re);
+
+    float* rows[kFftLanes];
+    for (int l = 0; l < kFftLanes; l++) rows[l] = (row0 + l < pass.rows) ? image + size_t(row0 + l) * stride : nullptr;
+    int c = 0;
+    for (; c + kFftLanes <= pass.cols; c += kFftLanes) {
+        const float* src[kFftLanes];
+        float* dst[kFftLanes];
+        for (int l = 0; l < kFftLanes; l++) {
+            src[l] = (((c + l) & 1) ? zi : zr) + size_t((c + l) / 2) * kFftLanes;
+            dst[l] = rows[l] ? rows[l] + c : dummy;
+        }
+        V::transpose(src, dst);
+    }
+    for (; c < pass.cols; c++) {
+        const float* src = ((c & 1) ? zi : zr) + size_t(c / 2) * kFftLanes;
+        for (int l = 0; l < kFftLanes; l++) {
+            if (rows[l]) rows[l][c] = src[l];
+        }
+    }
+}
+
+#pragma GCC diagnostic pop
+
+/* Dispatch */
+
+typedef void (*FftLanesFn)(const FftPlan&, float*, float*, float*, float*);
+typedef void (*FftRowsForwardFn)(const FftRowPass&, const float*, size_t, int, float*, float*);
+typedef void (*FftRowsInverseFn)(const FftRowPass&, const float*, const float*, int, float*, size_t);
+
+inline void fftLanesScalar(const FftPlan& plan, float* re, float* im, float* work_re, float* work_im) {
+    fftRun<FftLanesScalar>(plan, re, im, work_re, work_im);
+}
+
+inline void fftRowsForwardScalar(const FftRowPass& pass, const float* image, size_t stride, int row0, float* re, float* im) {
+    fftRowsForward<FftLanesScalar>(pass, image, stride, row0, re, im);
+}
+
+inline void fftRowsInverseScalar(const FftRowPass& pass, const float* re, const float* im, int row0, float* image, size_t stride) {
+    fftRowsInverse<FftLanesScalar>(pass, re, im, row0, image, stride);
+}
+
+#if DIP_X86_DISPATCH
+__attribute__((target("avx2")))
+inline void fftLanesAvx2(const FftPlan& plan, float* re, float* im, float* work_re, float* work_im) {
+    fftRun<FftLanesAvx2>(plan, re, im, work_re, work_im);
+}
+
+__attribute__((target("avx2")))
+inline void fftRowsForwardAvx2(const FftRowPass& pass, const float* image, size_t stride, int row0, float* re, float* im) {
+    fftRowsForward<FftLanesAvx2>(pass, image, stride, row0, re, im);
+}
+
+__attribute__((target("avx2")))
+inline void fftRowsInverseAvx2(const FftRowPass& pass, const float* re, const float* im, int row0, float* image, size_t stride) {
+    fftRowsInverse<FftLanesAvx2>(pass, re, im, row0, image, stride);
+}
+#endif
+
+// Transform 8 sequences of length plan.n held as described at the top;
+// work_re and work_im hold as many floats. The inverse is not normalised.
+inline void fftLanes(const FftPlan& plan, float* re, float* im, float* work_re, float* work_im, bool inverse) {
+#if DIP_X86_DISPATCH
+    static const FftLanesFn variants[kCpuLevelCount] = {fftLanesScalar, nullptr, fftLanesAvx2, nullptr, nullptr};
+#else
+    static const FftLanesFn variants[kCpuLevelCount] = {fftLanesScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const FftLanesFn fn = pickKernel(variants);
+    if (inverse) {
+        fn(plan, im, re, work_im, work_re);
+    } else {
+        fn(plan, re, im, work_re, work_im);
+    }
+}
+
+/* 2-D real transform */
+
+class RealFft2D {
+public:
+    // cols must be even
+    RealFft2D(int rows, int cols)
+        : rows_(rows), cols_(cols), bins_(cols / 2 + 1), groups_((cols / 2 + kFftLanes) / kFftLanes),
+          row_plan_(&fftPlan(cols / 2)), col_plan_(&fftPlan(rows)) {
+        for (int k = 0; k <= cols / 2; k++) {
+            double angle = 2.0 * M_PI * k / cols;
+            cos_k_.push_back(float(std::cos(angle)));
+            sin_k_.push_back(float(std::sin(angle)));
+        }
+    }
+
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+    int bins() const { return bins_; }
+
+    // Floats in each of the real and imaginary spectrum arrays
+    size_t spectrumSize() const { return size_t(groups_) * rows_ * kFftLanes; }
+
+    // Where bin u of row v is in a spectrum array
+    size_t index(int v, int u) const { return (size_t(u / kFftLanes) * rows_ + v) * kFftLanes + u % kFftLanes; }
+
+    // Spectrum of the rows x cols image with rows stride floats apart
+    void forward(const float* image, size_t stride, float* re, float* im) const {
+#if DIP_X86_DISPATCH
+        static const FftRowsForwardFn variants[kCpuLevelCount] = {fftRowsForwardScalar, nullptr, fftRowsForwardAvx2, nullptr, nullptr};
+#else
+        static const FftRowsForwardFn variants[kCpuLevelCount] = {fftRowsForwardScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+        static const FftRowsForwardFn rows_fn = pickKernel(variants);
+        ThreadPool& pool = ThreadPool::shared();
+        pool.parallelFor((rows_ + kFftLanes - 1) / kFftLanes, [&](int g) {
+            FftRowPass pass = rowPass();
+            rows_fn(pass, image, stride, g * kFftLanes, re, im);
+        });
+        columns(re, im, false);
+    }
+
+    // The image back from its spectrum (which is overwritten), scaled by
+    // rows * cols
+    void inverse(float* re, float* im, float* image, size_t stride) const {
+#if DIP_X86_DISPATCH
+        static const FftRowsInverseFn variants[kCpuLevelCount] = {fftRowsInverseScalar, nullptr, fftRowsInverseAvx2, nullptr, nullptr};
+#else
+        static const FftRowsInverseFn variants[kCpuLevelCount] = {fftRowsInverseScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+        static const FftRowsInverseFn rows_fn = pickKernel(variants);
+        columns(re, im, true);
+        ThreadPool& pool = ThreadPool::shared();
+        pool.parallelFor((rows_ + kFftLanes - 1) / kFftLanes, [&](int g) {
+            FftRowPass pass = rowPass();
+            rows_fn(pass, re, im, g * kFftLanes, image, stride);
+        });
+    }
+
+private:
+    static std::vector<float>& scratch(size_t size) {
+        static thread_local std::vector<float> buffer;
+        if (buffer.size() < size) buffer.resize(size);
+        return buffer;
+    }
+
+    FftRowPass rowPass() const {
+        FftRowPass pass;
+        pass.plan = row_plan_;
+        pass.cos_k = cos_k_.data();
+        pass.sin_k = sin_k_.data();
+        pass.rows = rows_;
+        pass.cols = cols_;
+        pass.groups = groups_;
+        pass.buffer = scratch(fftRowBufferSize(cols_, groups_)).data();
+        return pass;
+    }
+
+    void columns(float* re, float* im, bool inverse) const {
+        ThreadPool::shared().parallelFor(groups_, [&](int g) {
+            size_t block = size_t(rows_) * kFftLanes;
+            float* work = scratch(2 * block).data();
+            fftLanes(*col_plan_, re + g * block, im + g * block, work, work + block, inverse);
+        });
+    }
+
+    int rows_, cols_, bins_, groups_;
+    const FftPlan* row_plan_;
+    const FftPlan* col_plan_;
+    std::vector<float> cos_k_, sin_k_;
+};
+
+// re and im *= gain, element by element (a real filter on a spectrum)
+inline void spectrumMultiply(float* re, float* im, const float* gain, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        re[i] *= gain[i];
+        im[i] *= gain[i];
+    }
+}
+
+#endif // DIP_COMMON_FFT_H
@@ -0,0 +1,224 @@
+#ifndef DIP_COMMON_FLIP_H
+#define DIP_COMMON_FLIP_H
+
+// Mirror flips and 180 degree rotation, in place.
+//
+// A row is mirrored by swapping whole blocks of pixels from its two ends,
+// each block reversed in registers: pshufd for 4-byte pixels and a set of
+// byte shuffles across three registers for 3-byte pixels (16 pixels = 48
+// bytes per block), so no pixel in the middle of a row goes through a scalar
+// loop. The last blocks of a row are allowed to overlap; they are all loaded
+// before any is stored, so every byte still gets its mirrored value. Rows
+// narrower than one block are done per pixel.
+//
+// The same kernel mirrors a pair of rows into each other (row a gets b
+// reversed and b gets a reversed), which with the rows swapped top to bottom
+// is the 180 degree rotation. No image-sized buffer is ever allocated.
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bmp_io.h"
+#include "dispatch.h"
+#include "tile_executor.h"
+
+// a gets b's pixels last to first and b gets a's; a == b mirrors one row
+typedef void (*MirrorRowPairFn)(unsigned char*, unsigned char*, int, int);
+
+template <int NC>
+inline void mirrorRowPairPixels(unsigned char* a, unsigned char* b, int width) {
+    unsigned char t[4][NC];
+    for (int x = 0; x < (width + 1) / 2; x++) {
+        int l = x * NC, r = (width - 1 - x) * NC;
+        std::memcpy(t[0], a + l, NC);
+        std::memcpy(t[1], b + r, NC);
+        std::memcpy(t[2], a + r, NC);
+        std::memcpy(t[3], b + l, NC);
+        std::memcpy(a + l, t[1], NC);
+        std::memcpy(b + r, t[0], NC);
+        std::memcpy(a + r, t[3], NC);
+        std::memcpy(b + l, t[2], NC);
+    }
+}
+
+inline void mirrorRowPairScalar(unsigned char* a, unsigned char* b, int width, int nc) {
+    if (nc == 4) {
+        mirrorRowPairPixels<4>(a, b, width);
+    } else {
+        mirrorRowPairPixels<3>(a, b, width);
+    }
+}
+
+// Mirror a row pair with Block::run, which reverses Block::kPixels pixels
+// from src into dst. Always inlined so that run() is inlined into the
+// target-specific caller.
+template <typename Block>
+__attribute__((always_inline)) inline void mirrorRowPairBlocks(unsigned char* a, unsigned char* b, int width, int nc) {
+    const int P = Block::kPixels;
+    const size_t bytes = size_t(P) * nc;
+    if (width < P) {
+        mirrorRowPairScalar(a, b, width, nc);
+        return;
+    }
+    unsigned char t[8][Block::kBytes];
+    int i = 0, j = width;  // pixels [i, j) are still to be done
+    for (; j - i > 4 * P; i += P, j -= P) {
+        size_t l = size_t(i) * nc, r = size_t(j - P) * nc;
+        Block::run(b + r, t[0]);
+        Block::run(a + l, t[1]);
+        Block::run(b + l, t[2]);
+        Block::run(a + r, t[3]);
+        std::memcpy(a + l, t[0], bytes);
+        std::memcpy(b + r, t[1], bytes);
+        std::memcpy(a + r, t[2], bytes);
+        std::memcpy(b + l, t[3], bytes);
+    }
+
+    // The last one or two block pairs, which may overlap each other
+    int pairs = (j - i > 2 * P) ? 2 : 1;
+    for (int k = 0; k < pairs; k++) {
+        size_t l = size_t(i + k * P) * nc, r = size_t(j - (k + 1) * P) * nc;
+        Block::run(b + r, t[4 * k]);
+        Block::run(a + l, t[4 * k + 1]);
+        Block::run(b + l, t[4 * k + 2]);
+        Block::run(a + r, t[4 * k + 3]);
+    }
+    for (int k = 0; k < pairs; k++) {
+        size_t l = size_t(i + k * P) * nc, r = size_t(j - (k + 1) * P) * nc;
+        std::memcpy(a + l, t[4 * k], bytes);
+        std::memcpy(b + r, t[4 * k + 1], bytes);
+        std::memcpy(a + r, t[4 * k + 2], bytes);
+        std::memcpy(b + l, t[4 * k + 3], bytes);
+    }
+}
+
+#if DIP_X86_DISPATCH
+struct FlipBlock4Sse2 {
+    static const int kPixels = 4;
+    static const int kBytes = 16;
+    __attribute__((target("sse2")))
+    static void run(const unsigned char* src, unsigned char* dst) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_shuffle_epi32(v, 0x1B));
+    }
+};
+
+struct FlipBlock4Avx2 {
+    static const int kPixels = 8;
+    static const int kBytes = 32;
+    __attribute__((target("avx2")))
+    static void run(const unsigned char* src, unsigned char* dst) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+        v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), v);
+    }
+};
+
+// Byte k of output register r takes byte kFlip3Masks[r][s][k] of input
+// register s (0x80 = none) when 16 BGR pixels are reversed
+alignas(16) static const unsigned char kFlip3Masks[3][3][16] = {
+    {{0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+     {0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 14},
+     {13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6, 1, 2, 3, 0x80}},
+    {{0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 15, 0x80},
+     {15, 0x80, 11, 12, 13, 8, 9, 10, 5, 6, 7, 2, 3, 4, 0x80, 0},
+     {0x80, 0, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80}},
+    {{0x80, 12, 13, 14, 9, 10, 11, 6, 7, 8, 3, 4, 5, 0, 1, 2},
+     {1, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+     {0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80}}};
+
+struct FlipBlock3Avx2 {
+    static const int kPixels = 16;
+    static const int kBytes = 48;
+    __attribute__((target("avx2")))
+    static __m128i mask(int r, int s) { return _mm_load_si128(reinterpret_cast<const __m128i*>(kFlip3Masks[r][s])); }
+
+    __attribute__((target("avx2")))
+    static void run(const unsigned char* src, unsigned char* dst) {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+        __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+        __m128i o0 = _mm_or_si128(_mm_shuffle_epi8(v1, mask(0, 1)), _mm_shuffle_epi8(v2, mask(0, 2)));
+        __m128i o1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, mask(1, 0)), _mm_shuffle_epi8(v1, mask(1, 1))), _mm_shuffle_epi8(v2, mask(1, 2)));
+        __m128i o2 = _mm_or_si128(_mm_shuffle_epi8(v0, mask(2, 0)), _mm_shuffle_epi8(v1, mask(2, 1)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), o0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), o1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 32), o2);
+    }
+};
+
+__attribute__((target("sse2")))
+inline void mirrorRowPairSse2(unsigned char* a, unsigned char* b, int width, int nc) {
+    if (nc == 4) {
+        mirrorRowPairBlocks<FlipBlock4Sse2>(a, b, width, nc);
+    } else {
+        mirrorRowPairScalar(a, b, width, nc);
+    }
+}
+
+__attribute__((target("avx2")))
+inline void mirrorRowPairAvx2(unsigned char* a, unsigned char* b, int width, int nc) {
+    if (nc == 4) {
+        mirrorRowPairBlocks<FlipBlock4Avx2>(a, b, width, nc);
+    } else if (nc == 3) {
+        mirrorRowPairBlocks<FlipBlock3Avx2>(a, b, width, nc);
+    } else {
+        mirrorRowPairScalar(a, b, width, nc);
+    }
+}
+#endif
+
+inline void mirrorRowPair(unsigned char* a, unsigned char* b, int width, int nc) {
+#if DIP_X86_DISPATCH
+    static const MirrorRowPairFn variants[kCpuLevelCount] = {mirrorRowPairScalar, mirrorRowPairSse2, mirrorRowPairAvx2, nullptr, nullptr};
+#else
+    static const MirrorRowPairFn variants[kCpuLevelCount] = {mirrorRowPairScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const MirrorRowPairFn fn = pickKernel(variants);
+    fn(a, b, width, nc);
+}
+
+// Out-of-place: dst gets src's pixels last to first
+inline void mirrorRow(const unsigned char* src, unsigned char* dst, int width, int nc) {
+    std::memcpy(dst, src, size_t(width) * nc);
+    mirrorRowPair(dst, dst, width, nc);
+}
+
+inline void swapBytes(unsigned char* a, unsigned char* b, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16) {
+        __m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(a + i), v);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(b + i), u);
+    }
+#endif
+    for (; i < n; i++) std::swap(a[i], b[i]);
+}
+
+inline void flipHorizontal(const BMPImage& image) {
+    forEachTile(image.height, image.rowBytes(), 0, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) mirrorRowPair(image.row(y), image.row(y), image.width, image.num_channel);
+    });
+}
+
+inline void flipVertical(const BMPImage& image) {
+    int h = image.height;
+    forEachTile(h / 2, 2 * image.rowBytes(), 0, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) swapBytes(image.row(y), image.row(h - 1 - y), image.rowBytes());
+    });
+}
+
+inline void rotate180(const BMPImage& image) {
+    int h = image.height;
+    forEachTile((h + 1) / 2, 2 * image.rowBytes(), 0, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) mirrorRowPair(image.row(y), image.row(h - 1 - y), image.width, image.num_channel);
+    });
+}
+
+#endif // DIP_COMMON_FLIP_H
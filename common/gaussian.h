@@ -0,0 +1,411 @@
+#ifndef DIP_COMMON_GAUSSIAN_H
+#define DIP_COMMON_GAUSSIAN_H
+
+// Gaussian blur.
+//
+// Small sigma uses a separable FIR (vertical pass straight from the 8-bit
+// rows, then a horizontal pass over a float row), with symmetric taps folded
+// and SSE2 doing four/sixteen elements at a time. Large sigma uses the
+// Young - van Vliet third-order recursive filter, whose cost per pixel does
+// not depend on sigma. The FIR only needs the rows within its radius, so it
+// can also run from a streamed row window; the IIR needs whole columns.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bmp_io.h"
+#include "tile_executor.h"
+
+// Above this sigma the recursive filter is cheaper than the SIMD FIR
+static const double kGaussianIirSigma = 8.0;
+
+// Normalised taps w[0..radius] of a Gaussian, radius = ceil(3 * sigma)
+inline std::vector<float> gaussianKernel(double sigma) {
+    int radius = std::max(1, int(std::ceil(3.0 * sigma)));
+    std::vector<double> w(radius + 1);
+    double sum = 0.0;
+    for (int k = 0; k <= radius; k++) {
+        w[k] = std::exp(-0.5 * k * k / (sigma * sigma));
+        sum += (k == 0) ? w[k] : 2.0 * w[k];
+    }
+    std::vector<float> taps(radius + 1);
+    for (int k = 0; k <= radius; k++) taps[k] = float(w[k] / sum);
+    return taps;
+}
+
+inline unsigned char saturateToByte(float v) {
+    long r = lrintf(v);
+    return static_cast<unsigned char>(r < 0 ? 0 : (r > 255 ? 255 : r));
+}
+
+#ifdef __SSE2__
+// Round and saturate 16 floats to 16 bytes
+inline void storeBytes16(unsigned char* dst, __m128 a, __m128 b, __m128 c, __m128 d) {
+    __m128i lo = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+    __m128i hi = _mm_packs_epi32(_mm_cvtps_epi32(c), _mm_cvtps_epi32(d));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(lo, hi));
+}
+#endif
+
+class GaussianFir {
+public:
+    GaussianFir() : width_(0), num_channel_(0), radius_(0) {}
+    GaussianFir(int width, int num_channel, double sigma) { reset(width, num_channel, sigma); }
+
+    void reset(int width, int num_channel, double sigma) {
+        width_ = width;
+        num_channel_ = num_channel;
+        taps_ = gaussianKernel(sigma);
+        radius_ = int(taps_.size()) - 1;
+        padded_.assign(size_t(width + 2 * radius_) * num_channel + 4, 0.0f);
+    }
+
+    int radius() const { return radius_; }
+
+    // Blur output row y; rowAt(j) must return source row y + j clamped to
+    // the image, for j in [-radius, radius].
+    template <typename RowAt>
+    void blurRow(RowAt rowAt, unsigned char* out) {
+        int nc = num_channel_;
+        int n = width_ * nc;
+        float* tmp = padded_.data() + size_t(radius_) * nc;
+        verticalPass(rowAt, tmp, n);
+
+        // Replicate the edge pixels into the padding
+        for (int x = 1; x <= radius_; x++) {
+            for (int c = 0; c < nc; c++) {
+                tmp[-x * nc + c] = tmp[c];
+                tmp[n - nc + x * nc + c] = tmp[n - nc + c];
+            }
+        }
+        horizontalPass(tmp, out, n);
+    }
+
+private:
+    template <typename RowAt>
+    void verticalPass(RowAt rowAt, float* tmp, int n) {
+        const float* w = taps_.data();
+        const unsigned char* center = rowAt(0);
+        int i = 0;
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= n; i += 16) {
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(center + i));
+            __m128i c_lo = _mm_unpacklo_epi8(c, zero);
+            __m128i c_hi = _mm_unpackhi_epi8(c, zero);
+            __m128 w0 = _mm_set1_ps(w[0]);
+            __m128 acc0 = _mm_mul_ps(w0, _mm_cvtepi32_ps(_mm_unpacklo_epi16(c_lo, zero)));
+            __m128 acc1 = _mm_mul_ps(w0, _mm_cvtepi32_ps(_mm_unpackhi_epi16(c_lo, zero)));
+            __m128 acc2 = _mm_mul_ps(w0, _mm_cvtepi32_ps(_mm_unpacklo_epi16(c_hi, zero)));
+            __m128 acc3 = _mm_mul_ps(w0, _mm_cvtepi32_ps(_mm_unpackhi_epi16(c_hi, zero)));
+            for (int k = 1; k <= radius_; k++) {
+                // Fold the symmetric taps: w[k] * (above + below), summed in 16 bits
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowAt(-k) + i));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowAt(k) + i));
+                __m128i s_lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+                __m128i s_hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+                __m128 wk = _mm_set1_ps(w[k]);
+                acc0 = _mm_add_ps(acc0, _mm_mul_ps(wk, _mm_cvtepi32_ps(_mm_unpacklo_epi16(s_lo, zero))));
+                acc1 = _mm_add_ps(acc1, _mm_mul_ps(wk, _mm_cvtepi32_ps(_mm_unpackhi_epi16(s_lo, zero))));
+                acc2 = _mm_add_ps(acc2, _mm_mul_ps(wk, _mm_cvtepi32_ps(_mm_unpacklo_epi16(s_hi, zero))));
+                acc3 = _mm_add_ps(acc3, _mm_mul_ps(wk, _mm_cvtepi32_ps(_mm_unpackhi_epi16(s_hi, zero))));
+            }
+            _mm_storeu_ps(tmp + i, acc0);
+            _mm_storeu_ps(tmp + i + 4, acc1);
+            _mm_storeu_ps(tmp + i + 8, acc2);
+            _mm_storeu_ps(tmp + i + 12, acc3);
+        }
+#endif
+        for (; i < n; i++) {
+            float acc = w[0] * center[i];
+            for (int k = 1; k <= radius_; k++) acc += w[k] * float(rowAt(-k)[i] + rowAt(k)[i]);
+            tmp[i] = acc;
+        }
+    }
+
+    void horizontalPass(const float* tmp, unsigned char* out, int n) {
+        const float* w = taps_.data();
+        int nc = num_channel_;
+        int i = 0;
+#ifdef __SSE2__
+        for (; i + 16 <= n; i += 16) {
+            __m128 acc[4];
+            for (int q = 0; q < 4; q++) {
+                const float* t = tmp + i + 4 * q;
+                __m128 a = _mm_mul_ps(_mm_set1_ps(w[0]), _mm_loadu_ps(t));
+                for (int k = 1; k <= radius_; k++) {
+                    __m128 s = _mm_add_ps(_mm_loadu_ps(t - k * nc), _mm_loadu_ps(t + k * nc));
+                    a = _mm_add_ps(a, _mm_mul_ps(_mm_set1_ps(w[k]), s));
+                }
+                acc[q] = a;
+            }
+            storeBytes16(out + i, acc[0], acc[1], acc[2], acc[3]);
+        }
+#endif
+        for (; i < n; i++) {
+            float acc = w[0] * tmp[i];
+            for (int k = 1; k <= radius_; k++) acc += w[k] * (tmp[i - k * nc] + tmp[i + k * nc]);
+            out[i] = saturateToByte(acc);
+        }
+    }
+
+    int width_;
+    int num_channel_;
+    int radius_;
+    std::vector<float> taps_;
+    std::vector<float> padded_;   // one vertically filtered row with radius_ pixels of padding each side
+};
+
+// Young - van Vliet recursive Gaussian coefficients
+struct GaussianIirCoeffs {
+    float B;
+    float a1, a2, a3;   // b1/b0, b2/b0, b3/b0
+    // Right-edge start values of the anti-causal pass (Triggs - Sdika): with
+    // u the last input and d[j] = causal output at n - 1 - j minus u, the
+    // anti-causal filter continues from u + sum_j M[k][j] * d[j] at n + k.
+    float M[3][3];
+
+    explicit GaussianIirCoeffs(double sigma) {
+        double q = (sigma >= 2.5) ? 0.98711 * sigma - 0.96330
+                                  : 3.97156 - 4.14554 * std::sqrt(1.0 - 0.26891 * sigma);
+        double q2 = q * q;
+        double q3 = q2 * q;
+        double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+        double b1 = 2.44413 * q + 2.85619 * q2 + 1.26661 * q3;
+        double b2 = -(1.4281 * q2 + 1.26661 * q3);
+        double b3 = 0.422205 * q3;
+        double c[4] = {1.0 - (b1 + b2 + b3) / b0, b1 / b0, b2 / b0, b3 / b0};
+        B = float(c[0]);
+        a1 = float(c[1]);
+        a2 = float(c[2]);
+        a3 = float(c[3]);
+
+        // Run both recursions past the edge on a constant-extended input,
+        // once per unit deviation, until the response has died out.
+        int len = int(20.0 * sigma) + 64;
+        std::vector<double> d(len + 3), e(len + 3);
+        for (int j = 0; j < 3; j++) {
+            std::fill(d.begin(), d.end(), 0.0);
+            std::fill(e.begin(), e.end(), 0.0);
+            d[2 - j] = 1.0;   // d[0..2] hold offsets n - 3 .. n - 1
+            for (int m = 3; m < len + 3; m++) d[m] = c[1] * d[m - 1] + c[2] * d[m - 2] + c[3] * d[m - 3];
+            for (int m = len - 1; m >= 3; m--) e[m] = c[0] * d[m] + c[1] * e[m + 1] + c[2] * e[m + 2] + c[3] * e[m + 3];
+            for (int k = 0; k < 3; k++) M[k][j] = float(e[3 + k]);
+        }
+    }
+};
+
+// One recursion step for n independent signals, in place:
+// row = B * row + a1 * p1 + a2 * p2 + a3 * p3
+inline void gaussianIirRow(const GaussianIirCoeffs& g, float* row, const float* p1, const float* p2, const float* p3, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128 B = _mm_set1_ps(g.B), a1 = _mm_set1_ps(g.a1), a2 = _mm_set1_ps(g.a2), a3 = _mm_set1_ps(g.a3);
+    for (; i + 4 <= n; i += 4) {
+        __m128 w = _mm_add_ps(_mm_mul_ps(B, _mm_loadu_ps(row + i)),
+                   _mm_add_ps(_mm_mul_ps(a1, _mm_loadu_ps(p1 + i)),
+                   _mm_add_ps(_mm_mul_ps(a2, _mm_loadu_ps(p2 + i)), _mm_mul_ps(a3, _mm_loadu_ps(p3 + i)))));
+        _mm_storeu_ps(row + i, w);
+    }
+#endif
+    for (; i < n; i++) row[i] = g.B * row[i] + g.a1 * p1[i] + g.a2 * p2[i] + g.a3 * p3[i];
+}
+
+// Anti-causal start values for n independent signals: u is the last input,
+// w[j] the causal output j steps before the edge, start[k] the value k
+// steps past it.
+inline void gaussianIirEdge(const GaussianIirCoeffs& g, const float* u, const float* const w[3], float* const start[3], size_t n) {
+    for (int k = 0; k < 3; k++) {
+        const float* m = g.M[k];
+        for (size_t i = 0; i < n; i++) {
+            start[k][i] = u[i] + m[0] * (w[0][i] - u[i]) + m[1] * (w[1][i] - u[i]) + m[2] * (w[2][i] - u[i]);
+        }
+    }
+}
+
+#ifdef __SSE2__
+// Causal then anti-causal recursion over n groups of four floats in place;
+// each lane is an independent signal.
+inline void gaussianIirLanes(float* v, int n, const GaussianIirCoeffs& g) {
+    __m128 B = _mm_set1_ps(g.B), a1 = _mm_set1_ps(g.a1), a2 = _mm_set1_ps(g.a2), a3 = _mm_set1_ps(g.a3);
+    __m128 u = _mm_loadu_ps(v + 4 * (n - 1));
+    __m128 w1 = _mm_loadu_ps(v), w2 = w1, w3 = w1;
+    for (int i = 0; i < n; i++) {
+        __m128 w = _mm_add_ps(_mm_mul_ps(B, _mm_loadu_ps(v + 4 * i)),
+                   _mm_add_ps(_mm_mul_ps(a1, w1), _mm_add_ps(_mm_mul_ps(a2, w2), _mm_mul_ps(a3, w3))));
+        w3 = w2; w2 = w1; w1 = w;
+        _mm_storeu_ps(v + 4 * i, w);
+    }
+    __m128 d0 = _mm_sub_ps(w1, u), d1 = _mm_sub_ps(w2, u), d2 = _mm_sub_ps(w3, u);
+    __m128 p[3];
+    for (int k = 0; k < 3; k++) {
+        p[k] = _mm_add_ps(u, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(g.M[k][0]), d0),
+                             _mm_add_ps(_mm_mul_ps(_mm_set1_ps(g.M[k][1]), d1), _mm_mul_ps(_mm_set1_ps(g.M[k][2]), d2))));
+    }
+    w1 = p[0]; w2 = p[1]; w3 = p[2];
+    for (int i = n - 1; i >= 0; i--) {
+        __m128 w = _mm_add_ps(_mm_mul_ps(B, _mm_loadu_ps(v + 4 * i)),
+                   _mm_add_ps(_mm_mul_ps(a1, w1), _mm_add_ps(_mm_mul_ps(a2, w2), _mm_mul_ps(a3, w3))));
+        w3 = w2; w2 = w1; w1 = w;
+        _mm_storeu_ps(v + 4 * i, w);
+    }
+}
+#endif
+
+// Causal then anti-causal recursion over one strided signal in place
+inline void gaussianIirLine(float* v, int n, int step, const GaussianIirCoeffs& g) {
+    float u = v[(n - 1) * step];
+    float w1 = v[0], w2 = v[0], w3 = v[0];
+    for (int i = 0; i < n; i++) {
+        float w = g.B * v[i * step] + g.a1 * w1 + g.a2 * w2 + g.a3 * w3;
+        w3 = w2; w2 = w1; w1 = w;
+        v[i * step] = w;
+    }
+    float p[3];
+    for (int k = 0; k < 3; k++) p[k] = u + g.M[k][0] * (w1 - u) + g.M[k][1] * (w2 - u) + g.M[k][2] * (w3 - u);
+    w1 = p[0]; w2 = p[1]; w3 = p[2];
+    for (int i = n - 1; i >= 0; i--) {
+        float w = g.B * v[i * step] + g.a1 * w1 + g.a2 * w2 + g.a3 * w3;
+        w3 = w2; w2 = w1; w1 = w;
+        v[i * step] = w;
+    }
+}
+
+// Floats per column strip of the vertical recursion
+const size_t kGaussianIirStrip = 1024;
+
+// Vertical pass over columns [i0, i1) of every row: every element of a row
+// is an independent signal, so the recursion runs down the image a whole
+// strip of a row at a time.
+inline void gaussianIirColumns(const BMPConstImage& in, float* plane, size_t n, size_t i0, size_t i1, const GaussianIirCoeffs& g) {
+    int height = in.height;
+    size_t len = i1 - i0;
+    for (int y = 0; y < height; y++) {
+        const unsigned char* src = in.row(y) + i0;
+        float* row = plane + size_t(y) * n + i0;
+        for (size_t i = 0; i < len; i++) row[i] = src[i];
+    }
+    std::vector<float> first(plane + i0, plane + i1);
+    std::vector<float> last(plane + size_t(height - 1) * n + i0, plane + size_t(height - 1) * n + i1);
+    for (int y = 0; y < height; y++) {
+        const float* p[3];
+        for (int k = 1; k <= 3; k++) p[k - 1] = (y - k >= 0) ? plane + size_t(y - k) * n + i0 : first.data();
+        gaussianIirRow(g, plane + size_t(y) * n + i0, p[0], p[1], p[2], len);
+    }
+    std::vector<float> edge(3 * len);
+    const float* w[3];
+    float* start[3];
+    for (int k = 0; k < 3; k++) {
+        w[k] = (height - 1 - k >= 0) ? plane + size_t(height - 1 - k) * n + i0 : first.data();
+        start[k] = edge.data() + size_t(k) * len;
+    }
+    gaussianIirEdge(g, last.data(), w, start, len);
+    for (int y = height - 1; y >= 0; y--) {
+        const float* p[3];
+        for (int k = 1; k <= 3; k++) p[k - 1] = (y + k < height) ? plane + size_t(y + k) * n + i0 : start[y + k - height];
+        gaussianIirRow(g, plane + size_t(y) * n + i0, p[0], p[1], p[2], len);
+    }
+}
+
+// Horizontal pass over rows [y0, y1), then conversion to bytes into out
+inline void gaussianIirRows(float* plane, int width, int nc, int y0, int y1, const GaussianIirCoeffs& g, const BMPImage& out) {
+    size_t n = size_t(width) * nc;
+    int y = y0;
+#ifdef __SSE2__
+    // Four rows at a time, one row per SSE lane, with 4x4 transposes to move
+    // between row-major floats and lanes.
+    std::vector<float> lanes(4 * n);
+    std::vector<float> channel(4 * size_t(width));
+    for (; y + 4 <= y1; y += 4) {
+        float* r[4];
+        for (int q = 0; q < 4; q++) r[q] = plane + size_t(y + q) * n;
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128 a = _mm_loadu_ps(r[0] + i), b = _mm_loadu_ps(r[1] + i);
+            __m128 c = _mm_loadu_ps(r[2] + i), d = _mm_loadu_ps(r[3] + i);
+            _MM_TRANSPOSE4_PS(a, b, c, d);
+            _mm_storeu_ps(&lanes[4 * i], a); _mm_storeu_ps(&lanes[4 * i + 4], b);
+            _mm_storeu_ps(&lanes[4 * i + 8], c); _mm_storeu_ps(&lanes[4 * i + 12], d);
+        }
+        for (; i < n; i++) {
+            for (int q = 0; q < 4; q++) lanes[4 * i + q] = r[q][i];
+        }
+
+        // Channels are interleaved, so run the recursion per channel
+        for (int c = 0; c < nc; c++) {
+            for (int x = 0; x < width; x++) _mm_storeu_ps(&channel[4 * x], _mm_loadu_ps(&lanes[4 * (size_t(x) * nc + c)]));
+            gaussianIirLanes(channel.data(), width, g);
+            for (int x = 0; x < width; x++) _mm_storeu_ps(&lanes[4 * (size_t(x) * nc + c)], _mm_loadu_ps(&channel[4 * x]));
+        }
+
+        for (i = 0; i + 4 <= n; i += 4) {
+            __m128 a = _mm_loadu_ps(&lanes[4 * i]), b = _mm_loadu_ps(&lanes[4 * i + 4]);
+            __m128 c = _mm_loadu_ps(&lanes[4 * i + 8]), d = _mm_loadu_ps(&lanes[4 * i + 12]);
+            _MM_TRANSPOSE4_PS(a, b, c, d);
+            _mm_storeu_ps(r[0] + i, a); _mm_storeu_ps(r[1] + i, b);
+            _mm_storeu_ps(r[2] + i, c); _mm_storeu_ps(r[3] + i, d);
+        }
+        for (; i < n; i++) {
+            for (int q = 0; q < 4; q++) r[q][i] = lanes[4 * i + q];
+        }
+    }
+#endif
+    for (; y < y1; y++) {
+        float* row = plane + size_t(y) * n;
+        for (int c = 0; c < nc; c++) gaussianIirLine(row + c, width, nc, g);
+    }
+
+    for (y = y0; y < y1; y++) {
+        const float* row = plane + size_t(y) * n;
+        unsigned char* dst = out.row(y);
+        for (size_t i = 0; i < n; i++) dst[i] = saturateToByte(row[i]);
+    }
+}
+
+// Recursive Gaussian; cost per pixel is independent of sigma. Needs one float
+// per channel of the whole image as scratch. The vertical pass runs on
+// column strips and the horizontal pass on bands of rows, both in parallel.
+inline void gaussianBlurIir(const BMPConstImage& in, const BMPImage& out, double sigma) {
+    GaussianIirCoeffs g(sigma);
+    int width = in.width;
+    int height = in.height;
+    int nc = in.num_channel;
+    size_t n = size_t(width) * nc;
+    std::vector<float> plane(n * height);
+    float* data = plane.data();
+
+    int strips = int((n + kGaussianIirStrip - 1) / kGaussianIirStrip);
+    ThreadPool::shared().parallelFor(strips, [&](int s) {
+        gaussianIirColumns(in, data, n, s * kGaussianIirStrip, std::min(n, (s + 1) * kGaussianIirStrip), g);
+    });
+    forEachTile(height, n * sizeof(float), 0, [&](int y0, int y1) {
+        gaussianIirRows(data, width, nc, y0, y1, g, out);
+    });
+}
+
+inline void gaussianBlurFir(const BMPConstImage& in, const BMPImage& out, double sigma) {
+    int radius = int(gaussianKernel(sigma).size()) - 1;
+    forEachTile(in.height, in.rowBytes(), radius, [&](int y0, int y1) {
+        GaussianFir fir(in.width, in.num_channel, sigma);
+        for (int y = y0; y < y1; y++) {
+            fir.blurRow([&](int j) { return in.row(std::max(0, std::min(in.height - 1, y + j))); }, out.row(y));
+        }
+    });
+}
+
+// Out-of-place Gaussian blur; picks the FIR or the recursive filter by sigma
+inline void gaussianBlur(const BMPConstImage& in, const BMPImage& out, double sigma) {
+    if (sigma < kGaussianIirSigma) {
+        gaussianBlurFir(in, out, sigma);
+    } else {
+        gaussianBlurIir(in, out, sigma);
+    }
+}
+
+#endif // DIP_COMMON_GAUSSIAN_H
@@ -0,0 +1,149 @@
+#ifndef DIP_COMMON_HISTOGRAM_H
+#define DIP_COMMON_HISTOGRAM_H
+
+// Image histograms and the tone curves derived from them.
+//
+// Counting is split into bands of rows on the shared thread pool, each band
+// counting into its own tables, so threads never share a counter. Within a
+// band consecutive pixels go to four interleaved sub-histograms: runs of
+// equal values (flat sky, black borders) would otherwise increment the same
+// counter back to back, and every increment would wait for the store of the
+// one before it. The sub-histograms are summed when the band is done, and
+// the bands are merged in parallel, each thread summing a slice of the bins
+// over all bands. Counts are integers, so the result does not depend on the
+// number of threads.
+//
+// A histogram has one plane per colour channel (B, G, R; alpha is not
+// counted) or a single plane of luma, Y = (29 B + 150 G + 77 R + 128) >> 8.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "bmp_io.h"
+#include "tile_executor.h"
+
+enum HistogramKind {
+    kHistogramChannels,
+    kHistogramLuma
+};
+
+inline int lumaOf(const unsigned char* p) {
+    return (29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8;
+}
+
+struct Histogram {
+    int planes;          // 3 for kHistogramChannels, 1 for kHistogramLuma
+    uint64_t total;      // pixels counted
+    uint64_t bins[3][256];
+
+    Histogram() : planes(0), total(0) { std::memset(bins, 0, sizeof(bins)); }
+};
+
+// Add the pixels [x0, x1) of rows [y0, y1) to counts (one plane per
+// channel, or one luma plane)
+inline void histogramCount(const BMPConstImage& in, int y0, int y1, int x0, int x1, HistogramKind kind, uint32_t counts[][256]) {
+    const int kSub = 4;
+    static thread_local uint32_t sub[kSub][3][256];
+    int planes = (kind == kHistogramLuma) ? 1 : 3;
+    std::memset(sub, 0, sizeof(sub));
+    int nc = in.num_channel;
+    for (int y = y0; y < y1; y++) {
+        const unsigned char* row = in.row(y) + size_t(x0) * nc;
+        int n = x1 - x0, x = 0;
+        if (kind == kHistogramLuma) {
+            for (; x + kSub <= n; x += kSub) {
+                const unsigned char* p = row + size_t(x) * nc;
+                sub[0][0][lumaOf(p)]++;
+                sub[1][0][lumaOf(p + nc)]++;
+                sub[2][0][lumaOf(p + 2 * nc)]++;
+                sub[3][0][lumaOf(p + 3 * nc)]++;
+            }
+            for (; x < n; x++) sub[0][0][lumaOf(row + size_t(x) * nc)]++;
+        } else {
+            for (; x + kSub <= n; x += kSub) {
+                const unsigned char* p = row + size_t(x) * nc;
+                for (int s = 0; s < kSub; s++, p += nc) {
+                    sub[s][0][p[0]]++;
+                    sub[s][1][p[1]]++;
+                    sub[s][2][p[2]]++;
+                }
+            }
+            for (; x < n; x++) {
+                const unsigned char* p = row + size_t(x) * nc;
+                sub[0][0][p[0]]++;
+                sub[0][1][p[1]]++;
+                sub[0][2][p[2]]++;
+            }
+        }
+    }
+    for (int p = 0; p < planes; p++) {
+        for (int v = 0; v < 256; v++) counts[p][v] += sub[0][p][v] + sub[1][p][v] + sub[2][p][v] + sub[3][p][v];
+    }
+}
+
+inline Histogram histogram(const BMPConstImage& in, HistogramKind kind) {
+    Histogram h;
+    h.planes = (kind == kHistogramLuma) ? 1 : 3;
+    h.total = uint64_t(in.width) * in.height;
+
+    ThreadPool& pool = ThreadPool::shared();
+    int rows = tileRows(in.height, in.rowBytes(), 0, pool.size());
+    int bands = (in.height + rows - 1) / rows;
+    std::vector<uint32_t> band_counts(size_t(bands) * 3 * 256, 0);
+    pool.parallelFor(bands, [&](int b) {
+        uint32_t (*counts)[256] = reinterpret_cast<uint32_t (*)[256]>(&band_counts[size_t(b) * 3 * 256]);
+        histogramCount(in, b * rows, std::min(in.height, (b + 1) * rows), 0, in.width, kind, counts);
+    });
+
+    // Merge: slice s sums bins [64 s, 64 s + 64) of every plane over all bands
+    const int kSlice = 64;
+    pool.parallelFor(h.planes * 256 / kSlice, [&](int s) {
+        int p = s / (256 / kSlice), v0 = (s % (256 / kSlice)) * kSlice;
+        for (int b = 0; b < bands; b++) {
+            const uint32_t* counts = &band_counts[(size_t(b) * 3 + p) * 256];
+            for (int v = v0; v < v0 + kSlice; v++) h.bins[p][v] += counts[v];
+        }
+    });
+    return h;
+}
+
+// Histogram equalisation: v goes to its rank among the pixels, spread over
+// 0..255, with the lowest occupied value going to 0
+inline void equalizeTable(const uint64_t* bins, uint64_t total, unsigned char* table) {
+    uint64_t cdf = 0, cdf_min = 0;
+    for (int v = 0; v < 256 && cdf_min == 0; v++) cdf_min = bins[v];
+    uint64_t range = total - cdf_min;
+    for (int v = 0; v < 256; v++) {
+        cdf += bins[v];
+        if (range == 0) {
+            table[v] = static_cast<unsigned char>(v); // a single value: leave it
+        } else {
+            uint64_t above = (cdf > cdf_min) ? cdf - cdf_min : 0;
+            table[v] = static_cast<unsigned char>((above * 255 + range / 2) / range);
+        }
+    }
+}
+
+// Contrast stretch: the values below the clip fraction of pixels at either
+// end go to 0 and 255 and the rest are spread linearly between them
+inline void stretchTable(const uint64_t* bins, uint64_t total, double clip, unsigned char* table) {
+    uint64_t cut = uint64_t(std::floor(clip * double(total)));
+    int lo = 0, hi = 255;
+    uint64_t below = 0;
+    while (lo < 255 && below + bins[lo] <= cut) below += bins[lo++];
+    uint64_t above = 0;
+    while (hi > 0 && above + bins[hi] <= cut) above += bins[hi--];
+    for (int v = 0; v < 256; v++) {
+        if (hi <= lo) {
+            table[v] = static_cast<unsigned char>(v);
+        } else {
+            int t = (255 * (v - lo) + (hi - lo) / 2) / (hi - lo);
+            table[v] = static_cast<unsigned char>(std::max(0, std::min(255, t)));
+        }
+    }
+}
+
+#endif // DIP_COMMON_HISTOGRAM_H
@@ -0,0 +1,348 @@
+#ifndef DIP_COMMON_HSV_H
+#define DIP_COMMON_HSV_H
+
+// Batch RGB <-> HSV in 16-bit fixed point.
+//
+// Whole rows of interleaved BGR(A) pixels are converted to planar H, S, V
+// arrays and back, 8 (SSE2) or 16 (AVX2) pixels at a time. The hue sector is
+// selected with compare masks instead of a switch, so every lane runs the
+// same instructions. The divisions of the forward transform are done in
+// single-precision floats; everything else is 16-bit integer arithmetic.
+// All variants give bit-identical results.
+//
+// Formats:
+//   h: hue / 60 degrees in Q13, [0, 6 * kHsvSector)
+//   s: saturation, 0..65535 for 0..1
+//   v: value, byte * 257, so 0..65535 for 0..1
+//
+// Measured against the double-precision rgbToHsv/hsvToRgb over all 2^24
+// colours: |h| within 0.004 degrees, s within 0.5/65535, v exact; the
+// round trip RGB -> HSV -> RGB is exact; after scaling s and v (e.g. by 1.3
+// and 1.4) the RGB result is within 1 level of the double version, which
+// truncates where this rounds.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "dispatch.h"
+
+static const int kHsvSector = 8192;             // one 60 degree hue sector
+static const int kHsvHueEnd = 6 * kHsvSector;   // 360 degrees
+static const int kHsvOne = 65535;               // s or v = 1
+
+/* Forward: RGB -> HSV */
+
+inline void rgbToHsvPixel(int r, int g, int b, uint16_t& h, uint16_t& s, uint16_t& v) {
+    int mx = std::max(std::max(r, g), b);
+    int mn = std::min(std::min(r, g), b);
+    int delta = mx - mn;
+    v = static_cast<uint16_t>(mx * 257);
+    s = static_cast<uint16_t>(lrintf(float(delta) * 65535.0f / float(std::max(mx, 1))));
+    int num, base;
+    if (mx == r) {
+        num = g - b;
+        base = 0;
+    } else if (mx == g) {
+        num = b - r;
+        base = 2 * kHsvSector;
+    } else {
+        num = r - g;
+        base = 4 * kHsvSector;
+    }
+    long hq = lrintf(float(base) + (float(num) * float(kHsvSector)) / float(std::max(delta, 1)));
+    if (hq < 0) hq += kHsvHueEnd;
+    h = static_cast<uint16_t>(hq);
+}
+
+typedef void (*RgbToHsvRowFn)(const unsigned char*, int, int, uint16_t*, uint16_t*, uint16_t*);
+
+inline void rgbToHsvRowScalar(const unsigned char* pixels, int num_channel, int n, uint16_t* h, uint16_t* s, uint16_t* v) {
+    for (int x = 0; x < n; x++) {
+        const unsigned char* p = pixels + x * num_channel;
+        rgbToHsvPixel(p[2], p[1], p[0], h[x], s[x], v[x]);
+    }
+}
+
+#if DIP_X86_DISPATCH
+// Values 0..65535 in int32 lanes to uint16 lanes (SSE2 has no unsigned pack)
+__attribute__((target("sse2")))
+inline __m128i hsvPackU16(__m128i lo, __m128i hi) {
+    const __m128i bias32 = _mm_set1_epi32(32768);
+    const __m128i bias16 = _mm_set1_epi16(short(0x8000));
+    return _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(lo, bias32), _mm_sub_epi32(hi, bias32)), bias16);
+}
+
+// Eight pixels from planar 16-bit r, g, b
+__attribute__((target("sse2")))
+inline void rgbToHsv8Sse2(__m128i r, __m128i g, __m128i b, uint16_t* h, uint16_t* s, uint16_t* v) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i mx = _mm_max_epi16(_mm_max_epi16(r, g), b);
+    __m128i mn = _mm_min_epi16(_mm_min_epi16(r, g), b);
+    __m128i delta = _mm_sub_epi16(mx, mn);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(v), _mm_mullo_epi16(mx, _mm_set1_epi16(257)));
+
+    // Sector: max == r, else max == g, else b
+    __m128i is_r = _mm_cmpeq_epi16(mx, r);
+    __m128i is_g = _mm_andnot_si128(is_r, _mm_cmpeq_epi16(mx, g));
+    __m128i is_b = _mm_andnot_si128(_mm_or_si128(is_r, is_g), _mm_cmpeq_epi16(zero, zero));
+    __m128i num = _mm_or_si128(_mm_and_si128(is_r, _mm_sub_epi16(g, b)),
+                  _mm_or_si128(_mm_and_si128(is_g, _mm_sub_epi16(b, r)), _mm_and_si128(is_b, _mm_sub_epi16(r, g))));
+    __m128i base = _mm_or_si128(_mm_and_si128(is_g, _mm_set1_epi16(2 * kHsvSector)), _mm_and_si128(is_b, _mm_set1_epi16(short(4 * kHsvSector))));
+    __m128i safe_mx = _mm_max_epi16(mx, one);
+    __m128i safe_delta = _mm_max_epi16(delta, one);
+
+    __m128i s32[2], h32[2];
+    for (int half = 0; half < 2; half++) {
+        // Sign-extend num; the others are non-negative
+        __m128i num32 = half ? _mm_srai_epi32(_mm_unpackhi_epi16(num, num), 16) : _mm_srai_epi32(_mm_unpacklo_epi16(num, num), 16);
+        __m128 fdelta = _mm_cvtepi32_ps(half ? _mm_unpackhi_epi16(delta, zero) : _mm_unpacklo_epi16(delta, zero));
+        __m128 fmx = _mm_cvtepi32_ps(half ? _mm_unpackhi_epi16(safe_mx, zero) : _mm_unpacklo_epi16(safe_mx, zero));
+        __m128 fsd = _mm_cvtepi32_ps(half ? _mm_unpackhi_epi16(safe_delta, zero) : _mm_unpacklo_epi16(safe_delta, zero));
+        __m128 fbase = _mm_cvtepi32_ps(half ? _mm_unpackhi_epi16(base, zero) : _mm_unpacklo_epi16(base, zero));
+        s32[half] = _mm_cvtps_epi32(_mm_div_ps(_mm_mul_ps(fdelta, _mm_set1_ps(65535.0f)), fmx));
+        __m128i hq = _mm_cvtps_epi32(_mm_add_ps(fbase, _mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(num32), _mm_set1_ps(float(kHsvSector))), fsd)));
+        h32[half] = _mm_add_epi32(hq, _mm_and_si128(_mm_cmplt_epi32(hq, _mm_setzero_si128()), _mm_set1_epi32(kHsvHueEnd)));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(s), hsvPackU16(s32[0], s32[1]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(h), hsvPackU16(h32[0], h32[1]));
+}
+
+__attribute__((target("sse2")))
+inline void rgbToHsvRowSse2(const unsigned char* pixels, int num_channel, int n, uint16_t* h, uint16_t* s, uint16_t* v) {
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        uint16_t r[8], g[8], b[8];
+        const unsigned char* p = pixels + x * num_channel;
+        for (int k = 0; k < 8; k++) {
+            b[k] = p[k * num_channel];
+            g[k] = p[k * num_channel + 1];
+            r[k] = p[k * num_channel + 2];
+        }
+        rgbToHsv8Sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(g)),
+                      _mm_loadu_si128(reinterpret_cast<const __m128i*>(b)), h + x, s + x, v + x);
+    }
+    rgbToHsvRowScalar(pixels + x * num_channel, num_channel, n - x, h + x, s + x, v + x);
+}
+
+// Sixteen pixels; the 16 <-> 32-bit unpacks and packs stay within 128-bit
+// lanes, so the pixel order is preserved.
+__attribute__((target("avx2")))
+inline void rgbToHsv16Avx2(__m256i r, __m256i g, __m256i b, uint16_t* h, uint16_t* s, uint16_t* v) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(1);
+    __m256i mx = _mm256_max_epi16(_mm256_max_epi16(r, g), b);
+    __m256i mn = _mm256_min_epi16(_mm256_min_epi16(r, g), b);
+    __m256i delta = _mm256_sub_epi16(mx, mn);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(v), _mm256_mullo_epi16(mx, _mm256_set1_epi16(257)));
+
+    __m256i is_r = _mm256_cmpeq_epi16(mx, r);
+    __m256i is_g = _mm256_andnot_si256(is_r, _mm256_cmpeq_epi16(mx, g));
+    __m256i is_b = _mm256_andnot_si256(_mm256_or_si256(is_r, is_g), _mm256_cmpeq_epi16(zero, zero));
+    __m256i num = _mm256_or_si256(_mm256_and_si256(is_r, _mm256_sub_epi16(g, b)),
+                  _mm256_or_si256(_mm256_and_si256(is_g, _mm256_sub_epi16(b, r)), _mm256_and_si256(is_b, _mm256_sub_epi16(r, g))));
+    __m256i base = _mm256_or_si256(_mm256_and_si256(is_g, _mm256_set1_epi16(2 * kHsvSector)), _mm256_and_si256(is_b, _mm256_set1_epi16(short(4 * kHsvSector))));
+    __m256i safe_mx = _mm256_max_epi16(mx, one);
+    __m256i safe_delta = _mm256_max_epi16(delta, one);
+
+    __m256i s32[2], h32[2];
+    for (int half = 0; half < 2; half++) {
+        __m256i num32 = half ? _mm256_srai_epi32(_mm256_unpackhi_epi16(num, num), 16) : _mm256_srai_epi32(_mm256_unpacklo_epi16(num, num), 16);
+        __m256 fdelta = _mm256_cvtepi32_ps(half ? _mm256_unpackhi_epi16(delta, zero) : _mm256_unpacklo_epi16(delta, zero));
+        __m256 fmx = _mm256_cvtepi32_ps(half ? _mm256_unpackhi_epi16(safe_mx, zero) : _mm256_unpacklo_epi16(safe_mx, zero));
+        __m256 fsd = _mm256_cvtepi32_ps(half ? _mm256_unpackhi_epi16(safe_delta, zero) : _mm256_unpacklo_epi16(safe_delta, zero));
+        __m256 fbase = _mm256_cvtepi32_ps(half ? _mm256_unpackhi_epi16(base, zero) : _mm256_unpacklo_epi16(base, zero));
+        s32[half] = _mm256_cvtps_epi32(_mm256_div_ps(_mm256_mul_ps(fdelta, _mm256_set1_ps(65535.0f)), fmx));
+        __m256i hq = _mm256_cvtps_epi32(_mm256_add_ps(fbase, _mm256_div_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(num32), _mm256_set1_ps(float(kHsvSector))), fsd)));
+        h32[half] = _mm256_add_epi32(hq, _mm256_and_si256(_mm256_cmpgt_epi32(zero, hq), _mm256_set1_epi32(kHsvHueEnd)));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(s), _mm256_packus_epi32(s32[0], s32[1]));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(h), _mm256_packus_epi32(h32[0], h32[1]));
+}
+
+__attribute__((target("avx2")))
+inline void rgbToHsvRowAvx2(const unsigned char* pixels, int num_channel, int n, uint16_t* h, uint16_t* s, uint16_t* v) {
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        uint16_t r[16], g[16], b[16];
+        const unsigned char* p = pixels + x * num_channel;
+        for (int k = 0; k < 16; k++) {
+            b[k] = p[k * num_channel];
+            g[k] = p[k * num_channel + 1];
+            r[k] = p[k * num_channel + 2];
+        }
+        rgbToHsv16Avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(r)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(g)),
+                       _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b)), h + x, s + x, v + x);
+    }
+    rgbToHsvRowScalar(pixels + x * num_channel, num_channel, n - x, h + x, s + x, v + x);
+}
+#endif
+
+// Convert n interleaved pixels (channel bytes B, G, R[, A]) to planar H, S, V
+inline void rgbToHsvRow(const unsigned char* pixels, int num_channel, int n, uint16_t* h, uint16_t* s, uint16_t* v) {
+#if DIP_X86_DISPATCH
+    static const RgbToHsvRowFn variants[kCpuLevelCount] = {rgbToHsvRowScalar, rgbToHsvRowSse2, rgbToHsvRowAvx2, nullptr, nullptr};
+#else
+    static const RgbToHsvRowFn variants[kCpuLevelCount] = {rgbToHsvRowScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const RgbToHsvRowFn fn = pickKernel(variants);
+    fn(pixels, num_channel, n, h, s, v);
+}
+
+/* Inverse: HSV -> RGB */
+
+// 0..65535 back to a byte, rounded: x / 257
+inline int hsvToByte(int x) {
+    return (x - (x >> 8) + 128) >> 8;
+}
+
+// (a * b) >> 16 for 16-bit a, b
+inline uint32_t hsvMulHi(uint32_t a, uint32_t b) {
+    return (a * b) >> 16;
+}
+
+inline void hsvToRgbPixel(uint32_t h, uint32_t s, uint32_t v, unsigned char& r, unsigned char& g, unsigned char& b) {
+    uint32_t sector = h >> 13;
+    uint32_t f = (h << 3) & 0xFFFF;     // position within the sector, Q16
+    int p = int(v - hsvMulHi(v, s));
+    int q = int(v - hsvMulHi(v, hsvMulHi(s, f)));
+    int t = int(v - hsvMulHi(v, hsvMulHi(s, kHsvOne - f)));
+    int vv = int(v);
+    // Sector table: (r, g, b) = (v,t,p) (q,v,p) (p,v,t) (p,q,v) (t,p,v) (v,p,q)
+    int rr = (sector == 0 || sector == 5) ? vv : (sector == 1) ? q : (sector == 4) ? t : p;
+    int gg = (sector == 1 || sector == 2) ? vv : (sector == 0) ? t : (sector == 3) ? q : p;
+    int bb = (sector == 3 || sector == 4) ? vv : (sector == 2) ? t : (sector == 5) ? q : p;
+    r = static_cast<unsigned char>(hsvToByte(rr));
+    g = static_cast<unsigned char>(hsvToByte(gg));
+    b = static_cast<unsigned char>(hsvToByte(bb));
+}
+
+typedef void (*HsvToRgbRowFn)(const uint16_t*, const uint16_t*, const uint16_t*, int, unsigned char*, int);
+
+inline void hsvToRgbRowScalar(const uint16_t* h, const uint16_t* s, const uint16_t* v, int n, unsigned char* pixels, int num_channel) {
+    for (int x = 0; x < n; x++) {
+        unsigned char* p = pixels + x * num_channel;
+        hsvToRgbPixel(h[x], s[x], v[x], p[2], p[1], p[0]);
+    }
+}
+
+#if DIP_X86_DISPATCH
+__attribute__((target("sse2")))
+inline __m128i hsvToByteSse2(__m128i x) {
+    return _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(x, _mm_srli_epi16(x, 8)), _mm_set1_epi16(128)), 8);
+}
+
+// Eight pixels to planar 8-bit r, g, b (in the low half of each register)
+__attribute__((target("sse2")))
+inline void hsvToRgb8Sse2(__m128i h, __m128i s, __m128i v, __m128i& r, __m128i& g, __m128i& b) {
+    __m128i sector = _mm_srli_epi16(h, 13);
+    __m128i f = _mm_slli_epi16(h, 3);
+    __m128i p = _mm_sub_epi16(v, _mm_mulhi_epu16(v, s));
+    __m128i q = _mm_sub_epi16(v, _mm_mulhi_epu16(v, _mm_mulhi_epu16(s, f)));
+    __m128i t = _mm_sub_epi16(v, _mm_mulhi_epu16(v, _mm_mulhi_epu16(s, _mm_sub_epi16(_mm_set1_epi16(-1), f))));
+    __m128i m[6];
+    for (int k = 0; k < 6; k++) m[k] = _mm_cmpeq_epi16(sector, _mm_set1_epi16(short(k)));
+    __m128i rr = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_or_si128(m[0], m[5]), v), _mm_and_si128(m[1], q)),
+                 _mm_or_si128(_mm_and_si128(_mm_or_si128(m[2], m[3]), p), _mm_and_si128(m[4], t)));
+    __m128i gg = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_or_si128(m[1], m[2]), v), _mm_and_si128(m[0], t)),
+                 _mm_or_si128(_mm_and_si128(m[3], q), _mm_and_si128(_mm_or_si128(m[4], m[5]), p)));
+    __m128i bb = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_or_si128(m[3], m[4]), v), _mm_and_si128(m[2], t)),
+                 _mm_or_si128(_mm_and_si128(m[5], q), _mm_and_si128(_mm_or_si128(m[0], m[1]), p)));
+    r = hsvToByteSse2(rr);
+    g = hsvToByteSse2(gg);
+    b = hsvToByteSse2(bb);
+}
+
+__attribute__((target("sse2")))
+inline void hsvToRgbRowSse2(const uint16_t* h, const uint16_t* s, const uint16_t* v, int n, unsigned char* pixels, int num_channel) {
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m128i r, g, b;
+        hsvToRgb8Sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(h + x)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + x)),
+                      _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + x)), r, g, b);
+        uint16_t rb[8], gb[8], bb[8];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rb), r);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(gb), g);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(bb), b);
+        unsigned char* p = pixels + x * num_channel;
+        for (int k = 0; k < 8; k++) {
+            p[k * num_channel] = static_cast<unsigned char>(bb[k]);
+            p[k * num_channel + 1] = static_cast<unsigned char>(gb[k]);
+            p[k * num_channel + 2] = static_cast<unsigned char>(rb[k]);
+        }
+    }
+    hsvToRgbRowScalar(h + x, s + x, v + x, n - x, pixels + x * num_channel, num_channel);
+}
+
+__attribute__((target("avx2")))
+inline __m256i hsvToByteAvx2(__m256i x) {
+    return _mm256_srli_epi16(_mm256_add_epi16(_mm256_sub_epi16(x, _mm256_srli_epi16(x, 8)), _mm256_set1_epi16(128)), 8);
+}
+
+__attribute__((target("avx2")))
+inline void hsvToRgb16Avx2(__m256i h, __m256i s, __m256i v, __m256i& r, __m256i& g, __m256i& b) {
+    __m256i sector = _mm256_srli_epi16(h, 13);
+    __m256i f = _mm256_slli_epi16(h, 3);
+    __m256i p = _mm256_sub_epi16(v, _mm256_mulhi_epu16(v, s));
+    __m256i q = _mm256_sub_epi16(v, _mm256_mulhi_epu16(v, _mm256_mulhi_epu16(s, f)));
+    __m256i t = _mm256_sub_epi16(v, _mm256_mulhi_epu16(v, _mm256_mulhi_epu16(s, _mm256_sub_epi16(_mm256_set1_epi16(-1), f))));
+    __m256i m[6];
+    for (int k = 0; k < 6; k++) m[k] = _mm256_cmpeq_epi16(sector, _mm256_set1_epi16(short(k)));
+    __m256i rr = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_or_si256(m[0], m[5]), v), _mm256_and_si256(m[1], q)),
+                 _mm256_or_si256(_mm256_and_si256(_mm256_or_si256(m[2], m[3]), p), _mm256_and_si256(m[4], t)));
+    __m256i gg = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_or_si256(m[1], m[2]), v), _mm256_and_si256(m[0], t)),
+                 _mm256_or_si256(_mm256_and_si256(m[3], q), _mm256_and_si256(_mm256_or_si256(m[4], m[5]), p)));
+    __m256i bb = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_or_si256(m[3], m[4]), v), _mm256_and_si256(m[2], t)),
+                 _mm256_or_si256(_mm256_and_si256(m[5], q), _mm256_and_si256(_mm256_or_si256(m[0], m[1]), p)));
+    r = hsvToByteAvx2(rr);
+    g = hsvToByteAvx2(gg);
+    b = hsvToByteAvx2(bb);
+}
+
+__attribute__((target("avx2")))
+inline void hsvToRgbRowAvx2(const uint16_t* h, const uint16_t* s, const uint16_t* v, int n, unsigned char* pixels, int num_channel) {
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m256i r, g, b;
+        hsvToRgb16Avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + x)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + x)),
+                       _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + x)), r, g, b);
+        uint16_t rb[16], gb[16], bb[16];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(rb), r);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(gb), g);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(bb), b);
+        unsigned char* p = pixels + x * num_channel;
+        for (int k = 0; k < 16; k++) {
+            p[k * num_channel] = static_cast<unsigned char>(bb[k]);
+            p[k * num_channel + 1] = static_cast<unsigned char>(gb[k]);
+            p[k * num_channel + 2] = static_cast<unsigned char>(rb[k]);
+        }
+    }
+    hsvToRgbRowScalar(h + x, s + x, v + x, n - x, pixels + x * num_channel, num_channel);
+}
+#endif
+
+// Convert planar H, S, V back to n interleaved pixels; only the B, G, R
+// bytes of each pixel are written. h must be below kHsvHueEnd.
+inline void hsvToRgbRow(const uint16_t* h, const uint16_t* s, const uint16_t* v, int n, unsigned char* pixels, int num_channel) {
+#if DIP_X86_DISPATCH
+    static const HsvToRgbRowFn variants[kCpuLevelCount] = {hsvToRgbRowScalar, hsvToRgbRowSse2, hsvToRgbRowAvx2, nullptr, nullptr};
+#else
+    static const HsvToRgbRowFn variants[kCpuLevelCount] = {hsvToRgbRowScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const HsvToRgbRowFn fn = pickKernel(variants);
+    fn(h, s, v, n, pixels, num_channel);
+}
+
+// Multiply n saturation or value entries by factor, clipped to kHsvOne
+inline void hsvScale(uint16_t* x, int n, double factor) {
+    // Q12 factor; anything above 16 saturates every nonzero entry anyway
+    uint32_t f = static_cast<uint32_t>(std::lround(std::max(0.0, std::min(16.0, factor)) * 4096.0));
+    for (int i = 0; i < n; i++) {
+        uint32_t scaled = (x[i] * f + 2048) >> 12;
+        x[i] = static_cast<uint16_t>(scaled > uint32_t(kHsvOne) ? uint32_t(kHsvOne) : scaled);
+    }
+}
+
+#endif // DIP_COMMON_HSV_H
@@ -0,0 +1,161 @@
+#ifndef DIP_COMMON_PLANES_H
+#define DIP_COMMON_PLANES_H
+
+// Interleaved BGR(A) bytes <-> planar floats, for operators that work on one
+// channel at a time in floating point (e.g. the FFT deblurring of hw4).
+//
+// splitPlanes() turns a row of pixels into three float rows (B, G, R) and
+// mergePlanes() turns three float rows back into pixels, mapping each value
+// to a byte on the way: round and saturate, then stretch by a per-channel
+// scale and shift (a min-max normalisation) and round and saturate again.
+// Rounding is to nearest, ties to even, as lrintf and cvtps2dq do, so every
+// variant gives the same bytes. The planes carry no alpha: merging leaves
+// the alpha bytes of dst as they are, so a caller keeps the source alpha by
+// copying the source row into dst first.
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "dispatch.h"
+
+/* Split: planes[c][x] = byte c of pixel x */
+
+typedef void (*SplitPlanesFn)(const unsigned char*, int, int, float* const*);
+
+inline void splitPlanesScalar(const unsigned char* src, int num_channel, int n, float* const* planes) {
+    float* b = planes[0];
+    float* g = planes[1];
+    float* r = planes[2];
+    for (int x = 0; x < n; x++, src += num_channel) {
+        b[x] = src[0];
+        g[x] = src[1];
+        r[x] = src[2];
+    }
+}
+
+/* Merge: byte c of pixel x from planes[c][x] */
+
+typedef void (*MergePlanesFn)(const float* const*, const float*, const float*, int, unsigned char*, int);
+
+// Round to a byte, saturating; the clamp first keeps lrintf in range
+inline int planeToByte(float v) {
+    return std::max(0, std::min(255, int(lrintf(std::max(-1.0f, std::min(256.0f, v))))));
+}
+
+inline void mergePlanesScalar(const float* const* planes, const float* scale, const float* shift, int n, unsigned char* dst, int num_channel) {
+    for (int x = 0; x < n; x++, dst += num_channel) {
+        for (int c = 0; c < 3; c++) {
+            dst[c] = static_cast<unsigned char>(planeToByte(float(planeToByte(planes[c][x])) * scale[c] + shift[c]));
+        }
+    }
+}
+
+#if DIP_X86_DISPATCH
+// Eight pixels at a time. With 3 channels the 24 bytes are picked apart with
+// byte shuffles of a 16- and an 8-byte load; with 4 each pixel is one dword
+// and a channel is a shift and mask away.
+__attribute__((target("avx2")))
+inline void splitPlanesAvx2(const unsigned char* src, int num_channel, int n, float* const* planes) {
+    int x = 0;
+    if (num_channel == 3) {
+        __m128i lo_masks[3], hi_masks[3];
+        for (int c = 0; c < 3; c++) {
+            alignas(16) unsigned char lo[16], hi[16];
+            std::memset(lo, 0x80, sizeof(lo));
+            std::memset(hi, 0x80, sizeof(hi));
+            for (int k = 0; k < 8; k++) {
+                int byte = 3 * k + c;
+                if (byte < 16) lo[k] = static_cast<unsigned char>(byte);
+                else hi[k] = static_cast<unsigned char>(byte - 16);
+            }
+            lo_masks[c] = _mm_load_si128(reinterpret_cast<const __m128i*>(lo));
+            hi_masks[c] = _mm_load_si128(reinterpret_cast<const __m128i*>(hi));
+        }
+        for (; x + 8 <= n; x += 8) {
+            const unsigned char* p = src + 3 * x;
+            __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i hi = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + 16));
+            for (int c = 0; c < 3; c++) {
+                __m128i bytes = _mm_or_si128(_mm_shuffle_epi8(lo, lo_masks[c]), _mm_shuffle_epi8(hi, hi_masks[c]));
+                _mm256_storeu_ps(planes[c] + x, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)));
+            }
+        }
+    } else {
+        const __m256i byte = _mm256_set1_epi32(0xFF);
+        for (; x + 8 <= n; x += 8) {
+            __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * x));
+            _mm256_storeu_ps(planes[0] + x, _mm256_cvtepi32_ps(_mm256_and_si256(px, byte)));
+            _mm256_storeu_ps(planes[1] + x, _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 8), byte)));
+            _mm256_storeu_ps(planes[2] + x, _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 16), byte)));
+        }
+    }
+    float* rest[3] = {planes[0] + x, planes[1] + x, planes[2] + x};
+    splitPlanesScalar(src + size_t(x) * num_channel, num_channel, n - x, rest);
+}
+
+__attribute__((target("avx2")))
+inline __m256i planeToByteAvx2(__m256 v) {
+    v = _mm256_max_ps(_mm256_set1_ps(-1.0f), _mm256_min_ps(_mm256_set1_ps(256.0f), v));
+    __m256i q = _mm256_cvtps_epi32(v);
+    return _mm256_max_epi32(_mm256_setzero_si256(), _mm256_min_epi32(_mm256_set1_epi32(255), q));
+}
+
+// The three channels are combined into one dword per pixel; with 3 channels
+// each 128-bit lane is then squeezed to 12 bytes and stored 16 bytes wide,
+// the 4 spare bytes being overwritten by the next store.
+__attribute__((target("avx2")))
+inline void mergePlanesAvx2(const float* const* planes, const float* scale, const float* shift, int n, unsigned char* dst, int num_channel) {
+    __m256 scales[3], shifts[3];
+    for (int c = 0; c < 3; c++) {
+        scales[c] = _mm256_set1_ps(scale[c]);
+        shifts[c] = _mm256_set1_ps(shift[c]);
+    }
+    const __m256i squeeze = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                             0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i alpha = _mm256_set1_epi32(int(0xFF000000u));
+    // 3 channels: the last 16-byte store ends 4 bytes past the 8 pixels
+    int end = (num_channel == 3) ? n - 9 : n - 7;
+    int x = 0;
+    for (; x < end; x += 8) {
+        __m256i px = _mm256_setzero_si256();
+        for (int c = 0; c < 3; c++) {
+            __m256 q = _mm256_cvtepi32_ps(planeToByteAvx2(_mm256_loadu_ps(planes[c] + x)));
+            __m256i v = planeToByteAvx2(_mm256_add_ps(_mm256_mul_ps(q, scales[c]), shifts[c]));
+            px = _mm256_or_si256(px, _mm256_slli_epi32(v, 8 * c));
+        }
+        if (num_channel == 4) {
+            __m256i* out = reinterpret_cast<__m256i*>(dst + 4 * size_t(x));
+            _mm256_storeu_si256(out, _mm256_or_si256(px, _mm256_and_si256(_mm256_loadu_si256(out), alpha)));
+        } else {
+            __m256i packed = _mm256_shuffle_epi8(px, squeeze);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * size_t(x)), _mm256_castsi256_si128(packed));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * size_t(x) + 12), _mm256_extracti128_si256(packed, 1));
+        }
+    }
+    const float* rest[3] = {planes[0] + x, planes[1] + x, planes[2] + x};
+    mergePlanesScalar(rest, scale, shift, n - x, dst + size_t(x) * num_channel, num_channel);
+}
+#endif
+
+inline void splitPlanes(const unsigned char* src, int num_channel, int n, float* const* planes) {
+#if DIP_X86_DISPATCH
+    static const SplitPlanesFn variants[kCpuLevelCount] = {splitPlanesScalar, nullptr, splitPlanesAvx2, nullptr, nullptr};
+#else
+    static const SplitPlanesFn variants[kCpuLevelCount] = {splitPlanesScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const SplitPlanesFn fn = pickKernel(variants);
+    fn(src, num_channel, n, planes);
+}
+
+inline void mergePlanes(const float* const* planes, const float* scale, const float* shift, int n, unsigned char* dst, int num_channel) {
+#if DIP_X86_DISPATCH
+    static const MergePlanesFn variants[kCpuLevelCount] = {mergePlanesScalar, nullptr, mergePlanesAvx2, nullptr, nullptr};
+#else
+    static const MergePlanesFn variants[kCpuLevelCount] = {mergePlanesScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const MergePlanesFn fn = pickKernel(variants);
+    fn(planes, scale, shift, n, dst, num_channel);
+}
+
+#endif // DIP_COMMON_PLANES_H
@@ -0,0 +1,256 @@
+#ifndef DIP_COMMON_POINT_OPS_H
+#define DIP_COMMON_POINT_OPS_H
+
+// Per-byte point operators with scalar, SSE2, AVX2 and AVX-512 variants.
+//
+// Each operator maps a span of n bytes src -> dst (src == dst is allowed)
+// and is dispatched through dispatch.h, so the same binary runs the widest
+// variant the machine supports. Every variant produces identical output.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "dispatch.h"
+
+/* Saturating add: dst = min(255, src + value) */
+
+typedef void (*AddSaturateFn)(const unsigned char*, unsigned char*, size_t, unsigned char);
+
+inline void addSaturateScalar(const unsigned char* src, unsigned char* dst, size_t n, unsigned char value) {
+    for (size_t i = 0; i < n; i++) dst[i] = static_cast<unsigned char>(std::min(255, src[i] + value));
+}
+
+#if DIP_X86_DISPATCH
+__attribute__((target("sse2")))
+inline void addSaturateSse2(const unsigned char* src, unsigned char* dst, size_t n, unsigned char value) {
+    __m128i v = _mm_set1_epi8(char(value));
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_adds_epu8(x, v));
+    }
+    addSaturateScalar(src + i, dst + i, n - i, value);
+}
+
+__attribute__((target("avx2")))
+inline void addSaturateAvx2(const unsigned char* src, unsigned char* dst, size_t n, unsigned char value) {
+    __m256i v = _mm256_set1_epi8(char(value));
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_adds_epu8(x, v));
+    }
+    addSaturateScalar(src + i, dst + i, n - i, value);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline void addSaturateAvx512(const unsigned char* src, unsigned char* dst, size_t n, unsigned char value) {
+    __m512i v = _mm512_set1_epi8(char(value));
+    for (size_t i = 0; i < n; i += 64) {
+        // The tail goes through a masked load/store
+        __mmask64 m = (n - i >= 64) ? ~__mmask64(0) : ((__mmask64(1) << (n - i)) - 1);
+        __m512i x = _mm512_maskz_loadu_epi8(m, src + i);
+        _mm512_mask_storeu_epi8(dst + i, m, _mm512_adds_epu8(x, v));
+    }
+}
+#endif
+
+inline void addSaturate(const unsigned char* src, unsigned char* dst, size_t n, unsigned char value) {
+#if DIP_X86_DISPATCH
+    static const AddSaturateFn variants[kCpuLevelCount] = {addSaturateScalar, addSaturateSse2, addSaturateAvx2, addSaturateAvx512, nullptr};
+#else
+    static const AddSaturateFn variants[kCpuLevelCount] = {addSaturateScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const AddSaturateFn fn = pickKernel(variants);
+    fn(src, dst, n, value);
+}
+
+/* Bit mask: dst = src & mask, e.g. 0xFF << k to drop the k low bits */
+
+typedef void (*MaskBitsFn)(const unsigned char*, unsigned char*, size_t, unsigned char);
+
+inline void maskBitsScalar(const unsigned char* src, unsigned char* dst, size_t n, unsigned char mask) {
+    for (size_t i = 0; i < n; i++) dst[i] = src[i] & mask;
+}
+
+#if DIP_X86_DISPATCH
+__attribute__((target("sse2")))
+inline void maskBitsSse2(const unsigned char* src, unsigned char* dst, size_t n, unsigned char mask) {
+    __m128i v = _mm_set1_epi8(char(mask));
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_and_si128(x, v));
+    }
+    maskBitsScalar(src + i, dst + i, n - i, mask);
+}
+
+__attribute__((target("avx2")))
+inline void maskBitsAvx2(const unsigned char* src, unsigned char* dst, size_t n, unsigned char mask) {
+    __m256i v = _mm256_set1_epi8(char(mask));
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_and_si256(x, v));
+    }
+    maskBitsScalar(src + i, dst + i, n - i, mask);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline void maskBitsAvx512(const unsigned char* src, unsigned char* dst, size_t n, unsigned char mask) {
+    __m512i v = _mm512_set1_epi8(char(mask));
+    for (size_t i = 0; i < n; i += 64) {
+        __mmask64 m = (n - i >= 64) ? ~__mmask64(0) : ((__mmask64(1) << (n - i)) - 1);
+        __m512i x = _mm512_maskz_loadu_epi8(m, src + i);
+        _mm512_mask_storeu_epi8(dst + i, m, _mm512_and_si512(x, v));
+    }
+}
+#endif
+
+inline void maskBits(const unsigned char* src, unsigned char* dst, size_t n, unsigned char mask) {
+#if DIP_X86_DISPATCH
+    static const MaskBitsFn variants[kCpuLevelCount] = {maskBitsScalar, maskBitsSse2, maskBitsAvx2, maskBitsAvx512, nullptr};
+#else
+    static const MaskBitsFn variants[kCpuLevelCount] = {maskBitsScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const MaskBitsFn fn = pickKernel(variants);
+    fn(src, dst, n, mask);
+}
+
+/* Contrast about mid-grey: dst = clamp(floor(factor * (src - 128)) + 128) */
+
+// factor as a 16-bit fixed-point coefficient: floor(factor * d) is computed
+// as (coeff * d + bias) >> shift, one 16x16 -> 32-bit multiply-add per byte.
+struct ContrastFixed {
+    int coeff;
+    int bias;
+    int shift;
+};
+
+inline unsigned char contrastReference(unsigned char v, double factor) {
+    double adjusted = factor * (static_cast<double>(v) - 128.0) + 128.0;
+    return static_cast<unsigned char>(std::max(0.0, std::min(255.0, adjusted)));
+}
+
+inline unsigned char contrastFixedByte(unsigned char v, const ContrastFixed& f) {
+    int r = ((f.coeff * (int(v) - 128) + f.bias) >> f.shift) + 128;
+    return static_cast<unsigned char>(r < 0 ? 0 : (r > 255 ? 255 : r));
+}
+
+// Pick the coefficient and bias closest to factor that reproduce the
+// double-precision formula on all 256 inputs (products that land on an
+// integer need a small bias to floor the same way on both sides of 128).
+// Factors too large for 16 bits are clamped.
+inline ContrastFixed contrastFixed(double factor) {
+    ContrastFixed f;
+    f.shift = 14;
+    while (f.shift > 0 && std::fabs(factor) * (1 << f.shift) >= 32767.0) f.shift--;
+    int nearest = int(std::lround(factor * (1 << f.shift)));
+    nearest = std::max(-32767, std::min(32767, nearest));
+    f.coeff = nearest;
+    f.bias = 0;
+    for (int delta = 0; delta <= 2; delta++) {
+        for (int sign = -1; sign <= 1; sign += 2) {
+            for (int bias = 0; bias < (1 << f.shift); bias = bias ? 2 * bias : 1) {
+                ContrastFixed candidate = f;
+                candidate.coeff = std::max(-32767, std::min(32767, nearest + sign * delta));
+                candidate.bias = bias;
+                bool exact = true;
+                for (int v = 0; v < 256 && exact; v++) {
+                    exact = contrastFixedByte(static_cast<unsigned char>(v), candidate) == contrastReference(static_cast<unsigned char>(v), factor);
+                }
+                if (exact) return candidate;
+            }
+        }
+    }
+    return f;
+}
+
+typedef void (*ContrastFn)(const unsigned char*, unsigned char*, size_t, ContrastFixed);
+
+inline void contrastScalar(const unsigned char* src, unsigned char* dst, size_t n, ContrastFixed f) {
+    for (size_t i = 0; i < n; i++) dst[i] = contrastFixedByte(src[i], f);
+}
+
+#if DIP_X86_DISPATCH
+// Bytes are widened to (v - 128, 1) int16 pairs so madd against (coeff, bias)
+// gives coeff * (v - 128) + bias in each 32-bit lane; the packs saturate back
+// to bytes.
+__attribute__((target("sse2")))
+inline void contrastSse2(const unsigned char* src, unsigned char* dst, size_t n, ContrastFixed f) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mid = _mm_set1_epi16(128);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i coeff = _mm_set1_epi32(int((f.coeff & 0xFFFF) | (f.bias << 16)));
+    const __m128i shift = _mm_cvtsi32_si128(f.shift);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i half[2] = {_mm_sub_epi16(_mm_unpacklo_epi8(x, zero), mid), _mm_sub_epi16(_mm_unpackhi_epi8(x, zero), mid)};
+        for (int h = 0; h < 2; h++) {
+            __m128i lo = _mm_sra_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(half[h], one), coeff), shift);
+            __m128i hi = _mm_sra_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(half[h], one), coeff), shift);
+            half[h] = _mm_adds_epi16(_mm_packs_epi32(lo, hi), mid);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(half[0], half[1]));
+    }
+    contrastScalar(src + i, dst + i, n - i, f);
+}
+
+// The unpacks and packs work within 128-bit lanes, so the byte order comes
+// back out unchanged.
+__attribute__((target("avx2")))
+inline void contrastAvx2(const unsigned char* src, unsigned char* dst, size_t n, ContrastFixed f) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mid = _mm256_set1_epi16(128);
+    const __m256i one = _mm256_set1_epi16(1);
+    const __m256i coeff = _mm256_set1_epi32(int((f.coeff & 0xFFFF) | (f.bias << 16)));
+    const __m128i shift = _mm_cvtsi32_si128(f.shift);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i half[2] = {_mm256_sub_epi16(_mm256_unpacklo_epi8(x, zero), mid), _mm256_sub_epi16(_mm256_unpackhi_epi8(x, zero), mid)};
+        for (int h = 0; h < 2; h++) {
+            __m256i lo = _mm256_sra_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(half[h], one), coeff), shift);
+            __m256i hi = _mm256_sra_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(half[h], one), coeff), shift);
+            half[h] = _mm256_adds_epi16(_mm256_packs_epi32(lo, hi), mid);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_packus_epi16(half[0], half[1]));
+    }
+    contrastScalar(src + i, dst + i, n - i, f);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline void contrastAvx512(const unsigned char* src, unsigned char* dst, size_t n, ContrastFixed f) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i mid = _mm512_set1_epi16(128);
+    const __m512i one = _mm512_set1_epi16(1);
+    const __m512i coeff = _mm512_set1_epi32(int((f.coeff & 0xFFFF) | (f.bias << 16)));
+    const __m128i shift = _mm_cvtsi32_si128(f.shift);
+    for (size_t i = 0; i < n; i += 64) {
+        __mmask64 m = (n - i >= 64) ? ~__mmask64(0) : ((__mmask64(1) << (n - i)) - 1);
+        __m512i x = _mm512_maskz_loadu_epi8(m, src + i);
+        __m512i half[2] = {_mm512_sub_epi16(_mm512_unpacklo_epi8(x, zero), mid), _mm512_sub_epi16(_mm512_unpackhi_epi8(x, zero), mid)};
+        for (int h = 0; h < 2; h++) {
+            __m512i lo = _mm512_maskz_sra_epi32(0xFFFF, _mm512_madd_epi16(_mm512_unpacklo_epi16(half[h], one), coeff), shift);
+            __m512i hi = _mm512_maskz_sra_epi32(0xFFFF, _mm512_madd_epi16(_mm512_unpackhi_epi16(half[h], one), coeff), shift);
+            half[h] = _mm512_adds_epi16(_mm512_packs_epi32(lo, hi), mid);
+        }
+        _mm512_mask_storeu_epi8(dst + i, m, _mm512_packus_epi16(half[0], half[1]));
+    }
+}
+#endif
+
+inline void contrast(const unsigned char* src, unsigned char* dst, size_t n, ContrastFixed f) {
+#if DIP_X86_DISPATCH
+    static const ContrastFn variants[kCpuLevelCount] = {contrastScalar, contrastSse2, contrastAvx2, contrastAvx512, nullptr};
+#else
+    static const ContrastFn variants[kCpuLevelCount] = {contrastScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const ContrastFn fn = pickKernel(variants);
+    fn(src, dst, n, f);
+}
+
+#endif // DIP_COMMON_POINT_OPS_H
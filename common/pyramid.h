@@ -0,0 +1,265 @@
+#ifndef DIP_COMMON_PYRAMID_H
+#define DIP_COMMON_PYRAMID_H
+
+// Image pyramids (mipmaps).
+//
+// An ImagePyramid holds the source image and every halved level below it in
+// one contiguous buffer, each level laid out like BMP pixel data (rows padded
+// to 4 bytes, in the source's row order), so a level can be handed to any
+// BMPConstImage consumer or written out as is. Level i is ceil(w / 2^i) by
+// ceil(h / 2^i).
+//
+// Levels are built in a single pass over the source rows: as soon as a level
+// has the rows a row of the next level needs, that row is reduced, so every
+// level is produced while its input is still in cache and the source is read
+// once. A reduction is either the 2x2 box average or the 5x5 binomial
+// ([1 4 6 4 1] / 16 on each axis) followed by decimation; edges are clamped.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "bmp_io.h"
+#include "dispatch.h"
+
+enum PyramidReduce {
+    kPyramidBox,
+    kPyramidGaussian
+};
+
+/* One reduced row: the rows of the finer level are summed into t, then
+   out[x] = (sum over the horizontal taps of t around pixel 2x + round) >> shift */
+
+// t holds n = width * nc sums with two clamped pixels of padding on each side
+// (t[-2nc..-1] and t[n..n+2nc-1]); v gets the horizontally filtered sums.
+typedef void (*PyramidRowFn)(const unsigned char* const*, int, uint16_t*, uint16_t*, unsigned char*, int, int, PyramidReduce);
+
+inline void pyramidPadSums(uint16_t* t, int width, int nc) {
+    size_t n = size_t(width) * nc;
+    for (int c = 0; c < nc; c++) {
+        t[c - 2 * nc] = t[c - nc] = t[c];
+        t[n + c] = t[n + nc + c] = t[n - nc + c];
+    }
+}
+
+inline void pyramidRowScalar(const unsigned char* const* rows, int width, uint16_t* t, uint16_t* v, unsigned char* out, int out_width, int nc, PyramidReduce reduce) {
+    (void)v;
+    size_t n = size_t(width) * nc;
+    if (reduce == kPyramidBox) {
+        for (size_t i = 0; i < n; i++) t[i] = uint16_t(rows[0][i] + rows[1][i]);
+    } else {
+        for (size_t i = 0; i < n; i++) t[i] = uint16_t(rows[0][i] + 4 * (rows[1][i] + rows[3][i]) + 6 * rows[2][i] + rows[4][i]);
+    }
+    pyramidPadSums(t, width, nc);
+    for (int x = 0; x < out_width; x++) {
+        for (int c = 0; c < nc; c++) {
+            const uint16_t* p = t + size_t(2 * x) * nc + c;
+            if (reduce == kPyramidBox) {
+                out[x * nc + c] = static_cast<unsigned char>((p[0] + p[nc] + 2) >> 2);
+            } else {
+                out[x * nc + c] = static_cast<unsigned char>((p[-2 * nc] + 4 * (p[-nc] + p[nc]) + 6 * p[0] + p[2 * nc] + 128) >> 8);
+            }
+        }
+    }
+}
+
+#if DIP_X86_DISPATCH
+// The filtered sums of pixels 0 and 2 of every group of four are gathered
+// with two byte shuffles (the group spans 12 or 16 16-bit lanes), rounded,
+// shifted and packed: 2 output pixels per step.
+__attribute__((target("avx2")))
+inline void pyramidRowAvx2(const unsigned char* const* rows, int width, uint16_t* t, uint16_t* v, unsigned char* out, int out_width, int nc, PyramidReduce reduce) {
+    if ((nc != 3) && (nc != 4)) {
+        pyramidRowScalar(rows, width, t, v, out, out_width, nc, reduce);
+        return;
+    }
+    size_t n = size_t(width) * nc;
+    size_t i = 0;
+    const __m256i four = _mm256_set1_epi16(4), six = _mm256_set1_epi16(6);
+    for (; i + 16 <= n; i += 16) {
+        __m256i r0 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[0] + i)));
+        __m256i r1 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[1] + i)));
+        __m256i s;
+        if (reduce == kPyramidBox) {
+            s = _mm256_add_epi16(r0, r1);
+        } else {
+            __m256i r2 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[2] + i)));
+            __m256i r3 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[3] + i)));
+            __m256i r4 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[4] + i)));
+            s = _mm256_add_epi16(_mm256_add_epi16(r0, r4), _mm256_add_epi16(_mm256_mullo_epi16(_mm256_add_epi16(r1, r3), four), _mm256_mullo_epi16(r2, six)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(t + i), s);
+    }
+    for (; i < n; i++) {
+        t[i] = (reduce == kPyramidBox) ? uint16_t(rows[0][i] + rows[1][i])
+                                       : uint16_t(rows[0][i] + 4 * (rows[1][i] + rows[3][i]) + 6 * rows[2][i] + rows[4][i]);
+    }
+    pyramidPadSums(t, width, nc);
+
+    // Horizontal filter at every position (unsigned 16-bit: at most 65280)
+    size_t step = size_t(nc);
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(t + i));
+        __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(t + i + step));
+        __m256i f;
+        if (reduce == kPyramidBox) {
+            f = _mm256_add_epi16(c, r);
+        } else {
+            __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(t + i - step));
+            __m256i ll = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(t + i - 2 * step));
+            __m256i rr = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(t + i + 2 * step));
+            f = _mm256_add_epi16(_mm256_add_epi16(ll, rr), _mm256_add_epi16(_mm256_mullo_epi16(_mm256_add_epi16(l, r), four), _mm256_mullo_epi16(c, six)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(v + i), f);
+    }
+    for (; i < n; i++) {
+        v[i] = (reduce == kPyramidBox) ? uint16_t(t[i] + t[i + step])
+                                       : uint16_t(t[i - 2 * step] + 4 * (t[i - step] + t[i + step]) + 6 * t[i] + t[i + 2 * step]);
+    }
+
+    // Decimate: lane o of the result is lane o (pixel 0) or o + nc (pixel 2)
+    unsigned char lo_mask[16], hi_mask[16];
+    for (int b = 0; b < 16; b++) {
+        int o = b / 2;
+        int lane = (o < 2 * nc) ? ((o < nc) ? o : o + nc) : -1;
+        int byte = 2 * lane + (b & 1);
+        lo_mask[b] = ((lane >= 0) && (lane < 8)) ? static_cast<unsigned char>(byte) : 0x80;
+        hi_mask[b] = (lane >= 8) ? static_cast<unsigned char>(byte - 16) : 0x80;
+    }
+    const __m128i mlo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo_mask));
+    const __m128i mhi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi_mask));
+    int shift = (reduce == kPyramidBox) ? 2 : 8;
+    const __m128i round = _mm_set1_epi16(short(1 << (shift - 1)));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t out_bytes = size_t(out_width) * nc;
+    int x = 0;
+    for (; (2 * x + 4 <= width) && (size_t(x) * nc + 8 <= out_bytes); x += 2) {
+        const uint16_t* p = v + size_t(2 * x) * nc;
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8));
+        __m128i g = _mm_or_si128(_mm_shuffle_epi8(a, mlo), _mm_shuffle_epi8(b, mhi));
+        g = _mm_srl_epi16(_mm_add_epi16(g, round), count);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + size_t(x) * nc), _mm_packus_epi16(g, g));
+    }
+    for (; x < out_width; x++) {
+        for (int c = 0; c < nc; c++) out[x * nc + c] = static_cast<unsigned char>((v[size_t(2 * x) * nc + c] + (1 << (shift - 1))) >> shift);
+    }
+}
+#endif
+
+inline void pyramidRow(const unsigned char* const* rows, int width, uint16_t* t, uint16_t* v, unsigned char* out, int out_width, int nc, PyramidReduce reduce) {
+#if DIP_X86_DISPATCH
+    static const PyramidRowFn variants[kCpuLevelCount] = {pyramidRowScalar, nullptr, pyramidRowAvx2, nullptr, nullptr};
+#else
+    static const PyramidRowFn variants[kCpuLevelCount] = {pyramidRowScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const PyramidRowFn fn = pickKernel(variants);
+    fn(rows, width, t, v, out, out_width, nc, reduce);
+}
+
+class ImagePyramid {
+public:
+    ImagePyramid() : num_channel_(0), top_down_(false), reduce_(kPyramidBox) {}
+
+    // Lay out levels 0 .. levels - 1 for a width x height source (fewer if
+    // the image reaches 1 x 1 first). Rows are then fed with pushRow().
+    void begin(int width, int height, int num_channel, bool top_down, int levels, PyramidReduce reduce) {
+        num_channel_ = num_channel;
+        top_down_ = top_down;
+        reduce_ = reduce;
+        levels_.clear();
+        size_t offset = 0;
+        for (int l = 0; l < levels; l++) {
+            Level level;
+            level.width = width;
+            level.height = height;
+            level.stride = bmpRowStride(width, num_channel);
+            level.offset = offset;
+            level.rows_done = 0;
+            offset += level.stride * size_t(height);
+            levels_.push_back(level);
+            if ((width == 1) && (height == 1)) break;
+            width = (width + 1) / 2;
+            height = (height + 1) / 2;
+        }
+        data_.assign(offset, 0);
+        size_t pad = 2 * size_t(num_channel);
+        t_.assign(size_t(levels_[0].width) * num_channel + 2 * pad + 16, 0);
+        v_.assign(t_.size(), 0);
+    }
+
+    // Append the next source row (in storage order) and reduce whatever
+    // rows of the coarser levels it completes
+    void pushRow(const unsigned char* row) {
+        Level& base = levels_[0];
+        std::memcpy(levelRow(0, base.rows_done), row, size_t(base.width) * num_channel_);
+        base.rows_done++;
+        for (size_t l = 1; l < levels_.size(); l++) {
+            const Level& fine = levels_[l - 1];
+            Level& coarse = levels_[l];
+            int reach = (reduce_ == kPyramidBox) ? 1 : 2;
+            while ((coarse.rows_done < coarse.height) &&
+                   ((2 * coarse.rows_done + reach < fine.rows_done) || (fine.rows_done == fine.height))) {
+                reduceRow(int(l), coarse.rows_done);
+                coarse.rows_done++;
+            }
+        }
+    }
+
+    // Build every level from base in one pass
+    void build(const BMPConstImage& base, int levels, PyramidReduce reduce) {
+        begin(base.width, base.height, base.num_channel, base.top_down, levels, reduce);
+        for (int s = 0; s < base.height; s++) pushRow(base.pixels + size_t(s) * base.stride);
+    }
+
+    int levels() const { return int(levels_.size()); }
+
+    BMPConstImage level(int i) const {
+        BMPConstImage image;
+        image.pixels = data_.data() + levels_[i].offset;
+        image.width = levels_[i].width;
+        image.height = levels_[i].height;
+        image.num_channel = num_channel_;
+        image.stride = levels_[i].stride;
+        image.top_down = top_down_;
+        return image;
+    }
+
+    // All levels, back to back
+    const std::vector<unsigned char>& data() const { return data_; }
+
+private:
+    struct Level {
+        int width;
+        int height;
+        size_t stride;
+        size_t offset;
+        int rows_done;  // rows filled so far, in storage order
+    };
+
+    unsigned char* levelRow(int l, int s) { return data_.data() + levels_[l].offset + size_t(s) * levels_[l].stride; }
+
+    void reduceRow(int l, int s) {
+        const Level& fine = levels_[l - 1];
+        const unsigned char* rows[5];
+        if (reduce_ == kPyramidBox) {
+            rows[0] = levelRow(l - 1, 2 * s);
+            rows[1] = levelRow(l - 1, std::min(2 * s + 1, fine.height - 1));
+        } else {
+            for (int k = 0; k < 5; k++) rows[k] = levelRow(l - 1, std::max(0, std::min(fine.height - 1, 2 * s + k - 2)));
+        }
+        size_t pad = 2 * size_t(num_channel_);
+        pyramidRow(rows, fine.width, t_.data() + pad, v_.data() + pad, levelRow(l, s), levels_[l].width, num_channel_, reduce_);
+    }
+
+    std::vector<Level> levels_;
+    std::vector<unsigned char> data_;
+    std::vector<uint16_t> t_;  // vertical sums of the finest level, padded
+    std::vector<uint16_t> v_;  // horizontally filtered sums
+    int num_channel_;
+    bool top_down_;
+    PyramidReduce reduce_;
+};
+
+#endif // DIP_COMMON_PYRAMID_H
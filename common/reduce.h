@@ -0,0 +1,150 @@
+#ifndef DIP_COMMON_REDUCE_H
+#define DIP_COMMON_REDUCE_H
+
+// Per-channel sums over an image.
+//
+// Sums are kept in integers all the way, so the result is exact and the
+// same whatever the number of threads or the order the bands finish in.
+// Each band of rows is summed on the shared thread pool with psadbw: the
+// bytes of one channel are masked out of a vector and summed against zero
+// into 64-bit lanes. With 3 channels the channel pattern repeats every 3
+// vectors, so blocks of 3 vectors are summed with 9 masks.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+
+#include "bmp_io.h"
+#include "dispatch.h"
+#include "tile_executor.h"
+
+// sums[c] += sum of byte c of every pixel in n bytes, c < num_channel;
+// returns how many bytes from the start were summed (a SIMD kernel leaves a
+// tail shorter than one block)
+typedef size_t (*ChannelSumsFn)(const unsigned char*, size_t, int, uint64_t*);
+
+inline size_t channelSumsScalar(const unsigned char* src, size_t n, int num_channel, uint64_t* sums) {
+    uint64_t s[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    if (num_channel == 4) {
+        for (; i + 4 <= n; i += 4) {
+            s[0] += src[i]; s[1] += src[i + 1]; s[2] += src[i + 2]; s[3] += src[i + 3];
+        }
+    } else {
+        for (; i + 3 <= n; i += 3) {
+            s[0] += src[i]; s[1] += src[i + 1]; s[2] += src[i + 2];
+        }
+    }
+    for (int c = 0; c < num_channel; c++) sums[c] += s[c];
+    return i;
+}
+
+// Lane masks for the channels of a block of vectors of W bytes: byte k of
+// vector v belongs to channel (v * W + k) % num_channel
+inline void channelSumMasks(int num_channel, int width, unsigned char masks[3][4][64]) {
+    std::memset(masks, 0, 3 * 4 * 64);
+    for (int v = 0; v < 3; v++) {
+        for (int k = 0; k < width; k++) masks[v][(v * width + k) % num_channel][k] = 0xFF;
+    }
+}
+
+#if DIP_X86_DISPATCH
+template <int NC>
+__attribute__((target("sse2")))
+inline size_t channelSumsSse2T(const unsigned char* src, size_t n, uint64_t* sums) {
+    const int V = (NC == 3) ? 3 : 1;
+    unsigned char bytes[3][4][64];
+    channelSumMasks(NC, 16, bytes);
+    __m128i masks[3][4], acc[4];
+#pragma GCC unroll 4
+    for (int c = 0; c < NC; c++) {
+#pragma GCC unroll 3
+        for (int v = 0; v < V; v++) masks[v][c] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes[v][c]));
+        acc[c] = _mm_setzero_si128();
+    }
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 * V <= n; i += 16 * V) {
+#pragma GCC unroll 3
+        for (int v = 0; v < V; v++) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16 * v));
+#pragma GCC unroll 4
+            for (int c = 0; c < NC; c++) acc[c] = _mm_add_epi64(acc[c], _mm_sad_epu8(_mm_and_si128(x, masks[v][c]), zero));
+        }
+    }
+    for (int c = 0; c < NC; c++) {
+        uint64_t lanes[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc[c]);
+        sums[c] += lanes[0] + lanes[1];
+    }
+    return i;
+}
+
+template <int NC>
+__attribute__((target("avx2")))
+inline size_t channelSumsAvx2T(const unsigned char* src, size_t n, uint64_t* sums) {
+    const int V = (NC == 3) ? 3 : 1;
+    unsigned char bytes[3][4][64];
+    channelSumMasks(NC, 32, bytes);
+    __m256i masks[3][4], acc[4];
+#pragma GCC unroll 4
+    for (int c = 0; c < NC; c++) {
+#pragma GCC unroll 3
+        for (int v = 0; v < V; v++) masks[v][c] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes[v][c]));
+        acc[c] = _mm256_setzero_si256();
+    }
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 * V <= n; i += 32 * V) {
+#pragma GCC unroll 3
+        for (int v = 0; v < V; v++) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32 * v));
+#pragma GCC unroll 4
+            for (int c = 0; c < NC; c++) acc[c] = _mm256_add_epi64(acc[c], _mm256_sad_epu8(_mm256_and_si256(x, masks[v][c]), zero));
+        }
+    }
+    for (int c = 0; c < NC; c++) {
+        uint64_t lanes[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc[c]);
+        sums[c] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+inline size_t channelSumsSse2(const unsigned char* src, size_t n, int num_channel, uint64_t* sums) {
+    return (num_channel == 4) ? channelSumsSse2T<4>(src, n, sums) : channelSumsSse2T<3>(src, n, sums);
+}
+
+__attribute__((target("avx2")))
+inline size_t channelSumsAvx2(const unsigned char* src, size_t n, int num_channel, uint64_t* sums) {
+    return (num_channel == 4) ? channelSumsAvx2T<4>(src, n, sums) : channelSumsAvx2T<3>(src, n, sums);
+}
+#endif
+
+// sums[c] = sum of channel c over the whole image, c < in.num_channel
+inline void channelSums(const BMPConstImage& in, uint64_t sums[4]) {
+#if DIP_X86_DISPATCH
+    static const ChannelSumsFn variants[kCpuLevelCount] = {channelSumsScalar, channelSumsSse2, channelSumsAvx2, nullptr, nullptr};
+#else
+    static const ChannelSumsFn variants[kCpuLevelCount] = {channelSumsScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const ChannelSumsFn fn = pickKernel(variants);
+    int nc = in.num_channel;
+    size_t row_bytes = in.rowBytes();
+    for (int c = 0; c < 4; c++) sums[c] = 0;
+    std::mutex mutex;
+    forEachTile(in.height, row_bytes, 0, [&](int y0, int y1) {
+        uint64_t band[4] = {0, 0, 0, 0};
+        for (int y = y0; y < y1; y++) {
+            const unsigned char* row = in.row(y);
+            size_t done = fn(row, row_bytes, nc, band);
+            channelSumsScalar(row + done, row_bytes - done, nc, band);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int c = 0; c < nc; c++) sums[c] += band[c];
+    });
+}
+
+#endif // DIP_COMMON_REDUCE_H
@@ -0,0 +1,305 @@
+#ifndef DIP_COMMON_RESAMPLE_H
+#define DIP_COMMON_RESAMPLE_H
+
+// Separable image resampling.
+//
+// A resize is a horizontal pass over every source row into an 8-bit
+// intermediate of out.width x in.height pixels, then a vertical pass into the
+// output. For each output column (and each output row) the source span and
+// its weights are computed once, up front, as Q14 fixed point that sums to
+// exactly 1, so a flat image stays flat. Pixel centres are aligned
+// ((x + 0.5) * in / out - 0.5), taps outside the image are dropped and the
+// rest renormalised, and when shrinking the filters are stretched by the
+// scale factor so they also low-pass the image. Any output size works.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "bmp_io.h"
+#include "dispatch.h"
+#include "tile_executor.h"
+
+enum ResampleFilter {
+    kResampleNearest,
+    kResampleBilinear,
+    kResampleBicubic,   // Keys cubic, a = -0.5
+    kResampleLanczos3,
+    kResampleArea,      // average over the exact footprint of each output pixel
+    kResampleFilterCount
+};
+
+inline const char* resampleFilterName(ResampleFilter filter) {
+    static const char* const names[kResampleFilterCount] = {"nearest", "bilinear", "bicubic", "lanczos3", "area"};
+    return names[filter];
+}
+
+inline bool parseResampleFilter(const std::string& name, ResampleFilter& filter) {
+    for (int i = 0; i < kResampleFilterCount; i++) {
+        if (name == resampleFilterName(ResampleFilter(i))) {
+            filter = ResampleFilter(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const int kResampleShift = 14;  // weights are Q14
+
+// Source span and weights of every output position along one axis
+struct ResampleTaps {
+    std::vector<int> start;        // first source index per output
+    std::vector<int> count;        // taps per output
+    std::vector<int16_t> weights;  // taps weights per output, zero padded
+    int taps;                      // stride of weights
+
+    const int16_t* weightsAt(int i) const { return weights.data() + size_t(i) * taps; }
+};
+
+inline double resampleKernel(ResampleFilter filter, double x) {
+    x = std::fabs(x);
+    switch (filter) {
+    case kResampleBilinear:
+        return (x < 1.0) ? 1.0 - x : 0.0;
+    case kResampleBicubic:
+        if (x < 1.0) return (1.5 * x - 2.5) * x * x + 1.0;
+        if (x < 2.0) return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+        return 0.0;
+    case kResampleLanczos3:
+        if (x < 1e-8) return 1.0;
+        if (x >= 3.0) return 0.0;
+        return 3.0 * std::sin(M_PI * x) * std::sin(M_PI * x / 3.0) / (M_PI * M_PI * x * x);
+    default:
+        return 0.0;
+    }
+}
+
+inline double resampleSupport(ResampleFilter filter) {
+    return (filter == kResampleBicubic) ? 2.0 : (filter == kResampleLanczos3) ? 3.0 : 1.0;
+}
+
+// Weights for resizing in_size samples to out_size
+inline ResampleTaps resampleTaps(int in_size, int out_size, ResampleFilter filter) {
+    double scale = double(in_size) / out_size;
+    double stretch = std::max(1.0, scale);
+    double support = (filter == kResampleArea) ? std::ceil(scale) + 1.0 : (filter == kResampleNearest) ? 0.5 : resampleSupport(filter) * stretch;
+    ResampleTaps taps;
+    taps.taps = std::min(in_size, int(std::ceil(2.0 * support)) + 1);
+    taps.start.resize(out_size);
+    taps.count.resize(out_size);
+    taps.weights.assign(size_t(out_size) * taps.taps, 0);
+    std::vector<double> w(taps.taps);
+    for (int i = 0; i < out_size; i++) {
+        double center = (i + 0.5) * scale;
+        int first, n;
+        if (filter == kResampleNearest) {
+            first = std::min(in_size - 1, int(center));
+            n = 1;
+            w[0] = 1.0;
+        } else if (filter == kResampleArea) {
+            // Overlap of [i, i + 1) * scale with each source pixel
+            double lo = i * scale, hi = (i + 1) * scale;
+            first = std::min(in_size - 1, int(lo));
+            int last = std::min(in_size - 1, std::max(first, int(std::ceil(hi)) - 1));
+            n = std::min(taps.taps, last - first + 1);
+            for (int k = 0; k < n; k++) {
+                w[k] = std::max(0.0, std::min(hi, first + k + 1.0) - std::max(lo, double(first + k)));
+            }
+        } else {
+            first = std::max(0, int(std::floor(center - support + 0.5)));
+            int end = std::min(in_size, int(std::floor(center + support + 0.5)));
+            n = std::min(taps.taps, end - first);
+            for (int k = 0; k < n; k++) w[k] = resampleKernel(filter, (first + k + 0.5 - center) / stretch);
+        }
+
+        // Normalise, quantise, and give the rounding error to the largest tap
+        double sum = 0.0;
+        for (int k = 0; k < n; k++) sum += w[k];
+        if (sum == 0.0) {
+            w[0] = sum = 1.0;
+            n = 1;
+        }
+        int16_t* q = taps.weights.data() + size_t(i) * taps.taps;
+        int total = 0, largest = 0;
+        for (int k = 0; k < n; k++) {
+            q[k] = int16_t(std::lround(w[k] / sum * (1 << kResampleShift)));
+            total += q[k];
+            if (q[k] > q[largest]) largest = k;
+        }
+        q[largest] = int16_t(q[largest] + (1 << kResampleShift) - total);
+        taps.start[i] = first;
+        taps.count[i] = n;
+    }
+    return taps;
+}
+
+inline unsigned char resampleRound(int sum) {
+    sum = (sum + (1 << (kResampleShift - 1))) >> kResampleShift;
+    return static_cast<unsigned char>(std::max(0, std::min(255, sum)));
+}
+
+// Horizontal pass over one row
+inline void resampleRowH(const unsigned char* src, unsigned char* dst, int out_width, int nc, const ResampleTaps& taps) {
+    for (int x = 0; x < out_width; x++) {
+        const int16_t* w = taps.weightsAt(x);
+        const unsigned char* s = src + size_t(taps.start[x]) * nc;
+        int n = taps.count[x];
+        for (int c = 0; c < nc; c++) {
+            int sum = 0;
+            for (int k = 0; k < n; k++) sum += w[k] * s[k * nc + c];
+            dst[c] = resampleRound(sum);
+        }
+        dst += nc;
+    }
+}
+
+/* Vertical pass: out[i] = sum over k of w[k] * rows[k][i] */
+
+typedef void (*ResampleColumnsFn)(const unsigned char* const*, const int16_t*, int, unsigned char*, size_t);
+
+inline void resampleColumnsRange(const unsigned char* const* rows, const int16_t* w, int n, unsigned char* dst, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        int sum = 0;
+        for (int k = 0; k < n; k++) sum += w[k] * rows[k][i];
+        dst[i] = resampleRound(sum);
+    }
+}
+
+inline void resampleColumnsScalar(const unsigned char* const* rows, const int16_t* w, int n, unsigned char* dst, size_t len) {
+    resampleColumnsRange(rows, w, n, dst, 0, len);
+}
+
+#if DIP_X86_DISPATCH
+// Rows are taken in pairs, interleaved as 16-bit lanes and multiplied by
+// their weight pair with pmaddwd into 32-bit sums.
+__attribute__((target("sse2")))
+inline void resampleColumnsSse2(const unsigned char* const* rows, const int16_t* w, int n, unsigned char* dst, size_t len) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi32(1 << (kResampleShift - 1));
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i acc0 = half, acc1 = half, acc2 = half, acc3 = half;
+        for (int k = 0; k < n; k += 2) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + i));
+            __m128i b = (k + 1 < n) ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k + 1] + i)) : zero;
+            int16_t w1 = (k + 1 < n) ? w[k + 1] : 0;
+            __m128i pair = _mm_set1_epi32(int((uint32_t(uint16_t(w1)) << 16) | uint16_t(w[k])));
+            __m128i lo = _mm_unpacklo_epi8(a, b), hi = _mm_unpackhi_epi8(a, b);  // a0 b0 a1 b1 ...
+            __m128i l0 = _mm_unpacklo_epi8(lo, zero), l1 = _mm_unpackhi_epi8(lo, zero);
+            __m128i h0 = _mm_unpacklo_epi8(hi, zero), h1 = _mm_unpackhi_epi8(hi, zero);
+            acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(l0, pair));
+            acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(l1, pair));
+            acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(h0, pair));
+            acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(h1, pair));
+        }
+        acc0 = _mm_srai_epi32(acc0, kResampleShift);
+        acc1 = _mm_srai_epi32(acc1, kResampleShift);
+        acc2 = _mm_srai_epi32(acc2, kResampleShift);
+        acc3 = _mm_srai_epi32(acc3, kResampleShift);
+        __m128i r = _mm_packus_epi16(_mm_packs_epi32(acc0, acc1), _mm_packs_epi32(acc2, acc3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), r);
+    }
+    resampleColumnsRange(rows, w, n, dst, i, len);
+}
+
+__attribute__((target("avx2")))
+inline void resampleColumnsAvx2(const unsigned char* const* rows, const int16_t* w, int n, unsigned char* dst, size_t len) {
+    const __m256i half = _mm256_set1_epi32(1 << (kResampleShift - 1));
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m256i acc0 = half, acc1 = half;
+        for (int k = 0; k < n; k += 2) {
+            __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + i)));
+            __m256i b = (k + 1 < n) ? _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k + 1] + i))) : _mm256_setzero_si256();
+            int16_t w1 = (k + 1 < n) ? w[k + 1] : 0;
+            __m256i pair = _mm256_set1_epi32(int((uint32_t(uint16_t(w1)) << 16) | uint16_t(w[k])));
+            // Within each 128-bit lane: elements 0-3 (8-11) and 4-7 (12-15)
+            acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), pair));
+            acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), pair));
+        }
+        __m256i v = _mm256_packs_epi32(_mm256_srai_epi32(acc0, kResampleShift), _mm256_srai_epi32(acc1, kResampleShift));
+        v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_castsi256_si128(v));
+    }
+    resampleColumnsRange(rows, w, n, dst, i, len);
+}
+#endif
+
+inline void resampleColumns(const unsigned char* const* rows, const int16_t* w, int n, unsigned char* dst, size_t len) {
+#if DIP_X86_DISPATCH
+    static const ResampleColumnsFn variants[kCpuLevelCount] = {resampleColumnsScalar, resampleColumnsSse2, resampleColumnsAvx2, nullptr, nullptr};
+#else
+    static const ResampleColumnsFn variants[kCpuLevelCount] = {resampleColumnsScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const ResampleColumnsFn fn = pickKernel(variants);
+    fn(rows, w, n, dst, len);
+}
+
+// Resize in to the size of out (alpha is resampled like any channel)
+inline void resampleImage(const BMPConstImage& in, const BMPImage& out, ResampleFilter filter) {
+    int nc = in.num_channel;
+    ResampleTaps columns = resampleTaps(in.width, out.width, filter);
+    ResampleTaps rows = resampleTaps(in.height, out.height, filter);
+    size_t tmp_bytes = size_t(out.width) * nc;
+    std::vector<unsigned char> tmp(tmp_bytes * in.height);
+
+    forEachTile(in.height, in.rowBytes() + tmp_bytes, 0, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) resampleRowH(in.row(y), tmp.data() + size_t(y) * tmp_bytes, out.width, nc, columns);
+    });
+    forEachTile(out.height, tmp_bytes, rows.taps / 2, [&](int y0, int y1) {
+        std::vector<const unsigned char*> src(rows.taps);
+        for (int y = y0; y < y1; y++) {
+            for (int k = 0; k < rows.count[y]; k++) src[k] = tmp.data() + size_t(rows.start[y] + k) * tmp_bytes;
+            resampleColumns(src.data(), rows.weightsAt(y), rows.count[y], out.row(y), tmp_bytes);
+        }
+    });
+}
+
+// Streaming form of resampleImage for when the source rows come one at a
+// time: pushRow() takes source rows in order (as in.row(0), in.row(1), ...),
+// runs the horizontal pass on each and writes every output row whose source
+// rows have all arrived. Only the rows one output row spans are kept.
+// Produces the same pixels as resampleImage.
+class RowResampler {
+public:
+    RowResampler() : num_channel_(0), pushed_(0), emitted_(0) {}
+
+    void begin(int in_width, int in_height, int num_channel, const BMPImage& out, ResampleFilter filter) {
+        num_channel_ = num_channel;
+        out_ = out;
+        columns_ = resampleTaps(in_width, out.width, filter);
+        rows_ = resampleTaps(in_height, out.height, filter);
+        ring_.assign(size_t(rows_.taps) * out.width * num_channel, 0);
+        src_.resize(rows_.taps);
+        pushed_ = 0;
+        emitted_ = 0;
+    }
+
+    void pushRow(const unsigned char* row) {
+        size_t row_bytes = size_t(out_.width) * num_channel_;
+        resampleRowH(row, ringRow(pushed_), out_.width, num_channel_, columns_);
+        pushed_++;
+        while ((emitted_ < out_.height) && (rows_.start[emitted_] + rows_.count[emitted_] <= pushed_)) {
+            for (int k = 0; k < rows_.count[emitted_]; k++) src_[k] = ringRow(rows_.start[emitted_] + k);
+            resampleColumns(src_.data(), rows_.weightsAt(emitted_), rows_.count[emitted_], out_.row(emitted_), row_bytes);
+            emitted_++;
+        }
+    }
+
+private:
+    unsigned char* ringRow(int y) { return ring_.data() + size_t(y % rows_.taps) * out_.width * num_channel_; }
+
+    int num_channel_;
+    BMPImage out_;
+    ResampleTaps columns_;
+    ResampleTaps rows_;
+    std::vector<unsigned char> ring_;  // horizontal pass of the last rows_.taps source rows
+    std::vector<const unsigned char*> src_;
+    int pushed_;
+    int emitted_;
+};
+
+#endif // DIP_COMMON_RESAMPLE_H
@@ -0,0 +1,274 @@
+#ifndef DIP_COMMON_ROW_STREAM_H
+#define DIP_COMMON_ROW_STREAM_H
+
+// Streaming row-band execution for images larger than RAM.
+//
+// BMPRowReader keeps a ring of 2 * radius + 1 rows (plus one read-ahead band)
+// and BMPRowWriter buffers one band of output rows, so a neighbourhood
+// operator runs in memory proportional to the image width, not its area.
+// Rows are visited in the order they are stored in the file; the output
+// keeps the input's row order, so symmetric operators need not care.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bmp_io.h"
+
+// Rows read or written per syscall
+static const int kRowBand = 16;
+
+inline bool preadFull(int fd, unsigned char* buf, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t n = pread(fd, buf, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf += n;
+        size -= size_t(n);
+        offset += n;
+    }
+    return true;
+}
+
+inline bool pwriteFull(int fd, const unsigned char* buf, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, buf, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf += n;
+        size -= size_t(n);
+        offset += n;
+    }
+    return true;
+}
+
+class BMPRowReader {
+public:
+    BMPRowReader() : fd_(-1), width_(0), height_(0), num_channel_(0), stride_(0),
+                     top_down_(false), radius_(0), capacity_(0), loaded_(0) {}
+    ~BMPRowReader() { close(); }
+    BMPRowReader(const BMPRowReader&) = delete;
+    BMPRowReader& operator=(const BMPRowReader&) = delete;
+
+    bool open(const std::string& filename, int radius) {
+        close();
+        fd_ = ::open(filename.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            std::cerr << "Error opening the file" << std::endl;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd_, &st) != 0 ||
+            !preadFull(fd_, reinterpret_cast<unsigned char*>(&header_), sizeof(BMPHeader), 0) ||
+            !preadFull(fd_, reinterpret_cast<unsigned char*>(&infoHeader_), sizeof(BMPInfoHeader), sizeof(BMPHeader))) {
+            std::cerr << "Not a BMP file" << std::endl;
+            close();
+            return false;
+        }
+        if (!bmpCheckHeader(header_, infoHeader_, uint64_t(st.st_size))) {
+            close();
+            return false;
+        }
+        headerBytes_.resize(header_.offset);
+        if (!preadFull(fd_, headerBytes_.data(), headerBytes_.size(), 0)) {
+            std::cerr << "Error reading the file" << std::endl;
+            close();
+            return false;
+        }
+        posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        width_ = infoHeader_.width;
+        height_ = std::abs(infoHeader_.height);
+        top_down_ = infoHeader_.height < 0;
+        num_channel_ = infoHeader_.bitsPerPixel / 8;
+        stride_ = bmpRowStride(width_, num_channel_);
+        radius_ = radius;
+        capacity_ = 2 * radius + 1 + kRowBand;
+        loaded_ = 0;
+        ring_.assign(size_t(capacity_) * stride_, 0);
+        return true;
+    }
+
+    void close() {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+        ring_.clear();
+        ring_.shrink_to_fit();
+    }
+
+    // Make stored rows [y - radius, y + radius] (clamped to the image) resident
+    bool load(int y) {
+        int need = std::min(height_, y + radius_ + 1);
+        while (loaded_ < need) {
+            int slot = loaded_ % capacity_;
+            int n = std::min(std::min(kRowBand, height_ - loaded_), capacity_ - slot);
+            off_t pos = off_t(header_.offset) + off_t(loaded_) * off_t(stride_);
+            if (!preadFull(fd_, ring_.data() + size_t(slot) * stride_, size_t(n) * stride_, pos)) {
+                std::cerr << "Error reading the file" << std::endl;
+                return false;
+            }
+            loaded_ += n;
+        }
+        return true;
+    }
+
+    // Stored row y, clamped to the first/last row; only valid within the
+    // window of the last load()
+    const unsigned char* row(int y) const {
+        y = std::max(0, std::min(height_ - 1, y));
+        return ring_.data() + size_t(y % capacity_) * stride_;
+    }
+
+    const BMPHeader& header() const { return header_; }
+    const std::vector<unsigned char>& headerBytes() const { return headerBytes_; }
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int numChannel() const { return num_channel_; }
+    size_t stride() const { return stride_; }
+    bool topDown() const { return top_down_; }
+
+private:
+    int fd_;
+    BMPHeader header_;
+    BMPInfoHeader infoHeader_;
+    std::vector<unsigned char> headerBytes_;
+    int width_;
+    int height_;
+    int num_channel_;
+    size_t stride_;
+    bool top_down_;
+    int radius_;
+    int capacity_;  // rows in the ring
+    int loaded_;    // rows [0, loaded_) have been read
+    std::vector<unsigned char> ring_;
+};
+
+class BMPRowWriter {
+public:
+    BMPRowWriter() : fd_(-1), offset_(0), stride_(0), written_(0), pending_(0) {}
+    ~BMPRowWriter() { close(); }
+    BMPRowWriter(const BMPRowWriter&) = delete;
+    BMPRowWriter& operator=(const BMPRowWriter&) = delete;
+
+    // Output with the same header (and geometry) as src
+    bool create(const std::string& filename, const BMPRowReader& src) {
+        close();
+        fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) {
+            std::cerr << "Error creating the output file" << std::endl;
+            return false;
+        }
+        std::vector<unsigned char> header = src.headerBytes();
+        offset_ = src.header().offset;
+        bmpPatchHeader(header.data(), offset_, src.width(), src.height(), src.numChannel(), src.topDown());
+        if (!pwriteFull(fd_, header.data(), header.size(), 0)) {
+            std::cerr << "Error writing the output file" << std::endl;
+            close();
+            return false;
+        }
+        stride_ = src.stride();
+        written_ = 0;
+        pending_ = 0;
+        band_.assign(size_t(kRowBand) * stride_, 0);
+        return true;
+    }
+
+    // Buffer for the next output row
+    unsigned char* row() { return band_.data() + size_t(pending_) * stride_; }
+
+    // Queue the row returned by row(), flushing once a band is full
+    bool commit() {
+        pending_++;
+        return pending_ < kRowBand || flush();
+    }
+
+    bool close() {
+        bool ok = true;
+        if (fd_ >= 0) {
+            ok = flush();
+            ::close(fd_);
+        }
+        fd_ = -1;
+        return ok;
+    }
+
+private:
+    bool flush() {
+        if (pending_ == 0) return true;
+        off_t pos = off_t(offset_) + off_t(written_) * off_t(stride_);
+        if (!pwriteFull(fd_, band_.data(), size_t(pending_) * stride_, pos)) {
+            std::cerr << "Error writing the output file" << std::endl;
+            return false;
+        }
+        written_ += pending_;
+        pending_ = 0;
+        return true;
+    }
+
+    int fd_;
+    uint32_t offset_;
+    size_t stride_;
+    int64_t written_;
+    int pending_;
+    std::vector<unsigned char> band_;
+};
+
+// The rows around output row y handed to a streamed operator
+struct RowWindow {
+    const unsigned char* const* rows;   // 2 * radius + 1 rows, clamped at the edges
+    int radius;
+    int y;
+    int width;
+    int height;
+    int num_channel;
+
+    const unsigned char* row(int dy) const { return rows[radius + dy]; }
+};
+
+// Run op(const RowWindow&, unsigned char* out_row) once per row of input,
+// writing the result to output. Only the row window and one output band are
+// ever resident.
+template <typename RowOp>
+bool streamRows(const std::string& input, const std::string& output, int radius, RowOp op) {
+    BMPRowReader src;
+    if (!src.open(input, radius)) {
+        return false;
+    }
+    BMPRowWriter dst;
+    if (!dst.create(output, src)) {
+        return false;
+    }
+    std::vector<const unsigned char*> rows(2 * radius + 1);
+    RowWindow window;
+    window.rows = rows.data();
+    window.radius = radius;
+    window.width = src.width();
+    window.height = src.height();
+    window.num_channel = src.numChannel();
+    for (int y = 0; y < src.height(); y++) {
+        if (!src.load(y)) {
+            return false;
+        }
+        for (int j = -radius; j <= radius; j++) {
+            rows[radius + j] = src.row(y + j);
+        }
+        window.y = y;
+        op(window, dst.row());
+        if (!dst.commit()) {
+            return false;
+        }
+    }
+    return dst.close();
+}
+
+#endif // DIP_COMMON_ROW_STREAM_H
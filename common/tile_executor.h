@@ -0,0 +1,186 @@
+#ifndef DIP_COMMON_TILE_EXECUTOR_H
+#define DIP_COMMON_TILE_EXECUTOR_H
+
+// Parallel tile executor for neighbourhood filters.
+//
+// ThreadPool is a small work-stealing pool: a parallel loop deals its indices
+// out as contiguous blocks, one block per thread, and a thread that runs out
+// takes indices from the back of another thread's block, so uneven tiles
+// still finish together. The calling thread works as well. The shared pool
+// has one thread per core; DIP_THREADS=n overrides that.
+//
+// forEachTile() cuts an image into bands of whole rows sized so that a band,
+// plus the halo rows above and below it that a filter reads, fits in cache
+// next to its output, and runs op(y0, y1) for every band on the shared pool.
+// Operators that keep running state from row to row (box sums, recursive
+// filters) restart it at y0, which is what the halo rows are for.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // threads counts the calling thread; 0 = one per core
+    explicit ThreadPool(int threads = 0) : stop_(false), generation_(0) {
+        if (threads <= 0) threads = int(std::max(1u, std::thread::hardware_concurrency()));
+        for (int t = 1; t < threads; t++) {
+            workers_.push_back(std::thread([this, t] { workerLoop(t); }));
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (size_t t = 0; t < workers_.size(); t++) workers_[t].join();
+    }
+
+    int size() const { return int(workers_.size()) + 1; }
+
+    // Run fn(i) for every i in [0, count) and return once all have finished.
+    // Called from inside a task it runs serially on that thread.
+    void parallelFor(int count, const std::function<void(int)>& fn) {
+        if (count <= 0) return;
+        if (workers_.empty() || (count == 1) || insideTask()) {
+            for (int i = 0; i < count; i++) fn(i);
+            return;
+        }
+        std::shared_ptr<Job> job = std::make_shared<Job>(fn, count, size());
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = job;
+            generation_++;
+        }
+        wake_.notify_all();
+        run(*job, 0);
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [&] { return job->remaining.load() == 0; });
+        job_.reset();
+    }
+
+    // The process-wide pool, created at first use
+    static ThreadPool& shared() {
+        static ThreadPool pool([] {
+            const char* env = std::getenv("DIP_THREADS");
+            return env ? std::atoi(env) : 0;
+        }());
+        return pool;
+    }
+
+private:
+    // One block of indices per thread: the owner takes from the front,
+    // thieves from the back
+    struct Block {
+        std::mutex mutex;
+        int begin;
+        int end;
+    };
+
+    struct Job {
+        Job(const std::function<void(int)>& f, int count, int threads) : fn(f), blocks(threads), remaining(count) {
+            for (int t = 0; t < threads; t++) {
+                blocks[t].begin = int(int64_t(count) * t / threads);
+                blocks[t].end = int(int64_t(count) * (t + 1) / threads);
+            }
+        }
+        std::function<void(int)> fn;
+        std::vector<Block> blocks;
+        std::atomic<int> remaining;
+    };
+
+    static bool& insideTask() {
+        static thread_local bool inside = false;
+        return inside;
+    }
+
+    static bool takeFront(Block& b, int& index) {
+        std::lock_guard<std::mutex> lock(b.mutex);
+        if (b.begin >= b.end) return false;
+        index = b.begin++;
+        return true;
+    }
+
+    static bool takeBack(Block& b, int& index) {
+        std::lock_guard<std::mutex> lock(b.mutex);
+        if (b.begin >= b.end) return false;
+        index = --b.end;
+        return true;
+    }
+
+    // Work on job as thread t until no index is left anywhere
+    void run(Job& job, int t) {
+        int threads = int(job.blocks.size());
+        insideTask() = true;
+        for (;;) {
+            int index;
+            bool found = takeFront(job.blocks[t], index);
+            for (int k = 1; !found && (k < threads); k++) found = takeBack(job.blocks[(t + k) % threads], index);
+            if (!found) break;
+            job.fn(index);
+            if (--job.remaining == 0) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                done_.notify_all();
+            }
+        }
+        insideTask() = false;
+    }
+
+    void workerLoop(int t) {
+        unsigned seen = 0;
+        for (;;) {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&] { return stop_ || (generation_ != seen); });
+                if (stop_) return;
+                seen = generation_;
+                job = job_;
+            }
+            // A late wake-up may find the job already finished and released
+            if (job) run(*job, t);
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::shared_ptr<Job> job_;
+    bool stop_;
+    unsigned generation_;
+};
+
+// Bytes of source and destination rows one band should keep in cache
+const size_t kTileCacheBytes = 256 * 1024;
+
+// Rows per band for rows of row_bytes and halo extra source rows on each
+// side. Bands are at least 2 * halo rows tall so that restarting a filter
+// at every band costs at most as much as the band itself, and small enough
+// to give every thread a few bands to balance with.
+inline int tileRows(int height, size_t row_bytes, int halo, int threads) {
+    long rows = long(kTileCacheBytes / std::max<size_t>(1, 2 * row_bytes)) - 2 * halo;
+    if (threads > 1) rows = std::min(rows, long(height + 4 * threads - 1) / (4 * threads));
+    rows = std::max(rows, long(2 * halo));
+    return int(std::max(1L, std::min(rows, long(height))));
+}
+
+// Run op(y0, y1) over bands of rows [y0, y1) that together cover [0, height)
+template <typename BandOp>
+inline void forEachTile(int height, size_t row_bytes, int halo, BandOp op) {
+    ThreadPool& pool = ThreadPool::shared();
+    int rows = tileRows(height, row_bytes, halo, pool.size());
+    int bands = (height + rows - 1) / rows;
+    pool.parallelFor(bands, [&](int b) { op(b * rows, std::min(height, (b + 1) * rows)); });
+}
+
+#endif // DIP_COMMON_TILE_EXECUTOR_H
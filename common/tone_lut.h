@@ -0,0 +1,311 @@
+#ifndef DIP_COMMON_TONE_LUT_H
+#define DIP_COMMON_TONE_LUT_H
+
+// Fused tone curves.
+//
+// A ToneLut starts as the identity and every operator appended to it is
+// composed into one 256-entry table per channel, so a chain of brightness,
+// contrast, bit-depth and gamma steps costs a single lookup per byte and a
+// single pass over the image, however long the chain is. Operators are
+// evaluated in double precision once per table entry, with the same rounding
+// as the standalone tools.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#include "bmp_io.h"
+#include "dispatch.h"
+#include "point_ops.h"
+#include "tile_executor.h"
+
+/* Single-table lookup over a byte span: dst[i] = table[src[i]] */
+
+typedef void (*LookupBytesFn)(const unsigned char*, unsigned char*, size_t, const unsigned char*);
+
+inline void lookupBytesScalar(const unsigned char* src, unsigned char* dst, size_t n, const unsigned char* table) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        unsigned char a = table[src[i]], b = table[src[i + 1]], c = table[src[i + 2]], d = table[src[i + 3]];
+        dst[i] = a; dst[i + 1] = b; dst[i + 2] = c; dst[i + 3] = d;
+    }
+    for (; i < n; i++) dst[i] = table[src[i]];
+}
+
+#if DIP_X86_DISPATCH
+// The table as sixteen 16-entry pshufb tables, one per high nibble, each
+// XORed with the one below it (d[0] and d[8] are kept as they are)
+__attribute__((target("avx2")))
+inline void lookupTablesAvx2(const unsigned char* table, __m256i d[16]) {
+    __m128i prev = _mm_setzero_si128();
+    for (int k = 0; k < 16; k++) {
+        __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16 * k));
+        d[k] = _mm256_broadcastsi128_si256((k == 0 || k == 8) ? cur : _mm_xor_si128(cur, prev));
+        prev = cur;
+    }
+}
+
+// pshufb yields d[k][idx & 15] while its index byte is non-negative and 0
+// once it is negative. Stepping the index down by 16 with signed saturation
+// keeps it non-negative for exactly the sub-tables k <= idx >> 4, so XORing
+// the eight lookups telescopes to table[idx]. Indices of 128 and above are
+// negative from the start and run through d[8..15] with the top bit flipped.
+__attribute__((target("avx2")))
+inline __m256i lookupStepAvx2(const __m256i d[16], __m256i idx) {
+    const __m256i step = _mm256_set1_epi8(16);
+    __m256i lo = idx;
+    __m256i hi = _mm256_xor_si256(idx, _mm256_set1_epi8(char(0x80)));
+    __m256i r = _mm256_setzero_si256();
+    for (int k = 0; k < 8; k++) {
+        r = _mm256_xor_si256(r, _mm256_shuffle_epi8(d[k], lo));
+        r = _mm256_xor_si256(r, _mm256_shuffle_epi8(d[k + 8], hi));
+        lo = _mm256_subs_epi8(lo, step);
+        hi = _mm256_subs_epi8(hi, step);
+    }
+    return r;
+}
+
+__attribute__((target("avx2")))
+inline void lookupBytesAvx2(const unsigned char* src, unsigned char* dst, size_t n, const unsigned char* table) {
+    __m256i d[16];
+    lookupTablesAvx2(table, d);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), lookupStepAvx2(d, idx));
+    }
+    lookupBytesScalar(src + i, dst + i, n - i, table);
+}
+
+// Two 128-entry byte permutes cover the table; the top bit of each index
+// picks between them.
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+inline void lookupBytesVbmi(const unsigned char* src, unsigned char* dst, size_t n, const unsigned char* table) {
+    __m512i t0 = _mm512_loadu_si512(table);
+    __m512i t1 = _mm512_loadu_si512(table + 64);
+    __m512i t2 = _mm512_loadu_si512(table + 128);
+    __m512i t3 = _mm512_loadu_si512(table + 192);
+    for (size_t i = 0; i < n; i += 64) {
+        __mmask64 m = (n - i >= 64) ? ~__mmask64(0) : ((__mmask64(1) << (n - i)) - 1);
+        __m512i idx = _mm512_maskz_loadu_epi8(m, src + i);
+        __m512i lo = _mm512_permutex2var_epi8(t0, idx, t1);
+        __m512i hi = _mm512_permutex2var_epi8(t2, idx, t3);
+        __m512i r = _mm512_mask_blend_epi8(_mm512_movepi8_mask(idx), lo, hi);
+        _mm512_mask_storeu_epi8(dst + i, m, r);
+    }
+}
+#endif
+
+inline void lookupBytes(const unsigned char* src, unsigned char* dst, size_t n, const unsigned char* table) {
+#if DIP_X86_DISPATCH
+    static const LookupBytesFn variants[kCpuLevelCount] = {lookupBytesScalar, nullptr, lookupBytesAvx2, nullptr, lookupBytesVbmi};
+#else
+    static const LookupBytesFn variants[kCpuLevelCount] = {lookupBytesScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const LookupBytesFn fn = pickKernel(variants);
+    fn(src, dst, n, table);
+}
+
+/* Per-channel lookup over interleaved pixels: byte i of a pixel goes
+   through tables[i] */
+
+typedef void (*LookupChannelsFn)(const unsigned char*, unsigned char*, size_t, int, const unsigned char* const*);
+
+inline void lookupChannelsScalar(const unsigned char* src, unsigned char* dst, size_t n, int num_channel, const unsigned char* const* tables) {
+    const unsigned char* t0 = tables[0];
+    const unsigned char* t1 = tables[1];
+    const unsigned char* t2 = tables[2];
+    size_t i = 0;
+    if (num_channel == 4) {
+        const unsigned char* t3 = tables[3];
+        for (; i + 4 <= n; i += 4) {
+            dst[i] = t0[src[i]]; dst[i + 1] = t1[src[i + 1]];
+            dst[i + 2] = t2[src[i + 2]]; dst[i + 3] = t3[src[i + 3]];
+        }
+    } else {
+        for (; i + 3 <= n; i += 3) {
+            dst[i] = t0[src[i]]; dst[i + 1] = t1[src[i + 1]]; dst[i + 2] = t2[src[i + 2]];
+        }
+    }
+}
+
+#if DIP_X86_DISPATCH
+// Every 64-byte block is looked up in each channel's table as in
+// lookupBytesVbmi and the results merged by byte masks. With 3 channels the
+// channel of a block's first byte cycles through 0, 1, 2 (64 = 1 mod 3).
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+inline void lookupChannelsVbmi(const unsigned char* src, unsigned char* dst, size_t n, int num_channel, const unsigned char* const* tables) {
+    __m512i t[4][4];
+    __mmask64 lanes[3][4];
+    for (int c = 0; c < num_channel; c++) {
+        for (int q = 0; q < 4; q++) t[c][q] = _mm512_loadu_si512(tables[c] + 64 * q);
+    }
+    int phases = (num_channel == 3) ? 3 : 1;
+    for (int p = 0; p < phases; p++) {
+        for (int c = 0; c < num_channel; c++) {
+            lanes[p][c] = 0;
+            for (int k = 0; k < 64; k++) {
+                if ((p + k) % num_channel == c) lanes[p][c] |= __mmask64(1) << k;
+            }
+        }
+    }
+    int phase = 0;
+    for (size_t i = 0; i < n; i += 64) {
+        __mmask64 m = (n - i >= 64) ? ~__mmask64(0) : ((__mmask64(1) << (n - i)) - 1);
+        __m512i idx = _mm512_maskz_loadu_epi8(m, src + i);
+        __mmask64 top = _mm512_movepi8_mask(idx);
+        __m512i r = _mm512_setzero_si512();
+        for (int c = 0; c < num_channel; c++) {
+            __m512i lo = _mm512_permutex2var_epi8(t[c][0], idx, t[c][1]);
+            __m512i hi = _mm512_permutex2var_epi8(t[c][2], idx, t[c][3]);
+            r = _mm512_mask_blend_epi8(lanes[phase][c], r, _mm512_mask_blend_epi8(top, lo, hi));
+        }
+        _mm512_mask_storeu_epi8(dst + i, m, r);
+        if (++phase == phases) phase = 0;
+    }
+}
+#endif
+
+inline void lookupChannels(const unsigned char* src, unsigned char* dst, size_t n, int num_channel, const unsigned char* const* tables) {
+#if DIP_X86_DISPATCH
+    static const LookupChannelsFn variants[kCpuLevelCount] = {lookupChannelsScalar, nullptr, nullptr, nullptr, lookupChannelsVbmi};
+#else
+    static const LookupChannelsFn variants[kCpuLevelCount] = {lookupChannelsScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const LookupChannelsFn fn = pickKernel(variants);
+    fn(src, dst, n, num_channel, tables);
+}
+
+class ToneLut {
+public:
+    // Channel c is byte c of each pixel: B, G, R, then A for 32-bit images
+    static const int kMaxChannel = 4;
+
+    ToneLut() : steps_(0), single_(kSingleNone), single_value_(0) {
+        single_contrast_.coeff = single_contrast_.bias = single_contrast_.shift = 0;
+        for (int c = 0; c < kMaxChannel; c++) {
+            for (int v = 0; v < 256; v++) table_[c][v] = static_cast<unsigned char>(v);
+        }
+    }
+
+    // Append v -> f(v) on every channel; f gets and returns 0..255
+    template <typename F>
+    ToneLut& map(F f) {
+        for (int c = 0; c < kMaxChannel; c++) mapChannel(c, f);
+        return *this;
+    }
+
+    // Append v -> f(v) on channel c only
+    template <typename F>
+    ToneLut& mapChannel(int c, F f) {
+        for (int v = 0; v < 256; v++) table_[c][v] = static_cast<unsigned char>(f(table_[c][v]));
+        steps_++;
+        single_ = kSingleNone;
+        return *this;
+    }
+
+    // min(255, max(0, v + value))
+    ToneLut& add(int value) {
+        // Saturating adds of non-negative values fold into one
+        int sum = (single_ == kSingleAdd) ? single_value_ + value : value;
+        bool single = (steps_ == 0) || (single_ == kSingleAdd);
+        map([value](int v) { return std::max(0, std::min(255, v + value)); });
+        if (single && value >= 0) {
+            single_ = kSingleAdd;
+            single_value_ = static_cast<unsigned char>(std::min(255, sum));
+        }
+        return *this;
+    }
+
+    // Keep the top bits bits of each byte, i.e. (v >> (8 - bits)) << (8 - bits)
+    ToneLut& keepBits(int bits) {
+        int mask = (0xFF << (8 - std::max(0, std::min(8, bits)))) & 0xFF;
+        if (single_ == kSingleMask) mask &= single_value_;
+        bool single = (steps_ == 0) || (single_ == kSingleMask);
+        map([mask](int v) { return v & mask; });
+        if (single) {
+            single_ = kSingleMask;
+            single_value_ = static_cast<unsigned char>(mask);
+        }
+        return *this;
+    }
+
+    // factor * (v - 128) + 128, clipped, as adjustContrast() in hw3
+    ToneLut& contrast(double factor) {
+        bool first = (steps_ == 0);
+        map([factor](int v) { return contrastReference(static_cast<unsigned char>(v), factor); });
+        if (first) {
+            ContrastFixed f = contrastFixed(factor);
+            bool exact = true;
+            for (int v = 0; v < 256 && exact; v++) exact = contrastFixedByte(static_cast<unsigned char>(v), f) == table_[0][v];
+            if (exact) {
+                single_ = kSingleContrast;
+                single_contrast_ = f;
+            }
+        }
+        return *this;
+    }
+
+    // 255 * (v / 255)^gamma, rounded
+    ToneLut& gamma(double g) {
+        return map([g](int v) { return int(std::lround(255.0 * std::pow(v / 255.0, g))); });
+    }
+
+    const unsigned char* table(int c) const { return table_[c]; }
+
+    // Whether the first num_channel channels share one table
+    bool uniform(int num_channel) const {
+        for (int c = 1; c < num_channel; c++) {
+            if (std::memcmp(table_[c], table_[0], 256) != 0) return false;
+        }
+        return true;
+    }
+
+    // Apply to n bytes of interleaved pixels (n a multiple of num_channel);
+    // src == dst is allowed. A chain that is a single add, keepBits or
+    // contrast (repeated adds and keepBits fold together) runs the point_ops
+    // kernel for it, which beats any table walk.
+    void apply(const unsigned char* src, unsigned char* dst, size_t n, int num_channel) const {
+        switch (single_) {
+        case kSingleAdd:
+            addSaturate(src, dst, n, single_value_);
+            return;
+        case kSingleMask:
+            maskBits(src, dst, n, single_value_);
+            return;
+        case kSingleContrast:
+            ::contrast(src, dst, n, single_contrast_);
+            return;
+        case kSingleNone:
+            break;
+        }
+        if (uniform(num_channel)) {
+            lookupBytes(src, dst, n, table_[0]);
+            return;
+        }
+        const unsigned char* tables[kMaxChannel] = {table_[0], table_[1], table_[2], table_[3]};
+        lookupChannels(src, dst, n, num_channel, tables);
+    }
+
+    // Apply to a whole image, in parallel bands of rows; in and out may be
+    // the same image
+    void apply(const BMPConstImage& in, const BMPImage& out) const {
+        size_t row_bytes = in.rowBytes();
+        forEachTile(in.height, row_bytes, 0, [&](int y0, int y1) {
+            for (int y = y0; y < y1; y++) apply(in.row(y), out.row(y), row_bytes, in.num_channel);
+        });
+    }
+
+private:
+    // The one point operator the tables hold, if they hold exactly one
+    enum Single { kSingleNone, kSingleAdd, kSingleMask, kSingleContrast };
+
+    unsigned char table_[kMaxChannel][256];
+    int steps_;                     // mapChannel() calls so far
+    Single single_;
+    unsigned char single_value_;    // addend or mask
+    ContrastFixed single_contrast_;
+};
+
+#endif // DIP_COMMON_TONE_LUT_H
@@ -0,0 +1,248 @@
+#ifndef DIP_COMMON_TRANSPOSE_H
+#define DIP_COMMON_TRANSPOSE_H
+
+// Transposition and 90/270 degree rotation of 1, 3 and 4 channel images.
+//
+// All three are one transpose: output row j, pixel i is source row i, pixel
+// j, with the source rows and/or the output rows walked backwards for the
+// rotations. Walking a source column row by row touches one cache line and
+// one page per pixel, so the image is cut into square tiles small enough
+// that a tile's source and output rows both stay in L1, tiles are dealt out
+// to the shared thread pool a column strip at a time, and inside a tile
+// blocks of pixels are transposed in registers: 16x16 bytes with four
+// rounds of byte unpacks, 4x4 or 8x8 BGRA pixels as 32-bit lanes, and 8x8
+// BGR pixels widened to 32-bit lanes with pshufb, transposed, and packed
+// back. Pixels left over at the right and bottom edges of a tile are copied
+// one at a time.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "bmp_io.h"
+#include "dispatch.h"
+#include "tile_executor.h"
+
+enum RotateMode {
+    kRotateTranspose,  // mirror about the top-left to bottom-right diagonal
+    kRotate90,         // clockwise
+    kRotate270         // counter-clockwise
+};
+
+// Transpose rows x cols pixels: row c of dst (dst + c * dst_step) gets
+// pixel c of every source row r (src + r * src_step), in order. Steps may be
+// negative.
+typedef void (*TransposeTileFn)(const unsigned char*, ptrdiff_t, unsigned char*, ptrdiff_t, int, int, int);
+
+template <int NC>
+inline void transposePixels(const unsigned char* src, ptrdiff_t src_step, unsigned char* dst, ptrdiff_t dst_step, int r0, int r1, int c0, int c1) {
+    for (int c = c0; c < c1; c++) {
+        unsigned char* d = dst + c * dst_step;
+        const unsigned char* s = src + c * NC;
+        for (int r = r0; r < r1; r++) std::memcpy(d + r * NC, s + r * src_step, NC);
+    }
+}
+
+inline void transposeTileScalar(const unsigned char* src, ptrdiff_t src_step, unsigned char* dst, ptrdiff_t dst_step, int rows, int cols, int nc) {
+    if (nc == 1) {
+        transposePixels<1>(src, src_step, dst, dst_step, 0, rows, 0, cols);
+    } else if (nc == 3) {
+        transposePixels<3>(src, src_step, dst, dst_step, 0, rows, 0, cols);
+    } else {
+        transposePixels<4>(src, src_step, dst, dst_step, 0, rows, 0, cols);
+    }
+}
+
+// Transpose a tile with Block::run, which transposes Block::kSize square
+// blocks of Block::kChannels pixels; the edges left over go pixel by pixel.
+// Always inlined so that run() is inlined into the target-specific caller.
+template <typename Block>
+__attribute__((always_inline)) inline void transposeTileBlocks(const unsigned char* src, ptrdiff_t src_step, unsigned char* dst, ptrdiff_t dst_step, int rows, int cols) {
+    const int B = Block::kSize;
+    const int NC = Block::kChannels;
+    int rb = rows - rows % B, cb = cols - cols % B;
+    for (int c = 0; c < cb; c += B) {
+        for (int r = 0; r < rb; r += B) Block::run(src + r * src_step + c * NC, src_step, dst + c * dst_step + r * NC, dst_step);
+    }
+    transposePixels<NC>(src, src_step, dst, dst_step, rb, rows, 0, cols);
+    transposePixels<NC>(src, src_step, dst, dst_step, 0, rb, cb, cols);
+}
+
+#if DIP_X86_DISPATCH
+// 16x16 bytes: each round interleaves row i with row i + 8, and after four
+// rounds row j holds column j
+struct TransposeBlock1Sse2 {
+    static const int kSize = 16;
+    static const int kChannels = 1;
+    __attribute__((target("sse2")))
+    static void run(const unsigned char* src, ptrdiff_t src_step, unsigned char* dst, ptrdiff_t dst_step) {
+        __m128i r[16], o[16];
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++) r[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * src_step));
+#pragma GCC unroll 4
+        for (int round = 0; round < 4; round++) {
+#pragma GCC unroll 8
+            for (int i = 0; i < 8; i++) {
+                o[2 * i] = _mm_unpacklo_epi8(r[i], r[i + 8]);
+                o[2 * i + 1] = _mm_unpackhi_epi8(r[i], r[i + 8]);
+            }
+#pragma GCC unroll 16
+            for (int i = 0; i < 16; i++) r[i] = o[i];
+        }
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++) _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * dst_step), r[i]);
+    }
+};
+
+// 4x4 BGRA pixels, the same rounds on 32-bit lanes
+struct TransposeBlock4Sse2 {
+    static const int kSize = 4;
+    static const int kChannels = 4;
+    __attribute__((target("sse2")))
+    static void run(const unsigned char* src, ptrdiff_t src_step, unsigned char* dst, ptrdiff_t dst_step) {
+        __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + src_step));
+        __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * src_step));
+        __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * src_step));
+        __m128i t0 = _mm_unpacklo_epi32(r0, r2), t1 = _mm_unpackhi_epi32(r0, r2);
+        __m128i t2 = _mm_unpacklo_epi32(r1, r3), t3 = _mm_unpackhi_epi32(r1, r3);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi32(t0, t2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + dst_step), _mm_unpackhi_epi32(t0, t2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * dst_step), _mm_unpacklo_epi32(t1, t3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * dst_step), _mm_unpackhi_epi32(t1, t3));
+    }
+};
+
+// 8x8 32-bit lanes in place: 32-bit and 64-bit unpacks within each 128-bit
+// half, then the halves are exchanged
+__attribute__((target("avx2")))
+inline void transpose8x32Avx2(__m256i* r) {
+    __m256i t[8], u[8];
+#pragma GCC unroll 4
+    for (int i = 0; i < 4; i++) {
+        t[2 * i] = _mm256_unpacklo_epi32(r[2 * i], r[2 * i + 1]);
+        t[2 * i + 1] = _mm256_unpackhi_epi32(r[2 * i], r[2 * i + 1]);
+    }
+#pragma GCC unroll 2
+    for (int i = 0; i < 2; i++) {
+        u[4 * i] = _mm256_unpacklo_epi64(t[4 * i], t[4 * i + 2]);
+        u[4 * i + 1] = _mm256_unpackhi_epi64(t[4 * i], t[4 * i + 2]);
+        u[4 * i + 2] = _mm256_unpacklo_epi64(t[4 * i + 1], t[4 * i + 3]);
+        u[4 * i + 3] = _mm256_unpackhi_epi64(t[4 * i + 1], t[4 * i + 3]);
+    }
+#pragma GCC unroll 4
+    for (int i = 0; i < 4; i++) {
+        r[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        r[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+struct TransposeBlock4Avx2 {
+    static const int kSize = 8;
+    static const int kChannels = 4;
+    __attribute__((target("avx2")))
+    static void run(const unsigned char* src, ptrdiff_t src_step, unsigned char* dst, ptrdiff_t dst_step) {
+        __m256i r[8];
+#pragma GCC unroll 8
+        for (int i = 0; i < 8; i++) r[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * src_step));
+        transpose8x32Avx2(r);
+#pragma GCC unroll 8
+        for (int i = 0; i < 8; i++) _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * dst_step), r[i]);
+    }
+};
+
+// 8x8 BGR pixels: a row's 24 bytes are loaded as two overlapping halves
+// (bytes 0-15 and 8-23) and spread to one pixel per 32-bit lane, and each
+// transposed row is packed back to 24 bytes. Nothing outside the block is
+// read or written.
+struct TransposeBlock3Avx2 {
+    static const int kSize = 8;
+    static const int kChannels = 3;
+    __attribute__((target("avx2")))
+    static void run(const unsigned char* src, ptrdiff_t src_step, unsigned char* dst, ptrdiff_t dst_step) {
+        const __m256i widen = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                               4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15, -1);
+        const __m256i narrow = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                                0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        const __m256i gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+        __m256i r[8];
+#pragma GCC unroll 8
+        for (int i = 0; i < 8; i++) {
+            const unsigned char* s = src + i * src_step;
+            __m256i v = _mm256_loadu2_m128i(reinterpret_cast<const __m128i*>(s + 8), reinterpret_cast<const __m128i*>(s));
+            r[i] = _mm256_shuffle_epi8(v, widen);
+        }
+        transpose8x32Avx2(r);
+#pragma GCC unroll 8
+        for (int i = 0; i < 8; i++) {
+            unsigned char* d = dst + i * dst_step;
+            __m256i v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(r[i], narrow), gather);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d), _mm256_castsi256_si128(v));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(d + 16), _mm256_extracti128_si256(v, 1));
+        }
+    }
+};
+
+__attribute__((target("sse2")))
+inline void transposeTileSse2(const unsigned char* src, ptrdiff_t src_step, unsigned char* dst, ptrdiff_t dst_step, int rows, int cols, int nc) {
+    if (nc == 1) {
+        transposeTileBlocks<TransposeBlock1Sse2>(src, src_step, dst, dst_step, rows, cols);
+    } else if (nc == 4) {
+        transposeTileBlocks<TransposeBlock4Sse2>(src, src_step, dst, dst_step, rows, cols);
+    } else {
+        transposeTileScalar(src, src_step, dst, dst_step, rows, cols, nc);
+    }
+}
+
+__attribute__((target("avx2")))
+inline void transposeTileAvx2(const unsigned char* src, ptrdiff_t src_step, unsigned char* dst, ptrdiff_t dst_step, int rows, int cols, int nc) {
+    if (nc == 1) {
+        transposeTileBlocks<TransposeBlock1Sse2>(src, src_step, dst, dst_step, rows, cols);
+    } else if (nc == 3) {
+        transposeTileBlocks<TransposeBlock3Avx2>(src, src_step, dst, dst_step, rows, cols);
+    } else {
+        transposeTileBlocks<TransposeBlock4Avx2>(src, src_step, dst, dst_step, rows, cols);
+    }
+}
+#endif
+
+inline TransposeTileFn transposeTileKernel() {
+#if DIP_X86_DISPATCH
+    static const TransposeTileFn variants[kCpuLevelCount] = {transposeTileScalar, transposeTileSse2, transposeTileAvx2, nullptr, nullptr};
+#else
+    static const TransposeTileFn variants[kCpuLevelCount] = {transposeTileScalar, nullptr, nullptr, nullptr, nullptr};
+#endif
+    static const TransposeTileFn fn = pickKernel(variants);
+    return fn;
+}
+
+// Tile side in pixels: a tile's source and output rows take about 32KB
+inline int transposeTileSize(int nc) {
+    return (nc == 1) ? 128 : 64;
+}
+
+// out must be in.height x in.width with in's channel count
+inline void rotateImage(const BMPConstImage& in, const BMPImage& out, RotateMode mode) {
+    int width = in.width, height = in.height, nc = in.num_channel;
+    // Source row i and output row j as seen by the transpose kernel
+    bool reverse_src = (mode != kRotate90);
+    bool reverse_dst = (mode != kRotate270);
+    ptrdiff_t src_step = in.top_down ? -ptrdiff_t(in.stride) : ptrdiff_t(in.stride);
+    ptrdiff_t dst_step = out.top_down ? -ptrdiff_t(out.stride) : ptrdiff_t(out.stride);
+    const unsigned char* src = in.row(reverse_src ? height - 1 : 0);
+    unsigned char* dst = out.row(reverse_dst ? width - 1 : 0);
+    if (reverse_src) src_step = -src_step;
+    if (reverse_dst) dst_step = -dst_step;
+
+    TransposeTileFn tile = transposeTileKernel();
+    int t = transposeTileSize(nc);
+    int strips = (width + t - 1) / t;
+    ThreadPool::shared().parallelFor(strips, [&](int s) {
+        int c0 = s * t, cols = std::min(t, width - c0);
+        for (int r0 = 0; r0 < height; r0 += t) {
+            tile(src + r0 * src_step + c0 * nc, src_step, dst + c0 * dst_step + r0 * nc, dst_step, std::min(t, height - r0), cols, nc);
+        }
+    });
+}
+
+#endif // DIP_COMMON_TRANSPOSE_H
@@ -0,0 +1,304 @@
+#ifndef DIP_COMMON_URING_IO_H
+#define DIP_COMMON_URING_IO_H
+
+// Bulk file I/O: many whole-buffer reads or writes submitted at once.
+//
+// On Linux the requests go through an io_uring, driven with the raw system
+// calls (no liburing): up to depth requests are queued in the submission
+// ring and handed to the kernel with one io_uring_enter(), and completions
+// are reaped as they arrive, so a batch of small files costs a few system
+// calls instead of one blocking read or write each. Buffers registered with
+// registerBuffers() are pinned once and used with READ_FIXED/WRITE_FIXED,
+// which saves the kernel mapping the pages on every request; requests whose
+// buffer is not inside a registered one use plain READ/WRITE. Short
+// transfers are resubmitted for the rest.
+//
+// Where io_uring is missing (old kernels, seccomp filters, or
+// /proc/sys/kernel/io_uring_disabled) the same requests run as a loop of
+// pread/pwrite. DIP_IO=sync forces that path. DIP_IO=uring (or kIoUring)
+// insists on the ring: when it cannot be set up ok() is false and run()
+// fails every request instead of falling back.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define DIP_IO_URING 1
+#else
+#define DIP_IO_URING 0
+#endif
+
+// One transfer of size bytes between data and the start of fd
+struct IoRequest {
+    int fd;
+    unsigned char* data;
+    size_t size;
+    bool ok;
+};
+
+enum IoBackend {
+    kIoAuto,   // io_uring when the kernel allows it, else pread/pwrite
+    kIoSync,   // pread/pwrite
+    kIoUring   // io_uring or nothing: without it ok() is false
+};
+
+inline bool ioBlocking(IoRequest& request, bool write) {
+    size_t done = 0;
+    while (done < request.size) {
+        ssize_t n = write ? pwrite(request.fd, request.data + done, request.size - done, off_t(done))
+                          : pread(request.fd, request.data + done, request.size - done, off_t(done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += size_t(n);
+    }
+    return request.ok = (done == request.size);
+}
+
+class BulkIo {
+public:
+    // depth: requests in flight at once
+    explicit BulkIo(unsigned depth = 64, IoBackend backend = kIoAuto)
+        : ring_fd_(-1), depth_(depth), forced_(false), ring_map_(nullptr), ring_size_(0), cq_map_(nullptr), cq_size_(0), sqes_(nullptr) {
+        if (backend == kIoAuto) {
+            const char* env = std::getenv("DIP_IO");
+            if (env && std::strcmp(env, "sync") == 0) backend = kIoSync;
+            if (env && std::strcmp(env, "uring") == 0) backend = kIoUring;
+        }
+        forced_ = (backend == kIoUring);
+        if (backend != kIoSync && !setup() && forced_) {
+            std::cerr << "io_uring is not available" << std::endl;
+        }
+    }
+
+    ~BulkIo() { teardown(); }
+    BulkIo(const BulkIo&) = delete;
+    BulkIo& operator=(const BulkIo&) = delete;
+
+    bool ring() const { return ring_fd_ >= 0; }
+    // False when io_uring was insisted on but is not available
+    bool ok() const { return ring() || !forced_; }
+    const char* backendName() const { return ring() ? "io_uring" : "pread/pwrite"; }
+
+    // Pin buffers for fixed reads and writes, replacing any registered
+    // before. Failing (e.g. over RLIMIT_MEMLOCK) only loses the speed-up.
+    void registerBuffers(const std::vector<iovec>& buffers) {
+#if DIP_IO_URING
+        if (!ring()) return;
+        if (!registered_.empty()) syscall(__NR_io_uring_register, ring_fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+        registered_.clear();
+        if (buffers.empty()) return;
+        if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS, buffers.data(), unsigned(buffers.size())) == 0) {
+            registered_ = buffers;
+        }
+#else
+        (void)buffers;
+#endif
+    }
+
+    // Run every request to completion; false if any failed (see request.ok)
+    bool run(std::vector<IoRequest>& requests, bool write) {
+        bool ok = true;
+        if (!ring()) {
+            if (forced_) {
+                for (size_t i = 0; i < requests.size(); i++) requests[i].ok = false;
+                return requests.empty();
+            }
+            for (size_t i = 0; i < requests.size(); i++) ok = ioBlocking(requests[i], write) && ok;
+            return ok;
+        }
+#if DIP_IO_URING
+        std::vector<size_t> done(requests.size(), 0);
+        size_t next = 0, in_flight = 0;
+        std::vector<size_t> retry;
+        for (size_t i = 0; i < requests.size(); i++) requests[i].ok = false;
+        while (next < requests.size() || !retry.empty() || in_flight > 0) {
+            // Queue new requests and resubmissions while there is room
+            unsigned queued = 0;
+            while (in_flight < depth_ && (!retry.empty() || next < requests.size())) {
+                size_t i;
+                if (!retry.empty()) {
+                    i = retry.back();
+                    retry.pop_back();
+                } else {
+                    i = next++;
+                    if (requests[i].size == 0) {
+                        requests[i].ok = true;
+                        continue;
+                    }
+                }
+                queue(requests[i], i, done[i], write);
+                in_flight++;
+                queued++;
+            }
+            if (in_flight == 0) break;
+            if (!enter(queued, 1)) {
+                // The ring broke down; finish everything still pending the slow way
+                teardown();
+                for (size_t i = 0; i < requests.size(); i++) {
+                    if (!requests[i].ok) ok = ioBlocking(requests[i], write) && ok;
+                }
+                return ok;
+            }
+            // Reap whatever has completed
+            unsigned head = *cq_head_;
+            unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++) {
+                const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+                size_t i = size_t(cqe.user_data);
+                in_flight--;
+                if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+                    retry.push_back(i);
+                } else if (cqe.res > 0) {
+                    done[i] += size_t(cqe.res);
+                    if (done[i] < requests[i].size) retry.push_back(i);
+                    else requests[i].ok = true;
+                } else {
+                    ok = false;  // error, or end of file before size bytes
+                }
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        }
+#endif
+        return ok;
+    }
+
+private:
+#if DIP_IO_URING
+    bool setup() {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        long fd = syscall(__NR_io_uring_setup, depth_, &params);
+        if (fd < 0) return false;
+        ring_fd_ = int(fd);
+        depth_ = std::min(depth_, params.sq_entries);
+
+        size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        ring_size_ = single ? std::max(sq_size, cq_size) : sq_size;
+        void* sq = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+        if (sq == MAP_FAILED) {
+            teardown();
+            return false;
+        }
+        ring_map_ = static_cast<unsigned char*>(sq);
+        if (single) {
+            cq_map_ = ring_map_;
+        } else {
+            cq_size_ = cq_size;
+            void* cq = mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+            if (cq == MAP_FAILED) {
+                teardown();
+                return false;
+            }
+            cq_map_ = static_cast<unsigned char*>(cq);
+        }
+        void* sqes = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            teardown();
+            return false;
+        }
+        sqes_ = sqes;
+        sq_entries_ = params.sq_entries;
+
+        sq_tail_ = reinterpret_cast<unsigned*>(ring_map_ + params.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned*>(ring_map_ + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(ring_map_ + params.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned*>(cq_map_ + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq_map_ + params.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned*>(cq_map_ + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq_map_ + params.cq_off.cqes);
+        return true;
+    }
+
+    void teardown() {
+        if (sqes_) munmap(sqes_, sq_entries_ * sizeof(io_uring_sqe));
+        if (cq_map_ && cq_map_ != ring_map_) munmap(cq_map_, cq_size_);
+        if (ring_map_) munmap(ring_map_, ring_size_);
+        if (ring_fd_ >= 0) close(ring_fd_);
+        sqes_ = nullptr;
+        cq_map_ = ring_map_ = nullptr;
+        ring_fd_ = -1;
+        registered_.clear();
+    }
+
+    // Registered buffer holding [data, data + size), or -1
+    int bufferIndex(const unsigned char* data, size_t size) const {
+        for (size_t b = 0; b < registered_.size(); b++) {
+            const unsigned char* base = static_cast<const unsigned char*>(registered_[b].iov_base);
+            if (data >= base && data + size <= base + registered_[b].iov_len) return int(b);
+        }
+        return -1;
+    }
+
+    // Fill the next submission entry for the rest of request i
+    void queue(const IoRequest& request, size_t i, size_t done, bool write) {
+        unsigned tail = *sq_tail_;
+        unsigned slot = tail & *sq_mask_;
+        io_uring_sqe& sqe = static_cast<io_uring_sqe*>(sqes_)[slot];
+        std::memset(&sqe, 0, sizeof(sqe));
+        int buffer = bufferIndex(request.data, request.size);
+        if (buffer >= 0) {
+            sqe.opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe.buf_index = uint16_t(buffer);
+        } else {
+            sqe.opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        }
+        sqe.fd = request.fd;
+        sqe.off = done;
+        sqe.addr = reinterpret_cast<uint64_t>(request.data + done);
+        sqe.len = unsigned(std::min<size_t>(request.size - done, 1u << 30));
+        sqe.user_data = i;
+        sq_array_[slot] = slot;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    // Submit count entries and wait for at least wait completions
+    bool enter(unsigned count, unsigned wait) {
+        for (;;) {
+            long n = syscall(__NR_io_uring_enter, ring_fd_, count, wait, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (n >= 0) {
+                count -= std::min(count, unsigned(n));
+                if (count == 0) return true;
+            } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                return false;
+            }
+        }
+    }
+
+    unsigned sq_entries_;
+    unsigned* sq_tail_;
+    unsigned* sq_mask_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned* cq_mask_;
+    io_uring_cqe* cqes_;
+#else
+    bool setup() { return false; }
+    void teardown() {}
+#endif
+
+    int ring_fd_;
+    unsigned depth_;
+    bool forced_;       // io_uring or nothing
+    unsigned char* ring_map_;
+    size_t ring_size_;
+    unsigned char* cq_map_;
+    size_t cq_size_;
+    void* sqes_;
+    std::vector<iovec> registered_;
+};
+
+#endif // DIP_COMMON_URING_IO_H